@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "func_walker.hh"
+
+// a persistent cache of what exploring a function finds, so a function that hasn't changed since the
+// last build doesn't have to be explored again
+//
+// exploring a function only depends on its own cfg (callees are looked up when the summary is merged,
+// which is cheap), so the key is a hash of the cfg: every action and edge, the lock names and callee
+// names in it, and which locations are the same as each other, but not what the locations are. a header
+// change that moves a function's lines still finds it; the cached locations are indices into the
+// function's distinct locations, and are mapped back onto the current ones when it's found
+//
+// every entry is its own file, written to a temporary name and renamed into place, so any number of
+// compilers can share a cache directory without a lock; a reader sees a whole entry or none, and two
+// writers of the same key write the same thing
+
+namespace lock_checker {
+
+// 128 bits from two differently seeded splitmix64 lanes; not cryptographic, just wide enough that two
+// different functions in one cache won't collide
+struct content_hash {
+    uint64_t a = 0x6a09e667f3bcc908ull, b = 0xbb67ae8584caa73bull;
+
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    void add(uint64_t v) {
+        a = mix(a ^ v);
+        b = mix(b + v + 0x9e3779b97f4a7c15ull);
+    }
+    void add(const std::string& s) {
+        add(s.size());
+        for (size_t i = 0; i < s.size(); i += 8) {
+            uint64_t w = 0;
+            memcpy(&w, s.data() + i, std::min<size_t>(8, s.size() - i));
+            add(w);
+        }
+    }
+};
+
+// what exploring a function found, in the function's own terms: lock masks and indices are over
+// cfg::locks, locations index cfg_fingerprint::locs and callees index cfg_fingerprint::callees
+struct cached_summary {
+    struct err {
+        uint32_t loc, typ;
+    };
+    struct call {
+        uint32_t loc, callee, held;
+    };
+    struct order_edge {
+        uint32_t held, taken, loc;
+    };
+
+    uint32_t blocking_locks = 0;
+    uint32_t limit_hit = kWithinBudget;
+    std::vector<err> errs;
+    std::vector<call> calls;
+    std::vector<order_edge> order_edges;
+};
+
+template <typename T> struct cfg_fingerprint {
+    uint64_t key[2];
+    uint32_t num_locks;
+    std::vector<typename T::Location> locs; // distinct, in the order they first appear, with end_line last
+    std::unordered_map<typename T::Location, uint32_t> loc_index;
+    std::vector<uint32_t> callees; // distinct func_ids, in the order they're first called
+    std::unordered_map<uint32_t, uint32_t> callee_index;
+};
+
+template <typename T> struct analysis_cache {
+    static constexpr uint32_t kMagic = 0x434b434c; // "LCKC"
+    static constexpr uint32_t kVersion = 1;
+
+    std::string dir;
+    // lock ids aren't always meaningful from one compile to the next (the plugin's are tree pointers), so
+    // they're hashed by name
+    std::function<std::string(const typename T::LockId&)> lock_name;
+
+    std::atomic<uint64_t> hits{0}, misses{0}, stores{0}, failed_stores{0};
+
+    analysis_cache(std::string dir_, std::function<std::string(const typename T::LockId&)> lock_name_): dir(std::move(dir_)), lock_name(std::move(lock_name_)) {}
+
+    // sliced is file_checker::slice_locks, which changes what runs out of budget
+    cfg_fingerprint<T> fingerprint(const cfg<T>& fun, const func_table<T>& funcs, explore_engine engine, uint64_t max_states, bool sliced = false) const {
+        cfg_fingerprint<T> fp;
+        fp.num_locks = fun.locks.size();
+        content_hash h;
+        h.add(kVersion);
+        h.add(engine);
+        h.add(max_states);
+        if (sliced) {
+            h.add(std::string("sliced"));
+        }
+
+        h.add(fun.locks.size());
+        for (const auto& lock: fun.locks) {
+            h.add(lock_name(lock));
+        }
+        auto loc = [&](const typename T::Location& l) {
+            auto [it, inserted] = fp.loc_index.try_emplace(l, fp.locs.size());
+            if (inserted) {
+                fp.locs.push_back(l);
+            }
+            return it->second;
+        };
+        h.add(fun.num_actions());
+        for (size_t i = 0; i < fun.num_actions(); i++) {
+            h.add(fun.tags[i]);
+            h.add(loc(fun.locs[i]));
+            if (fun.tags[i] == kCall) {
+                auto [it, inserted] = fp.callee_index.try_emplace(fun.operands[i], fp.callees.size());
+                if (inserted) {
+                    fp.callees.push_back(fun.operands[i]);
+                    h.add(funcs.name(fun.operands[i]));
+                }
+                h.add(it->second);
+            } else {
+                h.add(fun.operands[i]);
+            }
+        }
+        h.add(loc(fun.end_line));
+
+        h.add(fun.num_bbs());
+        for (size_t b = 0; b < fun.num_bbs(); b++) {
+            h.add(fun.action_begin[b]);
+            h.add(fun.action_end[b]);
+            h.add((uint32_t)fun.on_true[b]);
+            h.add((uint32_t)fun.on_false[b]);
+            h.add((uint32_t)fun.depends_on[b]);
+        }
+        h.add(*fun.start_bb);
+        h.add(*fun.end_bb);
+        h.add(fun.fallible_calls);
+
+        fp.key[0] = h.a;
+        fp.key[1] = h.b;
+        return fp;
+    }
+
+    // the entry for a function, if there is one and it fits the function
+    std::optional<cached_summary> load(const cfg_fingerprint<T>& fp) {
+        auto entry = read_entry(fp);
+        (entry ? hits : misses)++;
+        return entry;
+    }
+
+    void store(const cfg_fingerprint<T>& fp, const cached_summary& summary) {
+        std::vector<uint32_t> words = {
+            kMagic, kVersion,
+            (uint32_t)fp.key[0], (uint32_t)(fp.key[0] >> 32), (uint32_t)fp.key[1], (uint32_t)(fp.key[1] >> 32),
+            summary.blocking_locks, summary.limit_hit,
+            (uint32_t)summary.errs.size(), (uint32_t)summary.calls.size(), (uint32_t)summary.order_edges.size(),
+        };
+        for (const auto& e: summary.errs) {
+            words.insert(words.end(), {e.loc, e.typ});
+        }
+        for (const auto& c: summary.calls) {
+            words.insert(words.end(), {c.loc, c.callee, c.held});
+        }
+        for (const auto& e: summary.order_edges) {
+            words.insert(words.end(), {e.held, e.taken, e.loc});
+        }
+        (write_atomically(fp, words) ? stores : failed_stores)++;
+    }
+
+    // hits / (hits + misses)
+    double hit_rate() const {
+        const uint64_t total = hits + misses;
+        return total == 0 ? 0.0 : (double)hits / total;
+    }
+
+private:
+    static constexpr size_t kHeaderWords = 11;
+
+    std::atomic<uint64_t> next_temp{0};
+
+    std::string subdir(const cfg_fingerprint<T>& fp) const {
+        char name[4];
+        snprintf(name, sizeof(name), "%02x", (unsigned)(fp.key[0] >> 56));
+        return dir + "/" + name;
+    }
+    std::string path(const cfg_fingerprint<T>& fp) const {
+        char name[40];
+        snprintf(name, sizeof(name), "/%016llx%016llx", (unsigned long long)fp.key[0], (unsigned long long)fp.key[1]);
+        return subdir(fp) + name;
+    }
+
+    std::optional<cached_summary> read_entry(const cfg_fingerprint<T>& fp) const {
+        const int fd = open(path(fp).c_str(), O_RDONLY);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        std::vector<uint32_t> words;
+        uint32_t buf[1024];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            words.insert(words.end(), buf, buf + n / 4);
+        }
+        close(fd);
+
+        if (words.size() < kHeaderWords || words[0] != kMagic || words[1] != kVersion
+                || words[2] != (uint32_t)fp.key[0] || words[3] != (uint32_t)(fp.key[0] >> 32)
+                || words[4] != (uint32_t)fp.key[1] || words[5] != (uint32_t)(fp.key[1] >> 32)
+                || words.size() != kHeaderWords + 2ull * words[8] + 3ull * words[9] + 3ull * words[10]) {
+            return std::nullopt;
+        }
+        cached_summary s;
+        s.blocking_locks = words[6];
+        s.limit_hit = words[7];
+        const uint32_t* p = &words[kHeaderWords];
+        for (uint32_t i = 0; i < words[8]; i++, p += 2) {
+            s.errs.push_back({p[0], p[1]});
+        }
+        for (uint32_t i = 0; i < words[9]; i++, p += 3) {
+            s.calls.push_back({p[0], p[1], p[2]});
+        }
+        for (uint32_t i = 0; i < words[10]; i++, p += 3) {
+            s.order_edges.push_back({p[0], p[1], p[2]});
+        }
+
+        // whatever's in the file is used to index into the function, so it has to fit
+        const uint32_t lock_mask = fp.num_locks >= 32 ? ~0u : (1u << fp.num_locks) - 1;
+        bool fits = (s.blocking_locks & ~lock_mask) == 0 && s.limit_hit <= kTimeLimit;
+        for (const auto& e: s.errs) {
+            fits &= e.loc < fp.locs.size();
+        }
+        for (const auto& c: s.calls) {
+            fits &= c.loc < fp.locs.size() && c.callee < fp.callees.size() && (c.held & ~lock_mask) == 0;
+        }
+        for (const auto& e: s.order_edges) {
+            fits &= e.loc < fp.locs.size() && e.held < fp.num_locks && e.taken < fp.num_locks;
+        }
+        return fits ? std::optional<cached_summary>(std::move(s)) : std::nullopt;
+    }
+
+    bool write_atomically(const cfg_fingerprint<T>& fp, const std::vector<uint32_t>& words) {
+        mkdir(dir.c_str(), 0777);
+        mkdir(subdir(fp).c_str(), 0777);
+        const std::string final_path = path(fp);
+        const std::string temp_path = final_path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(next_temp++);
+        const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0) {
+            return false;
+        }
+        const size_t size = words.size() * 4;
+        const bool written = write(fd, words.data(), size) == (ssize_t)size;
+        const bool closed = close(fd) == 0;
+        if (!written || !closed || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+            unlink(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+}
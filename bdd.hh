@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// a small reduced ordered binary decision diagram package
+//
+// this is used to represent sets of fallible lock call results symbolically; variable i is
+// bit i of a lock_state<fallible_lock>, so a set of fallible_locks values can be stored
+// without enumerating every combination of them
+//
+// nodes are hash consed, so two equal sets always end up with the same ref; this makes
+// checking if a set has changed a single comparison
+
+namespace lock_checker {
+
+struct bdd {
+    using ref = uint32_t;
+
+    static constexpr ref kFalse = 0;
+    static constexpr ref kTrue = 1;
+    static constexpr uint32_t kTerminal = 0xffffffff; // variable index used for the two terminals
+
+    struct node {
+        uint32_t var;
+        ref lo, hi;
+
+        bool operator==(const node& other) const {
+            return var == other.var && lo == other.lo && hi == other.hi;
+        }
+    };
+
+    struct node_hash {
+        std::size_t operator()(const node& n) const {
+            uint64_t h = ((uint64_t)n.lo << 32) | n.hi;
+            h ^= (uint64_t)n.var * 0x9e3779b97f4a7c15ull;
+            h ^= h >> 31;
+            h *= 0xbf58476d1ce4e5b9ull;
+            return h ^ (h >> 29);
+        }
+    };
+
+    enum op {
+        kAnd,
+        kOr,
+        kDiff, // a & ~b
+    };
+
+    std::vector<node> nodes;
+    std::unordered_map<node, ref, node_hash> unique;
+    std::unordered_map<node, ref, node_hash> op_cache; // reuses node as a key; var holds the op
+
+    bdd(): nodes{{kTerminal, kFalse, kFalse}, {kTerminal, kTrue, kTrue}} {}
+
+    ref mk(uint32_t var, ref lo, ref hi) {
+        if (lo == hi) {
+            return lo;
+        }
+        node n = {var, lo, hi};
+        if (auto it = unique.find(n); it != unique.end()) {
+            return it->second;
+        }
+        ref r = nodes.size();
+        nodes.push_back(n);
+        unique[n] = r;
+        return r;
+    }
+
+    // the set of all values with bit v set/cleared
+    ref var(uint32_t v) {
+        return mk(v, kFalse, kTrue);
+    }
+    ref not_var(uint32_t v) {
+        return mk(v, kTrue, kFalse);
+    }
+
+    // the set containing only mask, over the variables [0, num_vars)
+    ref single(uint32_t mask, uint32_t num_vars) {
+        ref r = kTrue;
+        for (uint32_t v = num_vars; v-- > 0;) {
+            r = ((mask >> v) & 1) ? mk(v, kFalse, r) : mk(v, r, kFalse);
+        }
+        return r;
+    }
+
+    ref apply(op o, ref a, ref b) {
+        switch (o) {
+        case kAnd:
+            if (a == kFalse || b == kFalse) return kFalse;
+            if (a == kTrue || a == b) return b;
+            if (b == kTrue) return a;
+            break;
+        case kOr:
+            if (a == kTrue || b == kTrue) return kTrue;
+            if (a == kFalse || a == b) return b;
+            if (b == kFalse) return a;
+            break;
+        case kDiff:
+            if (a == kFalse || b == kTrue || a == b) return kFalse;
+            if (b == kFalse) return a;
+            break;
+        }
+
+        node key = {(uint32_t)o, a, b};
+        if (auto it = op_cache.find(key); it != op_cache.end()) {
+            return it->second;
+        }
+
+        // terminals have the largest variable index, so this always picks a real variable
+        const uint32_t v = std::min(nodes[a].var, nodes[b].var);
+        const ref a_lo = (nodes[a].var == v) ? nodes[a].lo : a;
+        const ref a_hi = (nodes[a].var == v) ? nodes[a].hi : a;
+        const ref b_lo = (nodes[b].var == v) ? nodes[b].lo : b;
+        const ref b_hi = (nodes[b].var == v) ? nodes[b].hi : b;
+
+        ref lo = apply(o, a_lo, b_lo);
+        ref hi = apply(o, a_hi, b_hi);
+        ref r = mk(v, lo, hi);
+        op_cache[key] = r;
+        return r;
+    }
+
+    ref and_(ref a, ref b) {
+        return apply(kAnd, a, b);
+    }
+    ref or_(ref a, ref b) {
+        return apply(kOr, a, b);
+    }
+    ref diff(ref a, ref b) {
+        return apply(kDiff, a, b);
+    }
+
+    // removes variable v from the set (existential quantification)
+    ref forget(ref f, uint32_t v) {
+        return forget_all(f, 1u << v);
+    }
+
+    // removes every variable in the mask vars from the set in one pass; memoized per call, since
+    // without it a node reachable along many paths would be walked once for each of them
+    ref forget_all(ref f, uint32_t vars) {
+        std::unordered_map<ref, ref> memo;
+        return forget_from(f, vars, memo);
+    }
+
+    // the image of f after overwriting bit v with val in every element
+    ref assign(ref f, uint32_t v, bool val) {
+        return and_(forget(f, v), val ? var(v) : not_var(v));
+    }
+
+    // the image of f after clearing every bit in the mask vars in every element
+    ref clear_all(ref f, uint32_t vars) {
+        ref cleared = kTrue;
+        for (uint32_t v = 32; v-- > 0;) {
+            if ((vars >> v) & 1) {
+                cleared = mk(v, cleared, kFalse);
+            }
+        }
+        return and_(forget_all(f, vars), cleared);
+    }
+
+    // returns some element of a nonempty set; unconstrained bits are left cleared
+    uint32_t any(ref f) const {
+        uint32_t mask = 0;
+        while (nodes[f].var != kTerminal) {
+            if (nodes[f].lo != kFalse) {
+                f = nodes[f].lo;
+            } else {
+                mask |= 1u << nodes[f].var;
+                f = nodes[f].hi;
+            }
+        }
+        return mask;
+    }
+
+    // number of elements in the set over the variables [0, num_vars)
+    uint64_t count(ref f, uint32_t num_vars) const {
+        std::unordered_map<ref, uint64_t> memo;
+        return count_from(f, 0, num_vars, memo);
+    }
+
+private:
+    ref forget_from(ref f, uint32_t vars, std::unordered_map<ref, ref>& memo) {
+        // nothing below a node has a smaller variable than it does
+        const uint32_t v = nodes[f].var;
+        if (v == kTerminal || (uint64_t)vars >> v == 0) {
+            return f;
+        }
+        if (auto it = memo.find(f); it != memo.end()) {
+            return it->second;
+        }
+        const ref lo = forget_from(nodes[f].lo, vars, memo);
+        const ref hi = forget_from(nodes[f].hi, vars, memo);
+        const ref r = ((vars >> v) & 1) ? or_(lo, hi) : mk(v, lo, hi);
+        memo[f] = r;
+        return r;
+    }
+
+    uint64_t count_from(ref f, uint32_t level, uint32_t num_vars, std::unordered_map<ref, uint64_t>& memo) const {
+        if (f == kFalse) {
+            return 0;
+        }
+        const uint32_t v = (nodes[f].var == kTerminal) ? num_vars : nodes[f].var;
+        uint64_t skipped = 1ull << (v - level);
+        if (f == kTrue) {
+            return skipped;
+        }
+        if (auto it = memo.find(f); it != memo.end()) {
+            return skipped * it->second;
+        }
+        uint64_t c = count_from(nodes[f].lo, v + 1, num_vars, memo) + count_from(nodes[f].hi, v + 1, num_vars, memo);
+        memo[f] = c;
+        return skipped * c;
+    }
+};
+
+}
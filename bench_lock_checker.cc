@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "cfg_generator.hh"
+#include "file_checker.hh"
+#include "func_walker.hh"
+
+// timing harness for the parts of the checker that get slow on big translation units
+//
+// run with no arguments to run everything, or with the names of the benchmarks to run; every
+// input is generated from a fixed seed, so the numbers are comparable between runs and commits
+
+using namespace lock_checker;
+
+struct BasicAdapter {
+    using FuncId = std::string;
+    using Location = int;
+    using LockId = int;
+};
+
+using checker = file_checker<BasicAdapter>;
+using summary = checker::function_summary;
+
+// every allocation the process makes goes through here, so each benchmark can report how much
+// it allocated as well as how long it took
+static std::atomic<uint64_t> bytes_allocated{0}, allocations{0};
+
+// every form of new and delete is replaced, all going through these two, so whichever delete gcc
+// sees a new paired with frees what it allocated (or -Wall warns with -Wmismatched-new-delete)
+static void* counted_malloc(size_t n) {
+    bytes_allocated.fetch_add(n, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(n == 0 ? 1 : n)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+static void counted_free(void* p) noexcept {
+    free(p);
+}
+
+void* operator new(size_t n) {
+    return counted_malloc(n);
+}
+void* operator new[](size_t n) {
+    return counted_malloc(n);
+}
+void operator delete(void* p) noexcept {
+    counted_free(p);
+}
+void operator delete[](void* p) noexcept {
+    counted_free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    counted_free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    counted_free(p);
+}
+
+struct measurement {
+    double min_ms, median_ms;
+    uint64_t bytes, allocs; // per run
+    uint64_t total_allocs; // over every run, so a few allocations don't round down to 0 allocs
+};
+
+// runs f reps times
+static measurement measure(int reps, const std::function<void()>& f) {
+    std::vector<double> times;
+    times.reserve(reps); // so only f's allocations are counted
+    const uint64_t bytes_before = bytes_allocated, allocs_before = allocations;
+    for (int i = 0; i < reps; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        times.push_back(ms_since(start));
+    }
+    const uint64_t total_allocs = allocations - allocs_before;
+    const uint64_t bytes = (bytes_allocated - bytes_before) / reps;
+    std::sort(times.begin(), times.end());
+    return {times[0], times[times.size() / 2], bytes, total_allocs / reps, total_allocs};
+}
+
+// checks that fail, for the exit status
+static int failures = 0;
+
+// prints one line per benchmark; states is how many states each run visits, or 0 if it doesn't apply
+static void report(const std::string& name, const measurement& m, uint64_t states = 0) {
+    printf("%-52s min %9.2f ms  median %9.2f ms", name.c_str(), m.min_ms, m.median_ms);
+    if (states != 0) {
+        printf("  %10.3g states/s", states / (m.median_ms / 1000));
+    }
+    printf("  %10.3g bytes %9llu allocs\n", (double)m.bytes, (unsigned long long)m.allocs);
+}
+
+static void time_it(const std::string& name, int reps, const std::function<void()>& f) {
+    report(name, measure(reps, f));
+}
+
+// small deterministic generator so runs are comparable
+struct rng {
+    uint64_t s;
+
+    uint32_t next() {
+        s = s * 6364136223846793005ull + 1442695040888963407ull;
+        return s >> 33;
+    }
+    uint32_t below(uint32_t n) {
+        return next() % n;
+    }
+};
+
+// the locks synthetic_call_graph's summaries use
+static void add_synthetic_locks(checker& fc) {
+    fc.add_locks(std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7});
+}
+
+// a call graph shaped like a big firmware image: function i mostly calls functions after it,
+// a few of the calls go back up to make recursive cycles, and a handful of leaves take one of
+// the 8 locks with a blocking call; fc gets the locks and function names it needs
+static std::vector<std::pair<std::string, summary>> synthetic_call_graph(checker& fc, int n, uint64_t seed) {
+    add_synthetic_locks(fc);
+    rng r{seed};
+    std::vector<std::pair<std::string, summary>> fs;
+    for (int i = 0; i < n; i++) {
+        summary s;
+        if (r.below(100) < 2) {
+            s.blocking_locks = {1u << r.below(8)};
+        }
+        const int num_calls = 1 + r.below(4);
+        for (int c = 0; c < num_calls; c++) {
+            int callee;
+            if (r.below(100) < 5) {
+                callee = r.below(i + 1);
+            } else if (i + 1 < n) {
+                callee = i + 1 + r.below(std::min(n - i - 1, 200));
+            } else {
+                continue;
+            }
+            const lock_state<checker> held = {r.below(100) < 10 ? 1u << r.below(8) : 0u};
+            s.calls.push_back({i * 10 + c, fc.func_ids.intern("f" + std::to_string(callee)), held});
+        }
+        fs.push_back({"f" + std::to_string(i), std::move(s)});
+    }
+    return fs;
+}
+
+// check_callers as it was before it was made iterative, kept to compare against
+static void recursive_check_callers(checker& fc, const std::string& callee, std::unordered_map<int, errors>& line_errors) {
+    if (const auto it = fc.called_by.find(callee); it != fc.called_by.end()) {
+        for (const auto& cs: it->second) {
+            if ((fc.blocking_locks_used[callee] & cs.cur_lock_state) != 0) {
+                line_errors[cs.loc].add(errors::call_with_blocking_lock("blocking lock used by caller"));
+            }
+            const auto old_locks = fc.blocking_locks_used[cs.caller];
+            fc.blocking_locks_used[cs.caller] = fc.blocking_locks_used[cs.caller] | fc.blocking_locks_used[callee];
+            if (old_locks != fc.blocking_locks_used[cs.caller]) {
+                recursive_check_callers(fc, cs.caller, line_errors);
+            }
+        }
+    }
+}
+
+// checker::merge, but using recursive_check_callers
+static void recursive_merge(checker& fc, const std::string& name, const summary& s, std::unordered_map<int, errors>& line_errors) {
+    lock_state<checker> blocking_locks = s.blocking_locks;
+    for (const auto& c: s.calls) {
+        const auto& called_func = fc.func_ids.name(c.callee);
+        if (auto it = fc.blocking_locks_used.find(called_func); it != fc.blocking_locks_used.end()) {
+            if ((c.held & it->second) != 0) {
+                line_errors[c.loc].add(errors::call_with_blocking_lock(""));
+            }
+            blocking_locks = blocking_locks | it->second;
+        }
+        fc.called_by[called_func].push_back(callsite<BasicAdapter>{c.loc, c.held, name});
+    }
+    fc.blocking_locks_used[name] = blocking_locks;
+    recursive_check_callers(fc, name, line_errors);
+}
+
+static size_t count_errors(const std::unordered_map<int, errors>& line_errors) {
+    size_t n = 0;
+    for (const auto& [_, e]: line_errors) {
+        n += e.errs.size();
+    }
+    return n;
+}
+
+// the same, counting each (location, error type) once
+static size_t count_unique_errors(const std::unordered_map<int, errors>& line_errors) {
+    size_t n = 0;
+    for (const auto& [_, e]: line_errors) {
+        std::vector<int> types;
+        for (const auto& err: e.errs) {
+            types.push_back(err.typ);
+        }
+        std::sort(types.begin(), types.end());
+        n += std::unique(types.begin(), types.end()) - types.begin();
+    }
+    return n;
+}
+
+// merges every function of a 10k function call graph; callers first means the locks taken by the
+// leaves have to be pushed up through everything that was already merged, callees first means
+// there's almost nothing to push
+static void bench_check_callers() {
+    checker graph_names;
+    auto fs = synthetic_call_graph(graph_names, 10000, 1);
+
+    for (const bool callers_first: {true, false}) {
+        if (!callers_first) {
+            std::reverse(fs.begin(), fs.end());
+        }
+        const std::string order = callers_first ? "callers first" : "callees first";
+
+        size_t recursive_errors = 0, scc_errors = 0, recursive_unique = 0, scc_unique = 0;
+        time_it("check_callers/recursive/10k/" + order, 5, [&] {
+            checker fc;
+            fc.func_ids = graph_names.func_ids;
+            add_synthetic_locks(fc);
+            std::unordered_map<int, errors> line_errors;
+            for (const auto& [name, s]: fs) {
+                recursive_merge(fc, name, s, line_errors);
+            }
+            recursive_errors = count_errors(line_errors);
+            recursive_unique = count_unique_errors(line_errors);
+        });
+        time_it("check_callers/scc/10k/" + order, 5, [&] {
+            checker fc;
+            fc.func_ids = graph_names.func_ids;
+            add_synthetic_locks(fc);
+            std::unordered_map<int, errors> line_errors;
+            for (const auto& [name, s]: fs) {
+                fc.merge(name, s, line_errors);
+            }
+            scc_errors = count_errors(line_errors);
+            scc_unique = count_unique_errors(line_errors);
+        });
+        // the recursive version reports a call again every time the callee gains a lock, but both find
+        // the same calls (test_check_callers.test_matches_recursive)
+        printf("    errors reported: recursive %zu, scc %zu; unique: recursive %zu, scc %zu\n", recursive_errors, scc_errors, recursive_unique, scc_unique);
+    }
+}
+
+// explores one generated function with each engine, growing the function and then the number of
+// fallible takes to show how each engine scales
+static void bench_explore() {
+    struct shape {
+        int bbs, fallible_takes;
+    };
+    const std::vector<shape> shapes = {{64, 8}, {256, 8}, {1024, 8}, {4096, 8}, {256, 4}, {256, 12}, {256, 16}};
+
+    for (const auto& sh: shapes) {
+        generator_options options;
+        options.bbs = sh.bbs;
+        options.fallible_takes = sh.fallible_takes;
+        const auto fun = random_func<BasicAdapter>(options, 1);
+        func_table<BasicAdapter> funcs;
+        const auto graph = cfg<BasicAdapter>::build(fun, funcs);
+
+        for (const auto engine: {kBreadthFirst, kSymbolic, kDataflow}) {
+            const std::string name = std::string("explore/") + engine_name(engine) + "/" + std::to_string(sh.bbs) + "bb/" + std::to_string(sh.fallible_takes) + "takes";
+            explore_stats counters;
+            const auto m = measure(5, [&] {
+                counters = {};
+                uint64_t callbacks = 0;
+                graph.template explore_using<int>(engine, [&](edge_state<BasicAdapter, int>&, const action_ref<BasicAdapter>&) {
+                    callbacks++;
+                }, 0, std::nullopt, &counters);
+            });
+            report(name, m, counters.states_visited);
+        }
+    }
+}
+
+// how long lookups in the visited set are, for every state of a function with a lot of them (8 locks,
+// 12 fallible takes): the robin hood state_set the breadth first engine uses, against std::unordered_set
+// with the hash edge_state has now and with the xor-and-shift one it had before. for state_set a probe
+// is a slot looked at; for unordered_set it's a node in the key's bucket, which is what a lookup walks
+static void bench_probes() {
+    generator_options options;
+    options.bbs = 256;
+    options.locks = 8;
+    options.fallible_takes = 12;
+    const auto fun = random_func<BasicAdapter>(options, 1);
+    func_table<BasicAdapter> funcs;
+    const auto graph = cfg<BasicAdapter>::build(fun, funcs);
+    const auto layout = graph.key_layout();
+
+    visited_states<BasicAdapter, int> visited(layout);
+    auto ignore = [](edge_state<BasicAdapter, int>&, const action_ref<BasicAdapter>&) {};
+    graph.template explore_with<int>(visited, ignore, 0);
+    std::vector<edge_state<BasicAdapter, int>> states;
+    visited.packed.for_each([&](uint64_t key) {
+        states.push_back(layout.unpack<BasicAdapter>(key, 0));
+    });
+
+    auto print = [&](const char* name, double mean, size_t longest) {
+        printf("%-52s %zu states  mean probe %5.2f  max probe %3zu\n", name, states.size(), mean, longest);
+    };
+    double dist_sum = 0;
+    for (size_t i = 0; i < visited.packed.capacity(); i++) {
+        dist_sum += visited.packed.dists[i];
+    }
+    print("probes/state_set", dist_sum / states.size(), visited.packed.longest_probe());
+
+    struct xor_shift_hash {
+        size_t operator()(const edge_state<BasicAdapter, int>& es) const {
+            return std::hash<uint32_t>{}(es.fallible_locks.state) ^ (std::hash<int>{}(*es.bb_idx) << 1) ^ (std::hash<uint32_t>{}(es.cur_lock_state.state) << 2);
+        }
+    };
+    auto buckets = [&](const char* name, auto set) {
+        set.insert(states.begin(), states.end());
+        double sum = 0;
+        size_t longest = 0;
+        for (const auto& es: states) {
+            const size_t n = set.bucket_size(set.bucket(es));
+            sum += n;
+            longest = std::max(longest, n);
+        }
+        print(name, sum / states.size(), longest);
+    };
+    buckets("probes/unordered_set/mixed_hash", std::unordered_set<edge_state<BasicAdapter, int>>{});
+    buckets("probes/unordered_set/xor_shift_hash", std::unordered_set<edge_state<BasicAdapter, int>, xor_shift_hash>{});
+}
+
+// explores small generated functions, about the size of the ones in the tests, with the per-thread bitmap
+// and queue the breadth first engine uses for them and with the hash table and heap queue it uses for
+// everything else; each run explores every function 1000 times. once the thread's scratch has grown to
+// fit (in the untimed first explore), the dense path mustn't allocate at all, and the benchmark fails if it does
+static void bench_explore_small() {
+    struct shape {
+        int bbs, locks, fallible_takes;
+    };
+    const std::vector<shape> shapes = {{8, 1, 1}, {16, 2, 2}, {32, 2, 4}, {64, 3, 6}};
+
+    for (const auto& sh: shapes) {
+        generator_options options;
+        options.bbs = sh.bbs;
+        options.locks = sh.locks;
+        options.fallible_takes = sh.fallible_takes;
+        const auto fun = random_func<BasicAdapter>(options, 1);
+        func_table<BasicAdapter> funcs;
+        const auto graph = cfg<BasicAdapter>::build(fun, funcs);
+        const auto layout = graph.key_layout();
+        const uint32_t key_bits = layout.fallible_bits + layout.lock_bits + layout.bb_bits;
+
+        uint64_t callbacks = 0;
+        auto count = [&](edge_state<BasicAdapter, int>&, const action_ref<BasicAdapter>&) {
+            callbacks++;
+        };
+        explore_stats counters;
+        graph.template explore<int>(count, 0, std::nullopt, &counters);
+
+        const std::string suffix = "/" + std::to_string(sh.bbs) + "bb/" + std::to_string(key_bits) + "bits";
+        const auto dense = measure(5, [&] {
+            for (int i = 0; i < 1000; i++) {
+                graph.template explore<int>(count, 0);
+            }
+        });
+        report(std::string("explore_small/") + (graph.explores_dense() ? "dense" : "not_dense") + suffix, dense, counters.states_visited * 1000);
+        if (graph.explores_dense() && dense.total_allocs != 0) {
+            fprintf(stderr, "FAILED: explore_small/dense%s allocated %llu times\n", suffix.c_str(), (unsigned long long)dense.total_allocs);
+            failures++;
+        }
+        report("explore_small/hashed" + suffix, measure(5, [&] {
+            for (int i = 0; i < 1000; i++) {
+                visited_states<BasicAdapter, int> visited(layout);
+                graph.template explore_with<int>(visited, count, 0);
+            }
+        }), counters.states_visited * 1000);
+    }
+}
+
+// the whole per-function pipeline (cfg build, explore, merge) over a generated call graph, serially
+// and on the thread pool
+static void bench_process_function() {
+    for (const int n: {100, 1000}) {
+        generator_options options;
+        options.bbs = 64;
+        const auto fs = random_call_graph<BasicAdapter>(n, options, 1);
+
+        for (const auto engine: {kBreadthFirst, kSymbolic, kDataflow}) {
+            // states are counted in a separate run so the timed runs don't pay for the stats
+            file_checker<BasicAdapter, collect_stats> counted;
+            counted.engine = engine;
+            std::unordered_map<int, errors> counted_errors;
+            for (const auto& [name, fun]: fs) {
+                counted.process_function(name, fun, counted_errors);
+            }
+            uint64_t states = 0;
+            for (const auto& [_, st]: counted.stats) {
+                states += st.explore.states_visited;
+            }
+
+            const std::string suffix = std::string("/") + engine_name(engine) + "/" + std::to_string(n) + "funcs";
+            report("process_function" + suffix, measure(5, [&] {
+                checker fc;
+                fc.engine = engine;
+                std::unordered_map<int, errors> line_errors;
+                for (const auto& [name, fun]: fs) {
+                    fc.process_function(name, fun, line_errors);
+                }
+            }), states);
+            report("process_functions/4threads" + suffix, measure(5, [&] {
+                checker fc;
+                fc.engine = engine;
+                std::vector<std::pair<std::string, cfg<BasicAdapter>>> batch;
+                for (const auto& [name, fun]: fs) {
+                    batch.push_back({name, cfg<BasicAdapter>::build(fun, fc.func_ids)});
+                }
+                std::unordered_map<int, errors> line_errors;
+                fc.process_functions(std::move(batch), line_errors, 4);
+            }), states);
+        }
+    }
+}
+
+// n locks, each maybe taken on the way in and maybe given on the way out, so every combination of them
+// can be held in the middle
+static func<BasicAdapter> held_across_branches(int n) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    func<BasicAdapter> fun = {};
+    for (int i = 0; i < 2 * n; i++) {
+        const int lock = i % n;
+        if (i < n) {
+            fun.locks.push_back(lock);
+        }
+        const int b = fun.bbs.size();
+        fun.bbs.push_back({ .next = { {b + 1}, {b + 2} } });
+        fun.bbs.push_back({ .actions = { i < n ? a::lock_(10 * i, ix{lock}) : a::unlock_(10 * i, ix{lock}) }, .next = { {b + 2} } });
+        fun.bbs.push_back({ .actions = { a::call_(10 * i + 1, std::string("g")) }, .next = { {b + 3} } });
+    }
+    fun.bbs.push_back({});
+    fun.start_bb = {0};
+    fun.end_bb = {(int)fun.bbs.size() - 1};
+    return fun;
+}
+
+// exploring functions whole and one lock at a time, on functions that only ever hold one lock at once
+// (where slicing only adds work) and on ones that hold lots of them together (where it takes it away)
+static void bench_slices() {
+    generator_options options;
+    options.bbs = 96;
+    options.locks = 10;
+    options.fallible_takes = 2;
+    const std::vector<std::pair<std::string, std::vector<std::pair<std::string, func<BasicAdapter>>>>> inputs = {
+        {"generated", random_call_graph<BasicAdapter>(200, options, 5)},
+        {"held_across_branches", {{"f", held_across_branches(14)}}},
+    };
+
+    for (const auto& [input, fs]: inputs) {
+        for (const auto engine: {kBreadthFirst, kSymbolic, kDataflow}) {
+            for (const bool slice_locks: {false, true}) {
+                file_checker<BasicAdapter, collect_stats> counted;
+                counted.engine = engine;
+                counted.slice_locks = slice_locks;
+                std::unordered_map<int, errors> counted_errors;
+                for (const auto& [name, fun]: fs) {
+                    counted.process_function(name, fun, counted_errors);
+                }
+                uint64_t states = 0;
+                for (const auto& [_, st]: counted.stats) {
+                    states += st.explore.states_visited;
+                }
+
+                const std::string name = "slices/" + input + "/" + engine_name(engine) + (slice_locks ? "/sliced" : "/whole");
+                report(name, measure(5, [&] {
+                    checker fc;
+                    fc.engine = engine;
+                    fc.slice_locks = slice_locks;
+                    std::unordered_map<int, errors> line_errors;
+                    for (const auto& [name, fun]: fs) {
+                        fc.process_function(name, fun, line_errors);
+                    }
+                }), states);
+            }
+        }
+    }
+}
+
+static const std::vector<std::pair<const char*, void (*)()>> benchmarks = {
+    {"explore", bench_explore},
+    {"explore_small", bench_explore_small},
+    {"probes", bench_probes},
+    {"process_function", bench_process_function},
+    {"check_callers", bench_check_callers},
+    {"slices", bench_slices},
+};
+
+int main(int argc, char** argv) {
+    for (const auto& [name, run]: benchmarks) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++) {
+            selected |= strcmp(argv[i], name) == 0;
+        }
+        if (selected) {
+            run();
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
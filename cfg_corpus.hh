@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "file_checker.hh"
+#include "func_walker.hh"
+#include "unit_summary.hh"
+
+// a recording of every function the plugin hands to file_checker, so the checker can be run on real
+// code again without the compiler (see lock_checker_replay.cc)
+//
+// a corpus file is any number of unit records one after another, one per translation unit, each
+// written with a single append so parallel compiles can share a file. a record is a run of uint32s
+// in host byte order (it's only meant to be read on the machine that made it):
+//
+//     magic version num_functions num_strings function_words string_bytes unit_name
+//     function_words words of functions, each one of
+//         0 name num_locks locks[num_locks] num_bbs num_actions start_bb end_bb end_file end_line
+//           bbs[num_bbs] (action_begin action_end on_true on_false depends_on, -1 for none)
+//           actions[num_actions] (tag operand file line; a call's operand is the callee's name)
+//         1 name num_calls calls[num_calls] (callee file line), for a function that never takes or gives a lock
+//     string_offsets[num_strings]
+//     string bytes, each NUL terminated, padded to a multiple of 4
+//
+// names are string indices; locks are recorded by name and locations as file and line
+
+namespace lock_checker {
+
+// the ids a replayed unit uses: a lock is the index of its name in the unit's strings, so locks with
+// the same name are the same lock, as they are in the plugin, and a location is file << 32 | line
+struct ReplayAdapter {
+    using FuncId = std::string;
+    using Location = uint64_t;
+    using LockId = uint32_t;
+};
+
+inline uint64_t replay_location(uint32_t file, uint32_t line) {
+    return (uint64_t)file << 32 | line;
+}
+
+struct corpus_writer {
+    static constexpr uint32_t kMagic = 0x524b434c; // "LCKR"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderWords = 7;
+    enum : uint32_t { kCfg = 0, kLockFree = 1 };
+
+    // lock_name turns a T::LockId into a std::string, and where a T::Location into a source_location
+    template <typename T, typename L, typename W>
+    void add_function(const std::string& name, const cfg<T>& fun, const func_table<T>& funcs, L lock_name, W where) {
+        num_functions++;
+        words.insert(words.end(), {kCfg, intern(name), (uint32_t)fun.locks.size()});
+        for (const auto& lock: fun.locks) {
+            words.push_back(intern(lock_name(lock)));
+        }
+        const source_location end = where(fun.end_line);
+        words.insert(words.end(), {(uint32_t)fun.num_bbs(), (uint32_t)fun.num_actions(), (uint32_t)*fun.start_bb, (uint32_t)*fun.end_bb,
+                intern(end.file), end.line});
+        for (size_t b = 0; b < fun.num_bbs(); b++) {
+            words.insert(words.end(), {fun.action_begin[b], fun.action_end[b], (uint32_t)fun.on_true[b], (uint32_t)fun.on_false[b], (uint32_t)fun.depends_on[b]});
+        }
+        for (size_t i = 0; i < fun.num_actions(); i++) {
+            const source_location loc = where(fun.locs[i]);
+            const uint32_t operand = fun.tags[i] == kCall ? intern(funcs.name(fun.operands[i])) : fun.operands[i];
+            words.insert(words.end(), {(uint32_t)fun.tags[i], operand, intern(loc.file), loc.line});
+        }
+    }
+
+    template <typename Loc, typename W>
+    void add_lock_free_function(const std::string& name, const std::vector<std::pair<Loc, std::string>>& calls, W where) {
+        num_functions++;
+        words.insert(words.end(), {kLockFree, intern(name), (uint32_t)calls.size()});
+        for (const auto& [loc, callee]: calls) {
+            const source_location l = where(loc);
+            words.insert(words.end(), {intern(callee), intern(l.file), l.line});
+        }
+    }
+
+    bool empty() const {
+        return num_functions == 0;
+    }
+
+    // the record for everything added so far, after which the writer starts over
+    std::string finish(const std::string& unit) {
+        const uint32_t unit_name = intern(unit);
+        std::vector<uint32_t> header = {kMagic, kVersion, num_functions, (uint32_t)strings.size(), (uint32_t)words.size(), 0, unit_name};
+        std::string blob;
+        std::vector<uint32_t> offsets;
+        for (const auto& s: strings) {
+            offsets.push_back(blob.size());
+            blob += s;
+            blob += '\0';
+        }
+        blob.resize((blob.size() + 3) & ~(size_t)3, '\0');
+        header[5] = blob.size();
+
+        std::string out;
+        out.append((const char*)header.data(), header.size() * 4);
+        out.append((const char*)words.data(), words.size() * 4);
+        out.append((const char*)offsets.data(), offsets.size() * 4);
+        out += blob;
+        *this = corpus_writer{};
+        return out;
+    }
+
+private:
+    std::vector<uint32_t> words;
+    uint32_t num_functions = 0;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> string_ids;
+
+    uint32_t intern(const std::string& s) {
+        if (auto it = string_ids.find(s); it != string_ids.end()) {
+            return it->second;
+        }
+        const uint32_t id = strings.size();
+        string_ids[s] = id;
+        strings.push_back(s);
+        return id;
+    }
+};
+
+// one unit record, read where it lies
+struct corpus_unit {
+    const uint32_t* words = nullptr; // the corpus has to be 4-byte aligned, which a mapped file is
+    size_t size = 0; // in bytes
+
+    static std::optional<corpus_unit> open(const void* p, size_t available) {
+        corpus_unit u;
+        u.words = (const uint32_t*)p;
+        if (available < corpus_writer::kHeaderWords * 4 || u.words[0] != corpus_writer::kMagic || u.words[1] != corpus_writer::kVersion) {
+            return std::nullopt;
+        }
+        const uint64_t size = 4 * (corpus_writer::kHeaderWords + (uint64_t)u.words[4] + u.words[3]) + u.words[5];
+        if (size > available || u.words[5] % 4 != 0 || u.num_strings() == 0 || u.words[6] >= u.num_strings()) {
+            return std::nullopt;
+        }
+        u.size = size;
+        const char* blob = (const char*)p + size - u.words[5];
+        if (u.words[5] == 0 || blob[u.words[5] - 1] != '\0') {
+            return std::nullopt;
+        }
+        for (uint32_t i = 0; i < u.num_strings(); i++) {
+            if (u.string_offsets()[i] >= u.words[5]) {
+                return std::nullopt;
+            }
+        }
+        return u;
+    }
+
+    uint32_t num_functions() const { return words[2]; }
+    uint32_t num_strings() const { return words[3]; }
+    const char* name() const { return string(words[6]); }
+
+    const char* string(uint32_t i) const {
+        return (const char*)(string_offsets() + num_strings()) + string_offsets()[i];
+    }
+
+    // hands every function to fc the way the plugin did: lock free functions straight away, the rest
+    // straight away too with jobs <= 1, otherwise all together at the end; false if the record turns out
+    // to be malformed partway through
+    template <typename S>
+    bool replay(file_checker<ReplayAdapter, S>& fc, std::unordered_map<uint64_t, errors>& line_errors, unsigned jobs = 1) const {
+        const uint32_t* p = words + corpus_writer::kHeaderWords;
+        const uint32_t* const end = p + words[4];
+        bool ok = true;
+        auto next = [&]() -> uint32_t {
+            if (p >= end) {
+                ok = false;
+                return 0;
+            }
+            return *p++;
+        };
+        auto str = [&]() {
+            const uint32_t i = next();
+            ok &= i < num_strings();
+            return ok ? i : 0;
+        };
+
+        std::vector<std::pair<std::string, cfg<ReplayAdapter>>> pending;
+        for (uint32_t f = 0; f < num_functions() && ok; f++) {
+            const uint32_t kind = next();
+            const std::string name = string(str());
+            if (kind == corpus_writer::kLockFree) {
+                const uint32_t num_calls = next();
+                if ((size_t)(end - p) < 3ull * num_calls) {
+                    return false;
+                }
+                std::vector<std::pair<uint64_t, std::string>> calls(num_calls);
+                for (auto& [loc, callee]: calls) {
+                    callee = string(str());
+                    const uint32_t file = str();
+                    loc = replay_location(file, next());
+                }
+                if (!ok) {
+                    break;
+                }
+                fc.process_lock_free_function(name, calls, line_errors);
+                continue;
+            }
+            if (kind != corpus_writer::kCfg) {
+                return false;
+            }
+
+            const uint32_t num_locks = next();
+            if (num_locks > 32 || (size_t)(end - p) < num_locks) {
+                return false;
+            }
+            std::vector<uint32_t> locks;
+            for (uint32_t i = 0; i < num_locks; i++) {
+                locks.push_back(str());
+            }
+            const uint32_t num_bbs = next(), num_actions = next(), start_bb = next(), end_bb = next();
+            const uint32_t end_file = str(), end_line = next();
+            if (!ok || start_bb >= num_bbs || end_bb >= num_bbs || (size_t)(end - p) < 5ull * num_bbs + 4ull * num_actions) {
+                return false;
+            }
+
+            // blocks are rebuilt in the order their actions were recorded
+            const uint32_t* bbs = p;
+            const uint32_t* actions = p + 5 * num_bbs;
+            p = actions + 4 * num_actions;
+            std::vector<uint32_t> order(num_bbs);
+            for (uint32_t b = 0; b < num_bbs; b++) {
+                order[b] = b;
+            }
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return bbs[5 * a] < bbs[5 * b];
+            });
+
+            cfg_builder<ReplayAdapter> builder(fc.func_ids, num_bbs);
+            builder.graph.locks = locks;
+            for (uint32_t b: order) {
+                const uint32_t* block = bbs + 5 * b;
+                const int32_t on_true = block[2], on_false = block[3], depends_on = block[4];
+                if (block[0] > block[1] || block[1] > num_actions || on_true < -1 || on_true >= (int32_t)num_bbs
+                        || on_false < -1 || on_false >= (int32_t)num_bbs || depends_on < -1 || depends_on >= 32) {
+                    return false;
+                }
+                builder.begin_block(b);
+                for (uint32_t i = block[0]; i < block[1]; i++) {
+                    const uint32_t* a = actions + 4 * i;
+                    if (a[2] >= num_strings()) {
+                        return false;
+                    }
+                    const uint64_t loc = replay_location(a[2], a[3]);
+                    const idx<lock> lock_id = {(int)(a[1] & 0xff)};
+                    const bool lock_ok = (a[1] & 0xff) < num_locks && (a[1] >> 8) < 32;
+                    switch (a[0]) {
+                    case kLock: if (!lock_ok) return false; builder.lock_(loc, lock_id); break;
+                    case kFallibleLock: if (!lock_ok) return false; builder.fallible_lock_(loc, lock_id, {(int)(a[1] >> 8)}); break;
+                    case kUnlock: if (!lock_ok) return false; builder.unlock_(loc, lock_id); break;
+                    case kCall: if (a[1] >= num_strings()) return false; builder.call_(loc, string(a[1])); break;
+                    default: return false;
+                    }
+                }
+                cond_edge<ReplayAdapter> edge = {{on_true}};
+                if (on_false >= 0) {
+                    edge.on_false = idx<bb<ReplayAdapter>>{on_false};
+                }
+                if (depends_on >= 0) {
+                    edge.depends_on = idx<fallible_lock>{depends_on};
+                }
+                builder.end_block(edge);
+            }
+            auto fun = builder.finish({(int)start_bb}, {(int)end_bb}, replay_location(end_file, end_line));
+            if (jobs > 1) {
+                pending.push_back({name, std::move(fun)});
+            } else {
+                fc.process_function(name, std::move(fun), line_errors);
+            }
+        }
+        if (!pending.empty()) {
+            fc.process_functions(std::move(pending), line_errors, jobs);
+        }
+        return ok;
+    }
+
+private:
+    const uint32_t* string_offsets() const {
+        return words + corpus_writer::kHeaderWords + words[4];
+    }
+};
+
+}
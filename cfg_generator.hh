@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "func_walker.hh"
+
+// seeded generator for random functions and call graphs, for benchmarking the checker on inputs
+// with a known shape
+//
+// functions are built out of segments that each leave the locks as they found them (a blocking
+// take and give, a fallible take followed by a give if it succeeded, a branch, or a plain call),
+// joined end to end, with some back edges between segment boundaries to make loops
+//
+// T::Location and T::LockId must be constructible from int, and T::FuncId from std::string
+
+namespace lock_checker {
+
+struct generator_options {
+    int bbs = 64; // the function gets at least this many basic blocks
+    int locks = 4;
+    int fallible_takes = 8; // distinct fallible take calls; at most 32
+    double loop_density = 0.1; // chance that a segment boundary jumps back to an earlier one
+    double call_density = 0.3; // chance that a segment contains a call
+    int callees = 16; // calls go to callee_prefix + a number below this
+    std::string callee_prefix = "f";
+};
+
+// splitmix64; the same seed gives the same functions everywhere, unlike the std distributions
+struct generator_rng {
+    uint64_t s;
+
+    uint64_t next() {
+        uint64_t z = (s += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    int below(int n) {
+        return n <= 0 ? 0 : (int)(next() % n);
+    }
+    bool chance(double p) {
+        return (next() >> 11) * (1.0 / (1ull << 53)) < p;
+    }
+};
+
+template <typename T> func<T> random_func(const generator_options& options, uint64_t seed) {
+    using a = action<T>;
+
+    generator_rng rng{seed};
+    func<T> fun = {};
+    for (int i = 0; i < options.locks; i++) {
+        fun.locks.push_back(typename T::LockId(i));
+    }
+
+    auto add = [&](std::vector<action<T>> actions) {
+        fun.bbs.push_back({ .actions = std::move(actions) });
+        return (int)fun.bbs.size() - 1;
+    };
+    auto callee = [&]() {
+        return typename T::FuncId(options.callee_prefix + std::to_string(rng.below(options.callees)));
+    };
+
+    std::vector<int> boundaries; // blocks between segments, where any lock state is the same as at the start
+    int cur = add({});
+    int next_call_id = 0;
+    while ((int)fun.bbs.size() < options.bbs) {
+        boundaries.push_back(cur);
+        const int loc = fun.bbs.size() * 10;
+        const int lock = rng.below(options.locks);
+        const bool with_call = rng.chance(options.call_density);
+
+        const int kind = rng.below(4);
+        int join;
+        if (kind == 0 && options.locks > 0) {
+            // lock(); maybe call(); unlock();
+            std::vector<action<T>> actions = { a::lock_(loc, {lock}) };
+            if (with_call) {
+                actions.push_back(a::call_(loc + 1, callee()));
+            }
+            actions.push_back(a::unlock_(loc + 2, {lock}));
+            join = add(actions);
+            fun.bbs[cur].next = { {join} };
+        } else if (kind == 1 && options.locks > 0 && next_call_id < options.fallible_takes) {
+            // if (take(5) == pdTRUE) { maybe call(); give(); }
+            const int call_id = next_call_id++;
+            const int take = add({ a::fallible_lock_(loc, {lock}, {call_id}) });
+            std::vector<action<T>> give_actions;
+            if (with_call) {
+                give_actions.push_back(a::call_(loc + 1, callee()));
+            }
+            give_actions.push_back(a::unlock_(loc + 2, {lock}));
+            const int give = add(give_actions);
+            join = add({});
+            fun.bbs[cur].next = { {take} };
+            fun.bbs[take].next = { {give}, {join}, {call_id} };
+            fun.bbs[give].next = { {join} };
+        } else if (kind == 2) {
+            // if (x) { maybe call(); }, sometimes where x is the result of an earlier take
+            const int then = add(with_call ? std::vector<action<T>>{ a::call_(loc, callee()) } : std::vector<action<T>>{});
+            join = add({});
+            fun.bbs[cur].next = { {then}, {join} };
+            if (next_call_id > 0 && rng.chance(0.5)) {
+                fun.bbs[cur].next.depends_on = idx<fallible_lock>{rng.below(next_call_id)};
+            }
+            fun.bbs[then].next = { {join} };
+        } else {
+            join = add(with_call ? std::vector<action<T>>{ a::call_(loc, callee()) } : std::vector<action<T>>{});
+            fun.bbs[cur].next = { {join} };
+        }
+
+        if (rng.chance(options.loop_density)) {
+            // while (x) { ...the segments since some earlier boundary... }
+            const int exit = add({});
+            fun.bbs[join].next = { {boundaries[rng.below(boundaries.size())]}, {exit} };
+            join = exit;
+        }
+        cur = join;
+    }
+    const int end = add({});
+    fun.bbs[cur].next = { {end} };
+    fun.start_bb = {0};
+    fun.end_bb = {end};
+    fun.end_line = typename T::Location(end * 10);
+    return fun;
+}
+
+// n functions named callee_prefix + 0..n-1, calling each other; each one is random_func with its own seed
+template <typename T> std::vector<std::pair<typename T::FuncId, func<T>>> random_call_graph(int n, generator_options options, uint64_t seed) {
+    options.callees = n;
+    std::vector<std::pair<typename T::FuncId, func<T>>> fs;
+    generator_rng rng{seed};
+    for (int i = 0; i < n; i++) {
+        fs.push_back({typename T::FuncId(options.callee_prefix + std::to_string(i)), random_func<T>(options, rng.next())});
+    }
+    return fs;
+}
+
+}
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
 
+#include "analysis_cache.hh"
 #include "func_walker.hh"
+#include "lock_order.hh"
+#include "stats.hh"
+#include "work_pool.hh"
 
 namespace lock_checker {
 
@@ -55,15 +63,30 @@ struct errors {
     }
 };
 
-template <typename T> struct file_checker;
+template <typename T, typename S = no_stats> struct file_checker;
 
+// locks taken in an order that goes around in a circle, so the code taking them can deadlock
+//
+// sites[i] is where locks[i + 1] is taken while holding locks[i], and the last site is where
+// locks[0] is taken while holding the last lock
+template <typename T> struct lock_order_cycle {
+    std::vector<typename T::LockId> locks;
+    std::vector<typename T::Location> sites;
+};
+
+// one call from caller to a function, made at loc
+//
+// every path through the caller that reaches the call is folded into one entry; cur_lock_state is
+// the union of the locks held on each of them, which is all that's needed to tell if the call can
+// block on one of them
 template <typename T> struct callsite {
     typename T::Location loc;
     lock_state<file_checker<T>> cur_lock_state;
     typename T::FuncId caller;
 };
 
-template <typename T> struct file_checker {
+// S is no_stats or collect_stats, see stats.hh
+template <typename T, typename S> struct file_checker {
     using FuncId = typename T::FuncId;
     using Location = typename T::Location;
     using LockId = typename T::LockId;
@@ -73,12 +96,42 @@ template <typename T> struct file_checker {
     std::unordered_map<LockId, idx<file_checker<T>>> lock_idx;
     std::vector<LockId> locks;
 
-    std::unordered_map<FuncId, func<T>> functions; // might not need this
+    func_table<T> func_ids; // dense ids for every function seen, used for the callees stored in cfg<T>s
+    // the locks of every function processed; the bodies are dropped once they've been summarized
+    std::unordered_map<FuncId, std::vector<LockId>> function_locks;
     std::unordered_map<FuncId, lock_state<file_checker<T>>> blocking_locks_used; // bitfield of all the locks that are taken using a blocking call in the function
     std::unordered_map<FuncId, std::vector<callsite<T>>> called_by;
+    std::unordered_map<FuncId, std::vector<uint32_t>> callees_of; // func_ids of everything a function calls, to find its entries in called_by
+
+    explore_engine engine = kBreadthFirst; // how each function's basic blocks are walked
+    explore_budget budget; // past this, a function is checked again with kApproximate instead
+    // explore each function one slice at a time, see cfg::slices; it finds the same things, but the budget
+    // applies to each slice separately, so a function that runs out of it whole might not in slices
+    bool slice_locks = false;
+
+    // functions that ran out of budget, and which limit they hit; whoever runs the checker reports and clears these
+    std::vector<std::pair<FuncId, budget_limit>> over_budget;
+    // functions that weren't explored because they'd take the unit past kMaxLocks; they still pass on what
+    // their callees block on. whoever runs the checker reports and clears these
+    std::vector<FuncId> too_many_locks;
+
+    // a lock_state has one bit per lock, so that's as many as a unit can have
+    static constexpr size_t kMaxLocks = 32;
+
+    // which locks have been taken while holding which others, by global lock index
+    lock_order<Location> order;
+    // cycles in that order, found as the edge closing them is seen; whoever runs the checker reports and clears these
+    std::vector<lock_order_cycle<T>> order_cycles;
+
+    std::unordered_map<FuncId, function_stats> stats; // only filled in with collect_stats
+
+    // if set, functions already explored in an earlier run are looked up here instead
+    analysis_cache<T>* cache = nullptr;
 
     lock_state<file_checker<T>> to_global(const lock_state<lock>& caller_state, FuncId caller) const {
-        const auto &func_locks = functions.find(caller)->second.locks;
+        return to_global(caller_state, function_locks.find(caller)->second);
+    }
+    lock_state<file_checker<T>> to_global(const lock_state<lock>& caller_state, const std::vector<LockId>& func_locks) const {
         lock_state<file_checker<T>> caller_state_translated = { 0 };
 
         for (size_t i = 0; i < func_locks.size(); i++) {
@@ -91,99 +144,772 @@ template <typename T> struct file_checker {
         return caller_state_translated;
     }
 
-    void check_callers(FuncId callee, std::unordered_map<Location, errors>& line_errors) {
-        //fprintf(stderr, "checking %s\n", callee.c_str());
-        const auto &called_by_ = called_by;
-        if (const auto it = called_by_.find(callee); it != called_by.end()) {
-            for (const auto& cs: it->second) {
-                // check this call to see if it causes an error
-                if ((blocking_locks_used[callee] & cs.cur_lock_state) != 0) {
-                    line_errors[cs.loc].add(errors::call_with_blocking_lock("blocking lock used by caller"));
+    // pushes the blocking locks of a function up to everything that calls it, directly or through
+    // other functions, and reports calls made while holding one of them
+    //
+    // before is what blocking_locks_used[callee] was before it last changed; only the locks that
+    // were added since are reported, the rest have already been checked
+    void check_callers(FuncId callee, lock_state<file_checker<T>> before, std::unordered_map<Location, errors>& line_errors) {
+        propagate_blocking_locks({{callee, before}}, line_errors);
+    }
+
+    // the part of the call graph a change in blocking_locks_used can reach, numbered densely
+    struct propagation_graph {
+        std::unordered_map<FuncId, int> node_of;
+        std::vector<lock_state<file_checker<T>>*> locks; // the node's blocking_locks_used entry
+        std::vector<lock_state<file_checker<T>>> before; // what it was when the node was added
+        std::vector<const std::vector<callsite<T>>*> sites; // calls to the node, or nullptr if there are none
+
+        // callers of node i are caller_edges[first_caller[i]] up to caller_edges[first_caller[i + 1]]
+        std::vector<int> caller_edges;
+        std::vector<size_t> first_caller;
+
+        size_t size() const {
+            return locks.size();
+        }
+        const int* callers_begin(int v) const {
+            return caller_edges.data() + first_caller[v];
+        }
+        const int* callers_end(int v) const {
+            return caller_edges.data() + first_caller[v + 1];
+        }
+    };
+
+    // nodes grouped by component, with the end of each group in ends
+    struct component_list {
+        std::vector<int> nodes;
+        std::vector<size_t> ends;
+    };
+
+    // strongly connected components of g along caller edges, found with an iterative version of
+    // tarjan's algorithm; components come out callers first, so walking the list backwards visits
+    // every callee before the functions calling it
+    static component_list caller_components(const propagation_graph& g) {
+        const int n = g.size();
+        std::vector<int> index(n, -1), low(n, 0);
+        std::vector<bool> on_stack(n, false);
+        std::vector<int> stack;
+        std::vector<std::pair<int, const int*>> dfs; // node and the next caller edge to follow
+        component_list components;
+        int next_index = 0;
+
+        for (int root = 0; root < n; root++) {
+            if (index[root] != -1) {
+                continue;
+            }
+            dfs.push_back({root, g.callers_begin(root)});
+            index[root] = low[root] = next_index++;
+            stack.push_back(root);
+            on_stack[root] = true;
+
+            while (!dfs.empty()) {
+                auto& [v, edge] = dfs.back();
+                if (edge != g.callers_end(v)) {
+                    const int w = *edge++;
+                    if (index[w] == -1) {
+                        index[w] = low[w] = next_index++;
+                        stack.push_back(w);
+                        on_stack[w] = true;
+                        dfs.push_back({w, g.callers_begin(w)});
+                    } else if (on_stack[w]) {
+                        low[v] = std::min(low[v], index[w]);
+                    }
+                    continue;
                 }
 
-                // update blocking_locks_used
-                const auto old_locks = blocking_locks_used[cs.caller];
-                blocking_locks_used[cs.caller] = blocking_locks_used[cs.caller] | blocking_locks_used[callee];
-                //fprintf(stderr, "new locks used %08x\n", blocking_locks_used[cs.caller].state);
+                const int done = v;
+                dfs.pop_back();
+                if (!dfs.empty()) {
+                    const int parent = dfs.back().first;
+                    low[parent] = std::min(low[parent], low[done]);
+                }
+                if (low[done] == index[done]) {
+                    int w;
+                    do {
+                        w = stack.back();
+                        stack.pop_back();
+                        on_stack[w] = false;
+                        components.nodes.push_back(w);
+                    } while (w != done);
+                    components.ends.push_back(components.nodes.size());
+                }
+            }
+        }
+        return components;
+    }
+
+    // roots are the functions whose blocking_locks_used changed, with what it was before
+    //
+    // this only walks callers that are missing some of the new locks, since anything that already
+    // has them can't change and neither can its callers; every call site in that part of the graph
+    // is looked at once, and recursive functions are handled as a single component instead of
+    // going around the cycle until it settles
+    void propagate_blocking_locks(const std::vector<std::pair<FuncId, lock_state<file_checker<T>>>>& roots, std::unordered_map<Location, errors>& line_errors) {
+        // most of the time nothing calls the roots yet, so check for that before building anything
+        lock_state<file_checker<T>> new_locks = {0};
+        bool called = false;
+        for (const auto& [name, old_locks]: roots) {
+            new_locks = new_locks | (blocking_locks_used[name] & ~old_locks);
+            called |= called_by.count(name) != 0;
+        }
+        if (new_locks == 0 || !called) {
+            return;
+        }
+
+        propagation_graph g;
+        auto add = [&](const FuncId& name, lock_state<file_checker<T>>& used, lock_state<file_checker<T>> old_locks) {
+            g.node_of[name] = g.size();
+            const auto it = called_by.find(name);
+            g.locks.push_back(&used);
+            g.before.push_back(old_locks);
+            g.sites.push_back(it == called_by.end() ? nullptr : &it->second);
+        };
+
+        for (const auto& [name, old_locks]: roots) {
+            if (g.node_of.count(name) == 0) {
+                add(name, blocking_locks_used[name], old_locks);
+            }
+        }
 
-                // if blocking_locks_used is changed, check the functions that called it
-                if (old_locks != blocking_locks_used[cs.caller]) {
-                    check_callers(cs.caller, line_errors);
+        for (size_t i = 0; i < g.size(); i++) {
+            g.first_caller.push_back(g.caller_edges.size());
+            if (g.sites[i] == nullptr) {
+                continue;
+            }
+            for (const auto& cs: *g.sites[i]) {
+                int caller;
+                if (const auto it = g.node_of.find(cs.caller); it != g.node_of.end()) {
+                    caller = it->second;
+                } else {
+                    auto& caller_locks = blocking_locks_used[cs.caller];
+                    if ((new_locks & ~caller_locks) == 0) {
+                        continue;
+                    }
+                    caller = g.size();
+                    add(cs.caller, caller_locks, caller_locks);
                 }
+                g.caller_edges.push_back(caller);
+            }
+        }
+        g.first_caller.push_back(g.caller_edges.size());
+
+        const auto components = caller_components(g);
+        for (size_t c = components.ends.size(); c-- > 0;) {
+            const int* begin = components.nodes.data() + (c == 0 ? 0 : components.ends[c - 1]);
+            const int* end = components.nodes.data() + components.ends[c];
 
-                // this is guaranteed to terminate because it only recurses if block_locks_used is updated
-                // which can only happen up to 32 times
+            // everything in a component calls everything else in it, so they all end up with the same locks
+            lock_state<file_checker<T>> locks = {0};
+            for (const int* v = begin; v != end; v++) {
+                locks = locks | *g.locks[*v];
+            }
+
+            for (const int* it = begin; it != end; it++) {
+                const int v = *it;
+                *g.locks[v] = locks;
+                const auto added = locks & ~g.before[v];
+                if (added == 0 || g.sites[v] == nullptr) {
+                    continue;
+                }
+
+                // check the calls to this function to see if they cause an error
+                for (const auto& cs: *g.sites[v]) {
+                    if ((added & cs.cur_lock_state) != 0) {
+                        line_errors[cs.loc].add(errors::call_with_blocking_lock("blocking lock used by caller"));
+                    }
+                    add_lock_order(cs.cur_lock_state, added, cs.loc);
+                }
+                // callers that aren't in the graph already have every new lock
+                for (const int* w = g.callers_begin(v); w != g.callers_end(v); w++) {
+                    *g.locks[*w] = *g.locks[*w] | locks;
+                }
             }
         }
     }
 
     // TODO memoize?
-    void process_function(FuncId name, func<T> && f, std::unordered_map<Location, errors>& line_errors) {
-        functions[name] = f;
-        process_function_internal(name, line_errors);
-    }
     void process_function(FuncId name, const func<T> & f, std::unordered_map<Location, errors>& line_errors) {
-        functions[name] = f;
-        process_function_internal(name, line_errors);
+        process_function(name, cfg<T>::build(f, func_ids), line_errors);
+    }
+    // the cfg must have been built with func_ids; it's freed before this returns
+    void process_function(FuncId name, cfg<T> && f, std::unordered_map<Location, errors>& line_errors) {
+        const cfg<T> fun = std::move(f);
+        if (!add_locks(fun)) {
+            merge(name, unchecked_summary(name, fun), line_errors);
+            return;
+        }
+        function_locks[name] = fun.locks;
+        merge(name, summarize_cached(fun), line_errors);
+    }
+
+    // processes a batch of functions, exploring them on up to num_threads threads
+    //
+    // the results are merged in the order the functions are given, so line_errors ends up the same
+    // as calling process_function on each of them in that order; the cfgs must have been built with func_ids
+    void process_functions(std::vector<std::pair<FuncId, cfg<T>>>&& fs, std::unordered_map<Location, errors>& line_errors, unsigned num_threads) {
+        // anything shared is set up here, the workers only read it
+        std::vector<FuncId> names;
+        std::vector<function_summary> summaries(fs.size());
+        std::vector<std::pair<FuncId, cfg<T>>> batch;
+        std::vector<size_t> batch_at; // where each function in batch goes in summaries
+        for (size_t i = 0; i < fs.size(); i++) {
+            names.push_back(fs[i].first);
+            if (!add_locks(fs[i].second)) {
+                summaries[i] = unchecked_summary(fs[i].first, fs[i].second);
+                continue;
+            }
+            function_locks[fs[i].first] = fs[i].second.locks;
+            batch_at.push_back(i);
+            batch.push_back(std::move(fs[i]));
+        }
+        fs.clear();
+
+        // each body is freed as soon as it's been summarized
+        std::vector<function_summary> explored(batch.size());
+        if (!slice_locks) {
+            parallel_for(batch.size(), num_threads, [&](size_t i) {
+                explored[i] = summarize_cached(batch[i].second);
+                batch[i].second = cfg<T>{};
+            });
+        } else {
+            explore_slices(batch, explored, num_threads);
+        }
+        for (size_t i = 0; i < batch.size(); i++) {
+            summaries[batch_at[i]] = std::move(explored[i]);
+        }
+
+        for (size_t i = 0; i < names.size(); i++) {
+            merge(names[i], summaries[i], line_errors);
+        }
+    }
+
+    // for a function that never takes or gives a lock; given just the calls it makes, this skips building
+    // and exploring its cfg
+    //
+    // such a function can't cause any errors itself and holds nothing at any of its calls, so all that
+    // matters is who it calls, to pass their blocking locks on to its own callers
+    void process_lock_free_function(FuncId name, const std::vector<std::pair<Location, FuncId>>& calls, std::unordered_map<Location, errors>& line_errors) {
+        function_summary summary;
+        std::unordered_set<uint32_t> seen;
+        for (const auto& [loc, callee]: calls) {
+            const uint32_t id = func_ids.intern(callee);
+            if (seen.insert(id).second) {
+                summary.calls.push_back({loc, id, {0}});
+            }
+        }
+        if constexpr (S::enabled) {
+            summary.stats.skipped = true;
+            summary.stats.callsites = summary.calls.size();
+        }
+        merge(name, summary, line_errors);
+    }
+
+    // records that every lock in taken is acquired at loc while every lock in held is held
+    void add_lock_order(lock_state<file_checker<T>> held, lock_state<file_checker<T>> taken, const Location& loc) {
+        for (uint32_t h = held.state; h != 0; h &= h - 1) {
+            for (uint32_t t = taken.state; t != 0; t &= t - 1) {
+                add_lock_order(__builtin_ctz(h), __builtin_ctz(t), loc);
+            }
+        }
+    }
+    void add_lock_order(uint32_t held, uint32_t taken, const Location& loc) {
+        if (held >= locks.size() || taken >= locks.size()) {
+            // not a lock this checker knows about, so there's nothing to name in a cycle
+            return;
+        }
+        if (auto cycle = order.add(held, taken, loc)) {
+            lock_order_cycle<T> c;
+            for (const auto& e: *cycle) {
+                c.locks.push_back(locks[e.held]);
+                c.sites.push_back(e.site);
+            }
+            order_cycles.push_back(std::move(c));
+        }
     }
 
-    void process_function_internal(FuncId name, std::unordered_map<Location, errors>& line_errors) {
-        const auto& fun = functions[name];
+    // everything exploring a single function finds, before it's combined with the rest of the call graph
+    struct function_summary {
+        struct call {
+            Location loc;
+            uint32_t callee;
+            lock_state<file_checker<T>> held; // locks held on any path reaching the call
+        };
+        // taken is acquired at loc while held is held; both are global lock indices
+        struct order_edge {
+            uint32_t held, taken;
+            Location loc;
+        };
+
+        lock_state<file_checker<T>> blocking_locks = {}; // taken with a blocking call by the function itself
+        std::vector<std::pair<Location, error>> errs; // in the order they were found
+        std::vector<call> calls; // one per call site
+        std::vector<order_edge> order_edges; // the first place each pair of locks is seen in the function
+        budget_limit limit_hit = kWithinBudget; // if not kWithinBudget, the rest was found by kApproximate
+        typename S::record stats;
+    };
+
+    // add any locks the global list is missing; false, adding none of them, if that would make more than
+    // kMaxLocks (the order tracking in lock_order.hh has no limit, but lock_state does)
+    bool add_locks(const cfg<T>& fun) {
+        return add_locks(fun.locks);
+    }
+    bool add_locks(const std::vector<LockId>& fun_locks) {
+        std::unordered_set<LockId> missing;
+        for (const auto& lock_id: fun_locks) {
+            if (lock_idx.count(lock_id) == 0) {
+                missing.insert(lock_id);
+            }
+        }
+        if (fun_locks.size() > kMaxLocks || locks.size() + missing.size() > kMaxLocks) {
+            return false;
+        }
+        for (const auto& lock_id: fun_locks) {
+            if (auto it = lock_idx.find(lock_id); it == lock_idx.end()) {
+                lock_idx[lock_id] = {(int)locks.size()};
+                locks.push_back(lock_id);
+            }
+        }
+        return true;
+    }
 
-        lock_state<file_checker<T>> blocking_locks = {};
+    // for a function that can't be explored because its locks don't fit (see add_locks): it's put in
+    // too_many_locks, and gets the summary a lock-free function would, so its callers still see what
+    // its callees block on
+    function_summary unchecked_summary(const FuncId& name, const cfg<T>& fun) {
+        too_many_locks.push_back(name);
+        function_locks[name] = {};
+        function_summary summary;
+        std::unordered_set<uint32_t> seen;
+        for (uint32_t i = 0; i < fun.num_actions(); i++) {
+            const auto a = fun.action_at(i);
+            if (a.typ == kCall && seen.insert(a.callee).second) {
+                summary.calls.push_back({a.loc, a.callee, {0}});
+            }
+        }
+        if constexpr (S::enabled) {
+            summary.stats.callsites = summary.calls.size();
+        }
+        return summary;
+    }
 
-        {
-            // add any locks the global list is missing
-            for (const auto& lock_id: fun.locks) {
-                if (locks.size() > 32) {
-                    // TODO error out
+    // explores a function, or each of its slices with slice_locks; this only reads from the file_checker,
+    // so it's safe to run for several functions at once as long as nothing is being added
+    function_summary summarize(const cfg<T>& fun) const {
+        const auto slices = slice_locks ? fun.slices() : std::vector<cfg<T>>{};
+        std::vector<function_summary> parts;
+        if (slices.empty()) {
+            parts.push_back(explore_piece(fun));
+        }
+        for (const auto& slice: slices) {
+            parts.push_back(explore_piece(slice));
+        }
+        return finish_summary(fun, std::move(parts));
+    }
+
+    // explores a whole function or one slice of it, within the budget
+    function_summary explore_piece(const cfg<T>& piece) const {
+        function_summary summary;
+        auto explore = [&](auto* counters) {
+            budget_tracker tracker{budget};
+            if (!explore_into(summary, piece, engine, counters, budget.limited() ? &tracker : nullptr)) {
+                summary.limit_hit = tracker.hit;
+            }
+        };
+        if constexpr (S::enabled) {
+            const auto start = std::chrono::steady_clock::now();
+            explore(&summary.stats.explore);
+            summary.stats.explore_ms = ms_since(start);
+        } else {
+            explore(static_cast<no_stats*>(nullptr));
+        }
+        return summary;
+    }
+
+    // what exploring each piece of fun found, put back together; if any of them ran out of budget, the
+    // whole function is explored again with kApproximate instead
+    function_summary finish_summary(const cfg<T>& fun, std::vector<function_summary>&& parts) const {
+        function_summary summary;
+        if (parts.size() == 1) {
+            summary = std::move(parts[0]);
+        } else {
+            // a lock that's branched on is in every slice, so the same thing can be found more than once
+            std::set<std::pair<Location, int>> reported;
+            std::map<std::pair<Location, uint32_t>, size_t> call_index;
+            std::set<std::pair<uint32_t, uint32_t>> ordered;
+            for (const auto& part: parts) {
+                summary.blocking_locks = summary.blocking_locks | part.blocking_locks;
+                if (summary.limit_hit == kWithinBudget) {
+                    summary.limit_hit = part.limit_hit;
+                }
+                for (const auto& [loc, err]: part.errs) {
+                    if (reported.insert({loc, err.typ}).second) {
+                        summary.errs.push_back({loc, err});
+                    }
+                }
+                for (const auto& c: part.calls) {
+                    auto [it, inserted] = call_index.try_emplace({c.loc, c.callee}, summary.calls.size());
+                    if (inserted) {
+                        summary.calls.push_back(c);
+                    } else {
+                        summary.calls[it->second].held = summary.calls[it->second].held | c.held;
+                    }
                 }
-                if (auto it = lock_idx.find(lock_id); it == lock_idx.end()) {
-                    lock_idx[lock_id] = {(int)locks.size()};
-                    locks.push_back(lock_id);
+                for (const auto& e: part.order_edges) {
+                    if (ordered.insert({e.held, e.taken}).second) {
+                        summary.order_edges.push_back(e);
+                    }
+                }
+                if constexpr (S::enabled) {
+                    summary.stats.explore.states_enqueued += part.stats.explore.states_enqueued;
+                    summary.stats.explore.states_visited += part.stats.explore.states_visited;
+                    summary.stats.explore.peak_frontier = std::max(summary.stats.explore.peak_frontier, part.stats.explore.peak_frontier);
+                    summary.stats.explore_ms += part.stats.explore_ms;
                 }
             }
+            if constexpr (S::enabled) {
+                summary.stats.slices = parts.size();
+            }
+        }
+
+        if (summary.limit_hit != kWithinBudget) {
+            // throw away what was found, and start over with an engine that's sure to finish
+            summary.blocking_locks = {0};
+            summary.errs.clear();
+            summary.calls.clear();
+            summary.order_edges.clear();
+            if constexpr (S::enabled) {
+                const auto start = std::chrono::steady_clock::now();
+                explore_into(summary, fun, kApproximate, &summary.stats.explore, nullptr);
+                summary.stats.explore_ms += ms_since(start);
+            } else {
+                explore_into(summary, fun, kApproximate, static_cast<no_stats*>(nullptr), nullptr);
+            }
         }
+        if constexpr (S::enabled) {
+            summary.stats.bbs = fun.num_bbs();
+            summary.stats.actions = fun.num_actions();
+            summary.stats.fallible_calls = fun.fallible_calls;
+            summary.stats.callsites = summary.calls.size();
+        }
+        return summary;
+    }
+
+    // explores fun with the given engine, adding what it finds to summary; false if the budget ran out
+    // first, in which case summary has whatever was found until then
+    template <typename C> bool explore_into(function_summary& summary, const cfg<T>& fun, explore_engine with, C* counters, budget_tracker* tracker) const {
+        // a call is reached once for every state that gets to it; keep one entry per call site, with
+        // the locks held in each of those states or'd together
+        std::map<std::pair<Location, uint32_t>, size_t> call_index;
+        std::vector<lock_state<lock>> call_held;
+        lock_state<lock> blocking_locks = {0}; // in the function's own numbering until the end
+
+        // for each lock, everything held at any of its takes so far; each pair only makes it into
+        // the summary the first time it's seen, so a take costs a few word ops however many states reach it
+        std::vector<lock_state<lock>> held_at_take(fun.locks.size(), lock_state<lock>{0});
+        auto record_order = [&](lock_state<lock> held, idx<lock> taken, const Location& loc) {
+            auto& known = held_at_take[*taken];
+            const auto fresh = held & ~known & ~taken.mask();
+            if (fresh == 0) {
+                return;
+            }
+            known = known | fresh;
+            const uint32_t taken_global = *lock_idx.find(fun.locks[*taken])->second;
+            for (uint32_t bits = fresh.state; bits != 0; bits &= bits - 1) {
+                const uint32_t held_global = *lock_idx.find(fun.locks[__builtin_ctz(bits)])->second;
+                summary.order_edges.push_back({held_global, taken_global, loc});
+            }
+        };
 
+        // each error is only reported once at a location, however many states run into it
+        std::set<std::pair<Location, int>> reported;
+        auto report = [&](const Location& loc, const error& err) {
+            if (reported.insert({loc, err.typ}).second) {
+                summary.errs.push_back({loc, err});
+            }
+        };
 
-        fun.template explore<int>([&](edge_state<T, int>& es, const bb<T>& basic_block, const action<T>& a) {
+        // every check is over all the states reaching the action at once: the locks held in any of
+        // them, or in all of them
+        auto on_states = [&](const state_batch<T, int>& batch, const action_ref<T>& a) {
+            const auto any_held = batch.any();
+            if (a.typ == kLock || a.typ == kFallibleLock || a.typ == kObservedLock) {
+                record_order(any_held, a.lock_id, a.loc);
+            }
             if (a.typ == kLock) {
-                blocking_locks = blocking_locks | to_global(a.lock_id->mask(), name);
+                blocking_locks = blocking_locks | a.lock_id.mask();
 
-                auto lock_mask = a.lock_id->mask();
-                if ((es.cur_lock_state & lock_mask) != 0) {
+                auto lock_mask = a.lock_id.mask();
+                if ((any_held & lock_mask) != 0) {
                     // double lock
-                    line_errors[a.loc].add(errors::double_lock(""));
+                    report(a.loc, errors::double_lock(""));
                 }
             } else if (a.typ == kUnlock) {
-                auto lock_mask = a.lock_id->mask();
-                if ((es.cur_lock_state & lock_mask) == 0) {
+                auto lock_mask = a.lock_id.mask();
+                if ((batch.all() & lock_mask) == 0) {
                     // unlock without a lock
-                    line_errors[a.loc].add(errors::give_without_take(""));
+                    report(a.loc, errors::give_without_take(""));
                 }
             } else if (a.typ == kCall) {
-                if (auto it = blocking_locks_used.find(*a.called_func); it != blocking_locks_used.end()) {
-                    auto translated = to_global(es.cur_lock_state, name);
-                    if ((translated & it->second) != 0) {
-                        // TODO add an error
-                        line_errors[a.loc].add(errors::call_with_blocking_lock(""));
-                    }
-                    blocking_locks = blocking_locks | it->second;
+                auto [it, inserted] = call_index.try_emplace({a.loc, a.callee}, call_held.size());
+                if (inserted) {
+                    summary.calls.push_back({a.loc, a.callee, {0}});
+                    call_held.push_back(any_held);
+                } else {
+                    call_held[it->second] = call_held[it->second] | any_held;
                 }
-                // add to call graph
-                called_by[*a.called_func].push_back(callsite<T>{a.loc, to_global(es.cur_lock_state, name), name});
             } else if (a.typ == kEnd) {
-                if (es.cur_lock_state != 0) {
+                if (any_held != 0) {
                     // lock held at the end of the function
-                    line_errors[fun.end_line].add(errors::take_without_give(""));
+                    report(fun.end_line, errors::take_without_give(""));
+                }
+            }
+        };
+        // a block that only takes free locks and gives held ones can't cause any errors
+        auto on_clean_block = [&](const edge_state<T, int>& es, const block_transfer& t) {
+            blocking_locks = blocking_locks | t.taken;
+
+            // but the order it takes them in still counts; every take in the block holds at most
+            // what was held coming in plus the block's own takes, so if that's known already there's nothing to add
+            const auto most_held = es.cur_lock_state | t.taken;
+            bool known = true;
+            for (uint32_t bits = (t.taken | t.observed).state; bits != 0 && known; bits &= bits - 1) {
+                const idx<lock> l = {(int)__builtin_ctz(bits)};
+                known = (most_held & ~held_at_take[*l] & ~l.mask()) == 0;
+            }
+            if (known) {
+                return;
+            }
+            auto held = es.cur_lock_state;
+            const int b = *es.bb_idx;
+            for (uint32_t i = fun.action_begin[b]; i < fun.action_end[b]; i++) {
+                const auto a = fun.action_at(i);
+                if (a.typ == kLock) {
+                    record_order(held, a.lock_id, a.loc);
+                    held = held | a.lock_id.mask();
+                } else if (a.typ == kObservedLock) {
+                    record_order(held, a.lock_id, a.loc);
+                } else if (a.typ == kUnlock) {
+                    held = held & ~a.lock_id.mask();
+                }
+            }
+        };
+        auto visit = clean_block_batch_visitor<decltype(on_states), decltype(on_clean_block)>{on_states, on_clean_block};
+
+        const bool finished = fun.template explore_using<int>(with, visit, 0, std::nullopt, counters, tracker);
+
+        summary.blocking_locks = to_global(blocking_locks, fun.locks);
+        for (size_t i = 0; i < call_held.size(); i++) {
+            summary.calls[i].held = to_global(call_held[i], fun.locks);
+        }
+        return finished;
+    }
+
+    // summarize, going through the cache if there is one; a summary cut short by the time limit
+    // depends on how busy the machine was, so it isn't kept
+    function_summary summarize_cached(const cfg<T>& fun) const {
+        if (cache == nullptr) {
+            return summarize(fun);
+        }
+        const auto fp = cache->fingerprint(fun, func_ids, engine, budget.max_states, slice_locks);
+        if (auto hit = cache->load(fp)) {
+            return from_cache(*hit, fun, fp);
+        }
+        auto summary = summarize(fun);
+        if (summary.limit_hit != kTimeLimit) {
+            cache->store(fp, to_cache(summary, fun, fp));
+        }
+        return summary;
+    }
+
+    cached_summary to_cache(const function_summary& summary, const cfg<T>& fun, const cfg_fingerprint<T>& fp) const {
+        std::vector<uint32_t> local(locks.size(), 0);
+        for (size_t i = 0; i < fun.locks.size(); i++) {
+            local[*lock_idx.find(fun.locks[i])->second] = i;
+        }
+        auto to_local = [&](lock_state<file_checker<T>> global) {
+            uint32_t out = 0;
+            for (uint32_t bits = global.state; bits != 0; bits &= bits - 1) {
+                out |= 1u << local[__builtin_ctz(bits)];
+            }
+            return out;
+        };
+
+        cached_summary out;
+        out.blocking_locks = to_local(summary.blocking_locks);
+        out.limit_hit = summary.limit_hit;
+        for (const auto& [loc, err]: summary.errs) {
+            out.errs.push_back({fp.loc_index.at(loc), (uint32_t)err.typ});
+        }
+        for (const auto& c: summary.calls) {
+            out.calls.push_back({fp.loc_index.at(c.loc), fp.callee_index.at(c.callee), to_local(c.held)});
+        }
+        for (const auto& e: summary.order_edges) {
+            out.order_edges.push_back({local[e.held], local[e.taken], fp.loc_index.at(e.loc)});
+        }
+        return out;
+    }
+
+    function_summary from_cache(const cached_summary& cached, const cfg<T>& fun, const cfg_fingerprint<T>& fp) const {
+        function_summary summary;
+        summary.blocking_locks = to_global(lock_state<lock>{cached.blocking_locks}, fun.locks);
+        summary.limit_hit = (budget_limit)cached.limit_hit;
+        for (const auto& e: cached.errs) {
+            summary.errs.push_back({fp.locs[e.loc], error{(decltype(error::typ))e.typ, ""}});
+        }
+        for (const auto& c: cached.calls) {
+            summary.calls.push_back({fp.locs[c.loc], fp.callees[c.callee], to_global(lock_state<lock>{c.held}, fun.locks)});
+        }
+        for (const auto& e: cached.order_edges) {
+            summary.order_edges.push_back({(uint32_t)*lock_idx.find(fun.locks[e.held])->second, (uint32_t)*lock_idx.find(fun.locks[e.taken])->second, fp.locs[e.loc]});
+        }
+        if constexpr (S::enabled) {
+            summary.stats.cached = true;
+            summary.stats.bbs = fun.num_bbs();
+            summary.stats.actions = fun.num_actions();
+            summary.stats.fallible_calls = fun.fallible_calls;
+            summary.stats.callsites = summary.calls.size();
+        }
+        return summary;
+    }
+
+    // summarize_cached for every function in the batch, with every slice of every function as a piece of work
+    // of its own, so a function with a lot of locks is spread over the threads too
+    void explore_slices(std::vector<std::pair<FuncId, cfg<T>>>& batch, std::vector<function_summary>& summaries, unsigned num_threads) const {
+        std::vector<std::optional<cfg_fingerprint<T>>> fps(batch.size());
+        std::vector<char> hit(batch.size(), 0);
+        std::vector<std::vector<cfg<T>>> slices(batch.size());
+        parallel_for(batch.size(), num_threads, [&](size_t i) {
+            const auto& fun = batch[i].second;
+            if (cache != nullptr) {
+                fps[i] = cache->fingerprint(fun, func_ids, engine, budget.max_states, true);
+                if (auto entry = cache->load(*fps[i])) {
+                    summaries[i] = from_cache(*entry, fun, *fps[i]);
+                    hit[i] = 1;
+                    return;
+                }
+            }
+            slices[i] = fun.slices();
+        });
+
+        // a function that doesn't come apart is one piece by itself
+        std::vector<std::vector<function_summary>> parts(batch.size());
+        std::vector<std::pair<size_t, size_t>> pieces;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!hit[i]) {
+                parts[i].resize(std::max<size_t>(1, slices[i].size()));
+                for (size_t j = 0; j < parts[i].size(); j++) {
+                    pieces.push_back({i, j});
+                }
+            }
+        }
+        parallel_for(pieces.size(), num_threads, [&](size_t k) {
+            const auto [i, j] = pieces[k];
+            parts[i][j] = explore_piece(slices[i].empty() ? batch[i].second : slices[i][j]);
+        });
+
+        parallel_for(batch.size(), num_threads, [&](size_t i) {
+            if (!hit[i]) {
+                summaries[i] = finish_summary(batch[i].second, std::move(parts[i]));
+                if (fps[i] && summaries[i].limit_hit != kTimeLimit) {
+                    cache->store(*fps[i], to_cache(summaries[i], batch[i].second, *fps[i]));
+                }
+            }
+            batch[i].second = cfg<T>{};
+            slices[i] = {};
+        });
+    }
+
+    // adds a function's summary to the call graph, and reports any errors it causes
+    void merge(FuncId name, const function_summary& summary, std::unordered_map<Location, errors>& line_errors) {
+        for (const auto& [loc, err]: summary.errs) {
+            line_errors[loc].add(err);
+        }
+        if (summary.limit_hit != kWithinBudget) {
+            over_budget.push_back({name, summary.limit_hit});
+        }
+        for (const auto& e: summary.order_edges) {
+            add_lock_order(e.held, e.taken, e.loc);
+        }
+
+        // if the function was seen before, its new call sites replace the old ones
+        auto& callees = callees_of[name];
+        for (const auto callee: callees) {
+            auto& sites = called_by[func_ids.name(callee)];
+            sites.erase(std::remove_if(sites.begin(), sites.end(), [&](const callsite<T>& cs) {
+                return cs.caller == name;
+            }), sites.end());
+        }
+        callees.clear();
+
+        lock_state<file_checker<T>> blocking_locks = summary.blocking_locks;
+        for (const auto& c: summary.calls) {
+            const auto& called_func = func_ids.name(c.callee);
+            if (auto it = blocking_locks_used.find(called_func); it != blocking_locks_used.end()) {
+                if ((c.held & it->second) != 0) {
+                    // TODO add an error
+                    line_errors[c.loc].add(errors::call_with_blocking_lock(""));
                 }
+                add_lock_order(c.held, it->second, c.loc);
+                blocking_locks = blocking_locks | it->second;
             }
-        }, 0);
+            // add to call graph
+            called_by[called_func].push_back(callsite<T>{c.loc, c.held, name});
+            callees.push_back(c.callee);
+        }
+        std::sort(callees.begin(), callees.end());
+        callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
 
-        blocking_locks_used[name] = blocking_locks;
+        auto& used = blocking_locks_used[name];
+        const auto before = used;
+        used = blocking_locks;
         //fprintf(stderr, "blocking locks %08x\n", blocking_locks.state);
 
-        check_callers(name, line_errors);
+        if constexpr (S::enabled) {
+            const auto start = std::chrono::steady_clock::now();
+            check_callers(name, before, line_errors);
+
+            // extract_ms is filled in by whatever built the cfg
+            auto& record = stats[name];
+            const double extract_ms = record.extract_ms;
+            record = summary.stats;
+            record.extract_ms = extract_ms;
+            record.check_callers_ms = ms_since(start);
+        } else {
+            check_callers(name, before, line_errors);
+        }
+    }
+
+    // writes the stats for every function as one json document, all on one line, so that documents
+    // for several units can go one after another in the same file
+    void write_stats_json(FILE* out, const std::string& unit) const {
+        std::vector<const std::pair<const FuncId, function_stats>*> sorted;
+        function_stats total;
+        size_t skipped = 0, cached = 0;
+        for (const auto& entry: stats) {
+            sorted.push_back(&entry);
+            skipped += entry.second.skipped;
+            cached += entry.second.cached;
+            total.extract_ms += entry.second.extract_ms;
+            total.explore_ms += entry.second.explore_ms;
+            total.check_callers_ms += entry.second.check_callers_ms;
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) {
+            return a->first < b->first;
+        });
+
+        fprintf(out, "{\"unit\": ");
+        write_json_string(out, unit);
+        fprintf(out, ", \"engine\": \"%s\", \"functions\": [", engine_name(engine));
+        for (size_t i = 0; i < sorted.size(); i++) {
+            write_json(out, sorted[i]->first, sorted[i]->second);
+            if (i + 1 < sorted.size()) {
+                fprintf(out, ", ");
+            }
+        }
+        fprintf(out, "], \"skipped_functions\": %zu, \"skip_ratio\": %.3f, ", skipped, sorted.empty() ? 0.0 : (double)skipped / sorted.size());
+        fprintf(out, "\"cached_functions\": %zu, ", cached);
+        fprintf(out, "\"total_extract_ms\": %.3f, \"total_explore_ms\": %.3f, \"total_check_callers_ms\": %.3f}\n",
+                total.extract_ms, total.explore_ms, total.check_callers_ms);
     }
 };
 
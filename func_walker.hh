@@ -3,11 +3,20 @@
 #include <cstdint>
 #include <cstdio>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <optional>
 #include <queue>
+#include <set>
+#include <type_traits>
 #include <unordered_set>
 #include <vector>
 
+#include "bdd.hh"
+#include "state_table.hh"
+#include "stats.hh"
+
 // almost everything here is templated around a generic variable T, which needs to provide two types,
 // - a Location type for mapping a lock, unlock, or call to its location in code,
 // - and a FuncId type that provides a unique identifier for the function
@@ -84,12 +93,13 @@ struct lock;
 struct fallible_lock;
 template <typename T> struct bb;
 
-enum action_type {
+enum action_type : uint8_t {
     kLock,
     kFallibleLock,
     kUnlock,
     kCall,
-    kEnd // end of function reached
+    kEnd, // end of function reached
+    kObservedLock // only in a slice (see cfg::slices): a take of a lock the slice leaves out, which changes nothing
 };
 template <typename T> struct action {
     using Loc = typename T::Location;
@@ -141,6 +151,24 @@ public:
     }
 };
 
+// which algorithm func<T>::explore_using uses to walk the basic blocks
+enum explore_engine {
+    kBreadthFirst, // one edge_state per combination of fallible lock call results
+    kSymbolic, // one set of fallible lock call results per (basic block, lock state), stored as a bdd
+    kDataflow, // worklist over basic blocks, each block only walks the facts it hasn't seen before
+    kApproximate, // doesn't track fallible lock call results at all; cheap, but can report errors on paths that can't happen
+};
+
+inline const char* engine_name(explore_engine engine) {
+    switch (engine) {
+    case kSymbolic: return "symbolic";
+    case kDataflow: return "dataflow";
+    case kApproximate: return "approximate";
+    case kBreadthFirst: return "breadth_first";
+    }
+    return "unknown";
+}
+
 template <typename T> struct cond_edge {
     idx<bb<T>> on_true;
     std::optional<idx<bb<T>>> on_false;
@@ -168,6 +196,171 @@ template <typename T, typename U> struct edge_state {
     }
 };
 
+// where each part of an edge_state goes when it's packed into a single 64-bit key;
+// the field widths depend on the function, so most functions fit
+struct state_key_layout {
+    uint32_t fallible_bits;
+    uint32_t lock_bits;
+    uint32_t bb_bits;
+
+    bool fits() const {
+        return fallible_bits + lock_bits + bb_bits <= 64;
+    }
+    // whether every packed key is below 2^bits
+    bool fits_in(uint32_t bits) const {
+        return fallible_bits + lock_bits + bb_bits <= bits;
+    }
+
+    uint64_t pack(lock_state<fallible_lock> fallible_locks, lock_state<lock> cur_lock_state, int bb_idx) const {
+        return ((uint64_t)bb_idx << (fallible_bits + lock_bits)) | ((uint64_t)cur_lock_state.state << fallible_bits) | fallible_locks.state;
+    }
+    template <typename T, typename U> edge_state<T, U> unpack(uint64_t key, U added) const {
+        const auto field = [&](uint32_t shift, uint32_t bits) {
+            return (uint32_t)((key >> shift) & ((1ull << bits) - 1));
+        };
+        return {{field(0, fallible_bits)}, (int)field(fallible_bits + lock_bits, bb_bits), {field(fallible_bits, lock_bits)}, added};
+    }
+};
+
+// the set of states an explore engine has already seen
+//
+// states are packed into 64-bit keys and kept in a flat open addressing table when the layout allows it,
+// otherwise this falls back to hashing the edge_state directly
+template <typename T, typename U> struct visited_states {
+    state_key_layout layout;
+    state_set packed;
+    std::unordered_set<edge_state<T, U>> wide;
+
+    explicit visited_states(state_key_layout layout_): layout(layout_) {}
+
+    // returns true if the state hasn't been seen before
+    bool insert(const edge_state<T, U>& es) {
+        if (layout.fits()) {
+            return packed.insert(layout.pack(es.fallible_locks, es.cur_lock_state, *es.bb_idx));
+        }
+        return wide.insert(es).second;
+    }
+
+    size_t size() const {
+        return layout.fits() ? packed.size() : wide.size();
+    }
+};
+
+// what the dense explore engine keeps from one call to the next on the same thread: a bitmap with a bit
+// for every possible state, and a queue of packed keys; each grows to fit the widest keys explored so
+// far, so once a thread has seen a function as wide as any it will, exploring doesn't allocate
+template <typename U> struct dense_scratch {
+    std::vector<uint64_t> visited; // all zero between explores
+    std::vector<uint16_t> keys;
+    std::vector<U> added;
+    bool busy = false; // in use, so an explore started from inside a callback has to use something else
+
+    void reserve(uint32_t key_bits) {
+        const size_t states = (size_t)1 << key_bits;
+        if (keys.size() < states) {
+            visited.resize(std::max<size_t>(1, states / 64), 0);
+            keys.resize(states);
+            added.resize(states);
+        }
+    }
+};
+
+// the calling thread's dense_scratch, shared by every explore with the same U
+template <typename U> dense_scratch<U>& thread_dense_scratch() {
+    static thread_local dense_scratch<U> scratch;
+    return scratch;
+}
+
+// the set of states an explore engine has already seen, for functions small enough that every packed
+// key fits in a dense_scratch bitmap; no hashing, and nothing to allocate
+template <typename T, typename U> struct dense_visited_states {
+    state_key_layout layout;
+    uint64_t* bits;
+    size_t count = 0;
+
+    dense_visited_states(state_key_layout layout_, uint64_t* bits_): layout(layout_), bits(bits_) {}
+
+    // returns true if the state hasn't been seen before
+    bool insert(const edge_state<T, U>& es) {
+        const uint64_t key = layout.pack(es.fallible_locks, es.cur_lock_state, *es.bb_idx);
+        uint64_t& word = bits[key / 64];
+        const uint64_t bit = 1ull << (key % 64);
+        if ((word & bit) != 0) {
+            return false;
+        }
+        word |= bit;
+        count++;
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+};
+
+// the states waiting to be explored, as packed keys in a dense_scratch, for an engine that queues each
+// state at most once; so the queue never holds more states than there are keys, and everything that
+// was ever queued is still there afterwards
+template <typename T, typename U> struct dense_state_queue {
+    state_key_layout layout;
+    uint16_t* keys;
+    U* added;
+    uint32_t head = 0, tail = 0;
+
+    dense_state_queue(state_key_layout layout_, uint16_t* keys_, U* added_): layout(layout_), keys(keys_), added(added_) {}
+
+    void push(const edge_state<T, U>& es) {
+        keys[tail] = layout.pack(es.fallible_locks, es.cur_lock_state, *es.bb_idx);
+        added[tail] = es.added;
+        tail++;
+    }
+    edge_state<T, U> front() const {
+        return layout.unpack<T>(keys[head], added[head]);
+    }
+    void pop() {
+        head++;
+    }
+    bool empty() const {
+        return head == tail;
+    }
+    size_t size() const {
+        return tail - head;
+    }
+};
+
+// a vector that never holds more than N items, kept inline
+template <typename E, size_t N> struct inline_vector {
+    std::array<E, N> items;
+    size_t n = 0;
+
+    void push_back(const E& e) {
+        items[n++] = e;
+    }
+    void resize(size_t size) {
+        n = size;
+    }
+    void clear() {
+        n = 0;
+    }
+    size_t size() const {
+        return n;
+    }
+    E* data() {
+        return items.data();
+    }
+    E& operator[](size_t i) {
+        return items[i];
+    }
+    E* begin() {
+        return items.data();
+    }
+    E* end() {
+        return items.data() + n;
+    }
+};
+
+// a function as it's extracted from the compiler (or written out in a test); this is easy to build
+// up incrementally, and gets converted to a cfg<T> before it's explored
 template <typename T> struct func {
     std::vector<typename T::LockId> locks; // need some kind of lock id to map between locks across calls
     std::vector<bb<T>> bbs;
@@ -201,16 +394,517 @@ template <typename T> struct func {
             }
         }
     }
+};
+
+// how much work an exact explore engine may do on one function before giving up; 0 means no limit
+struct explore_budget {
+    uint64_t max_states = 0;
+    double max_ms = 0;
+
+    bool limited() const {
+        return max_states != 0 || max_ms != 0;
+    }
+};
+
+enum budget_limit : uint8_t {
+    kWithinBudget,
+    kStateLimit,
+    kTimeLimit,
+};
+
+// counts the states an engine visits against an explore_budget
+struct budget_tracker {
+    explore_budget budget;
+    uint64_t states = 0;
+    uint64_t next_time_check = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    budget_limit hit = kWithinBudget;
+
+    // called for every n states visited; returns false once the budget is used up
+    bool charge(uint64_t n = 1) {
+        states += n;
+        if (budget.max_states != 0 && states > budget.max_states) {
+            hit = kStateLimit;
+        } else if (budget.max_ms != 0 && states >= next_time_check) {
+            // reading the clock isn't free, so only do it every few states
+            next_time_check = states + 64;
+            if (ms_since(start) > budget.max_ms) {
+                hit = kTimeLimit;
+            }
+        }
+        return hit == kWithinBudget;
+    }
+};
+
+// maps each T::FuncId to a small integer, so calls can be stored and compared without
+// copying or hashing the function's name
+template <typename T> struct func_table {
+    using FuncId = typename T::FuncId;
+
+    std::unordered_map<FuncId, uint32_t> ids;
+    std::vector<FuncId> names;
+
+    uint32_t intern(const FuncId& name) {
+        if (auto it = ids.find(name); it != ids.end()) {
+            return it->second;
+        }
+        uint32_t id = names.size();
+        ids[name] = id;
+        names.push_back(name);
+        return id;
+    }
+
+    std::optional<uint32_t> find(const FuncId& name) const {
+        if (auto it = ids.find(name); it != ids.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    const FuncId& name(uint32_t id) const {
+        return names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+};
+
+// the net effect of a basic block, for blocks that only take and give locks with blocking calls,
+// so the explore engines can step over the whole block at once instead of replaying it action by action
+//
+// a state entering the block with every lock in must_hold held and every lock in must_be_free free
+// leaves it with (state & ~kill) | gen, and none of the takes or gives in between are errors;
+// any other state has to be replayed to find out where the error is
+struct block_transfer {
+    lock_state<lock> gen = {0}, kill = {0};
+    lock_state<lock> must_hold = {0}, must_be_free = {0};
+    lock_state<lock> taken = {0}; // every lock the block takes
+    lock_state<lock> observed = {0}; // every kObservedLock in the block
+    bool replay = false; // the block calls something or takes a lock with a fallible call, or is an error whatever the state
+
+    void add(action_type typ, lock_state<lock> lock_mask) {
+        if (typ == kLock) {
+            if ((gen & lock_mask) != 0) {
+                replay = true; // taken twice in the block
+            } else if ((kill & lock_mask) == 0) {
+                must_be_free = must_be_free | lock_mask;
+            }
+            gen = gen | lock_mask;
+            kill = kill & ~lock_mask;
+            taken = taken | lock_mask;
+        } else if (typ == kUnlock) {
+            if ((kill & lock_mask) != 0) {
+                replay = true; // given twice in the block
+            } else if ((gen & lock_mask) == 0) {
+                must_hold = must_hold | lock_mask;
+            }
+            kill = kill | lock_mask;
+            gen = gen & ~lock_mask;
+        } else if (typ == kObservedLock) {
+            observed = observed | lock_mask;
+        } else {
+            replay = true;
+        }
+    }
+
+    bool clean_for(lock_state<lock> state) const {
+        return !replay && (state & must_hold) == must_hold && (state & must_be_free) == 0;
+    }
+    lock_state<lock> apply(lock_state<lock> state) const {
+        return (state & ~kill) | gen;
+    }
+};
+
+// explore callbacks can have an on_clean_block(es, transfer) member; if they do, the engines call it for
+// a state that steps over a block with a clean block_transfer, instead of calling the callback for each
+// of the block's actions (which would all be error-free takes and gives)
+template <typename F, typename E, typename = void> struct has_clean_block_hook: std::false_type {};
+template <typename F, typename E> struct has_clean_block_hook<F, E, std::void_t<decltype(std::declval<F&>().on_clean_block(std::declval<const E&>(), std::declval<const block_transfer&>()))>>: std::true_type {};
+
+// an explore callback made of two lambdas, one for each action and one for each clean block
+template <typename F, typename G> struct clean_block_visitor {
+    F on_action;
+    G on_clean;
+
+    template <typename E, typename A> void operator()(E& es, const A& a) {
+        on_action(es, a);
+    }
+    template <typename E> void on_clean_block(const E& es, const block_transfer& t) {
+        on_clean(es, t);
+    }
+};
+
+// every state reaching one action, handed to a callback at once
+//
+// locks[i] is states[i].cur_lock_state, packed together so that a check over every state is a plain
+// loop over 32-bit words that the compiler can vectorize; it's only filled in for callbacks that take batches
+template <typename T, typename U> struct state_batch {
+    edge_state<T, U>* states;
+    const lock_state<lock>* locks;
+    size_t size;
+
+    // the locks held in at least one of the states
+    lock_state<lock> any() const {
+        uint32_t acc = 0;
+        for (size_t i = 0; i < size; i++) {
+            acc |= locks[i].state;
+        }
+        return {acc};
+    }
+    // the locks held in every one of the states
+    lock_state<lock> all() const {
+        uint32_t acc = ~0u;
+        for (size_t i = 0; i < size; i++) {
+            acc &= locks[i].state;
+        }
+        return {acc};
+    }
+};
+
+// explore callbacks can have an on_batch(batch, a) member taking every state that reaches an action
+// together (see state_batch); callbacks without one are called once per state, through per_state_visitor
+template <typename F, typename B, typename A, typename = void> struct has_batch_hook: std::false_type {};
+template <typename F, typename B, typename A> struct has_batch_hook<F, B, A, std::void_t<decltype(std::declval<F&>().on_batch(std::declval<const B&>(), std::declval<const A&>()))>>: std::true_type {};
+
+// adapts a callback that takes one state at a time, f(es, a), to the batched interface
+template <typename F> struct per_state_visitor {
+    F& f;
+
+    template <typename B, typename A> void on_batch(const B& batch, const A& a) {
+        for (size_t i = 0; i < batch.size; i++) {
+            f(batch.states[i], a);
+        }
+    }
+};
+
+// a batched explore callback made of two lambdas, one for the states reaching each action and one for each clean block
+template <typename F, typename G> struct clean_block_batch_visitor {
+    F on_states;
+    G on_clean;
+
+    template <typename B, typename A> void on_batch(const B& batch, const A& a) {
+        on_states(batch, a);
+    }
+    template <typename E> void on_clean_block(const E& es, const block_transfer& t) {
+        on_clean(es, t);
+    }
+};
+
+// an action as it's read back out of a cfg<T>; fields that don't apply to the action type are 0
+template <typename T> struct action_ref {
+    action_type typ;
+    typename T::Location loc;
+    idx<lock> lock_id;
+    idx<fallible_lock> call_id;
+    uint32_t callee; // index of the called function in the func_table the cfg was built with
+};
+
+// compact, read-only form of a func<T> that the explore engines walk
+//
+// the actions of every basic block are stored together in one set of arrays (one entry per action
+// in each), and each basic block stores the range of its actions and its outgoing edges; this keeps
+// a walk through the function to a few linear arrays, with no optionals or strings to chase
+template <typename T> struct cfg {
+    using Loc = typename T::Location;
+
+    std::vector<typename T::LockId> locks;
+
+    // per action; the actions for basic block b are [action_begin[b], action_end[b])
+    std::vector<action_type> tags;
+    std::vector<uint32_t> operands; // lock id | (call id << 8) for locks/unlocks, callee id for calls
+    std::vector<Loc> locs;
+
+    // per basic block; edges that func<T> leaves as nullopt are -1
+    std::vector<uint32_t> action_begin, action_end;
+    std::vector<int32_t> on_true, on_false, depends_on;
+    std::vector<block_transfer> transfers;
+    std::vector<lock_state<fallible_lock>> live; // see live_fallible_calls; worked out once, when the cfg is finished
+
+    idx<bb<T>> start_bb, end_bb;
+    Loc end_line;
+    uint32_t fallible_calls = 0; // one more than the largest fallible lock call id
+    // the most fallible lock calls in any one basic block; each can double the states the block is walked
+    // with, so this bounds how many there are. worked out with live, unknown until then
+    uint32_t block_fallible_calls = ~0u;
+
+    static cfg<T> build(const func<T>& f, func_table<T>& funcs);
+
+    size_t num_bbs() const {
+        return action_begin.size();
+    }
+    size_t num_actions() const {
+        return tags.size();
+    }
+
+    action_ref<T> action_at(uint32_t i) const {
+        const uint32_t op = operands[i];
+        if (tags[i] == kCall) {
+            return {tags[i], locs[i], {0}, {0}, op};
+        }
+        return {tags[i], locs[i], {(int)(op & 0xff)}, {(int)((op >> 8) & 0xff)}, 0};
+    }
+
+    action_ref<T> end_action() const {
+        return {kEnd, end_line, {0}, {0}, 0};
+    }
+
+    block_transfer transfer_of(size_t b) const {
+        block_transfer t;
+        for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+            t.add(tags[i], action_at(i).lock_id.mask());
+        }
+        return t;
+    }
+
+    // the locks with a fallible call some branch depends on, which can decide where the function goes
+    lock_state<lock> branch_locks() const {
+        std::vector<lock_state<lock>> call_lock(fallible_calls, lock_state<lock>{0});
+        for (uint32_t i = 0; i < num_actions(); i++) {
+            if (tags[i] == kFallibleLock) {
+                const auto a = action_at(i);
+                call_lock[*a.call_id] = a.lock_id.mask();
+            }
+        }
+        lock_state<lock> out = {0};
+        for (size_t b = 0; b < num_bbs(); b++) {
+            if (depends_on[b] >= 0 && depends_on[b] < (int)fallible_calls) {
+                out = out | call_lock[depends_on[b]];
+            }
+        }
+        return out;
+    }
+
+    // the function cut up so its locks can be explored separately, or nothing if it doesn't come apart
+    //
+    // a lock's state only ever depends on its own takes and gives, and on which way the branches went;
+    // a branch is either on every path or decided by a fallible call. so a slice keeps every block, edge
+    // and call, the actions of its own lock, and those of every lock in branch_locks. takes of the other
+    // locks become kObservedLock, which only shows the callback what's held there, and their gives are
+    // dropped. a slice then reaches the same actions the whole function does, with its locks held in the
+    // same combinations, and exploring it finds the same things about them. there's a slice for each lock
+    // that isn't branched on, so the states explored add up over the locks instead of multiplying
+    std::vector<cfg<T>> slices() const {
+        const auto shared = branch_locks();
+        std::vector<cfg<T>> out;
+        for (size_t l = 0; l < locks.size(); l++) {
+            const idx<lock> own = {(int)l};
+            if ((shared & own.mask()) == 0) {
+                out.push_back(slice(shared | own.mask()));
+            }
+        }
+        if (out.size() <= 1) {
+            return {};
+        }
+        return out;
+    }
+
+    // the function with only the locks in keep, as above; lock and fallible call ids stay the same
+    cfg<T> slice(lock_state<lock> keep) const {
+        cfg<T> s;
+        s.locks = locks;
+        s.on_true = on_true;
+        s.on_false = on_false;
+        s.depends_on = depends_on;
+        s.start_bb = start_bb;
+        s.end_bb = end_bb;
+        s.end_line = end_line;
+        s.fallible_calls = fallible_calls;
+        for (size_t b = 0; b < num_bbs(); b++) {
+            s.action_begin.push_back(s.tags.size());
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                const auto a = action_at(i);
+                if (a.typ == kCall || (keep & a.lock_id.mask()) != 0) {
+                    s.tags.push_back(tags[i]);
+                    s.operands.push_back(operands[i]);
+                } else if (a.typ == kLock || a.typ == kFallibleLock) {
+                    s.tags.push_back(kObservedLock);
+                    s.operands.push_back(*a.lock_id);
+                } else {
+                    continue;
+                }
+                s.locs.push_back(locs[i]);
+            }
+            s.action_end.push_back(s.tags.size());
+            s.transfers.push_back(s.transfer_of(b));
+        }
+        s.live = s.live_fallible_calls();
+        s.block_fallible_calls = s.most_fallible_calls_in_a_block();
+        return s;
+    }
+
+    void dump(const func_table<T>& funcs) const {
+        fprintf(stderr, "cfg start %d end %d\n", *start_bb, *end_bb);
+        for (size_t b = 0; b < num_bbs(); b++) {
+            fprintf(stderr, "bb idx %zu depends_on %d true %d false %d\n", b, depends_on[b], on_true[b], on_false[b]);
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                const auto a = action_at(i);
+                switch (a.typ) {
+                case kLock: fprintf(stderr, "\tlock id %d\n", *a.lock_id); break;
+                case kFallibleLock: fprintf(stderr, "\tfallible lock id %d call %d\n", *a.lock_id, *a.call_id); break;
+                case kUnlock: fprintf(stderr, "\tunlock id %d\n", *a.lock_id); break;
+                case kCall: fprintf(stderr, "\tcall %s\n", funcs.name(a.callee).c_str()); break;
+                case kObservedLock: fprintf(stderr, "\tobserved lock id %d\n", *a.lock_id); break;
+                default: fprintf(stderr, "\tUNKNOWN; this shouldn\'t happen!\n");
+                }
+            }
+        }
+    }
+
+    // updates the states inside a basic block after an action; fallible lock calls add a new state
+    // for every existing state where the lock can be taken
+    template <typename S> static void apply_action(const action_ref<T>& a, S& possible_states) {
+        if (a.typ == kLock) {
+            auto lock_mask = a.lock_id.mask();
+            for (auto &es: possible_states) {
+                es.cur_lock_state = es.cur_lock_state | lock_mask;
+            }
+        } else if (a.typ == kFallibleLock) {
+            auto call_mask = a.call_id.mask();
+            auto lock_mask = a.lock_id.mask();
+
+            int len = possible_states.size();
+            for (int i = 0; i < len; i++) {
+                // the call failing is the default state, and the only possible one if the lock is already held
+                possible_states[i].fallible_locks = possible_states[i].fallible_locks & ~call_mask;
+                if ((possible_states[i].cur_lock_state & lock_mask) == 0) {
+                    // add the state where the lock was successfully taken
+                    auto taken = possible_states[i];
+                    taken.fallible_locks = taken.fallible_locks | call_mask;
+                    taken.cur_lock_state = taken.cur_lock_state | lock_mask;
+                    possible_states.push_back(taken);
+                }
+            }
+        } else if (a.typ == kUnlock) {
+            auto lock_mask = a.lock_id.mask();
+            for (auto &es: possible_states) {
+                es.cur_lock_state = es.cur_lock_state & ~lock_mask;
+            }
+        }
+        // NOTE: we ignore calls here; calls should not affect the lock state
+        // TODO add support for lock helper
+    }
+
+    // hands the n states starting at states, all reaching action a, to f; locks is scratch space for the batch
+    template <typename U, typename F, typename L> void visit_states(F& f, edge_state<T, U>* states, size_t n, const action_ref<T>& a, L& locks) const {
+        if constexpr (has_batch_hook<F, state_batch<T, U>, action_ref<T>>::value) {
+            locks.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                locks[i] = states[i].cur_lock_state;
+            }
+            f.on_batch(state_batch<T, U>{states, locks.data(), n}, a);
+        } else {
+            per_state_visitor<F>{f}.on_batch(state_batch<T, U>{states, nullptr, n}, a);
+        }
+    }
+
+    // if f has an on_clean_block hook and es can step over block b in one go, does that and returns true
+    template <typename U, typename F> bool step_block(int b, edge_state<T, U>& es, F& f) const {
+        if constexpr (has_clean_block_hook<F, edge_state<T, U>>::value) {
+            const auto& t = transfers[b];
+            if (t.clean_for(es.cur_lock_state)) {
+                f.on_clean_block(es, t);
+                es.cur_lock_state = t.apply(es.cur_lock_state);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // calls push with the state at the start of every basic block es can continue to from block b
+    template <typename U, typename G> void for_each_successor(int b, const edge_state<T, U>& es, G push) const {
+        if (depends_on[b] >= 0) {
+            idx<fallible_lock> i = depends_on[b];
+            if ((es.fallible_locks & i.mask()) != 0) {
+                push(edge_state<T, U>{es.fallible_locks, on_true[b], es.cur_lock_state, es.added});
+            } else {
+                push(edge_state<T, U>{es.fallible_locks, on_false[b], es.cur_lock_state, es.added});
+            }
+        } else {
+            // the conditional does not depend on a fallible lock call (as far as we can tell),
+            // continue on both branches
+            push(edge_state<T, U>{es.fallible_locks, on_true[b], es.cur_lock_state, es.added});
+            if (on_false[b] >= 0) {
+                push(edge_state<T, U>{es.fallible_locks, on_false[b], es.cur_lock_state, es.added});
+            }
+        }
+    }
+
+    // calls f(es, a) for every action a in the function, for every state es that can reach it
+    //
+    // every engine takes an optional set of counters to update, see stats.hh; the exact engines also
+    // take an optional budget, and return false without finishing if it runs out
+    template <typename U, typename F, typename C = no_stats> bool explore(F f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt, C* counters = nullptr, budget_tracker* budget = nullptr) const {
+        // small functions get a bitmap of every state they could have instead of a hash table, and a
+        // queue with room for every state, both kept for the thread's next explore
+        if (explores_dense()) {
+            auto& scratch = thread_dense_scratch<U>();
+            if (!scratch.busy) {
+                return explore_dense(scratch, f, init_val, start_state, counters, budget);
+            }
+        }
+        visited_states<T, U> visited(key_layout());
+        return explore_with(visited, f, init_val, start_state, counters, budget);
+    }
 
-    template <typename U, typename F> void explore(F f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt) const {
+    static constexpr uint32_t kDenseMaxBits = 15; // at most 4 KB of bitmap and 32768 queued keys per thread
+    static constexpr uint32_t kDenseBlockFallibleCalls = 6; // so a block is walked with at most 64 states
+
+    // whether explore walks this function without allocating (once the thread's scratch is big enough)
+    bool explores_dense() const {
+        return key_layout().fits_in(kDenseMaxBits) && block_fallible_calls <= kDenseBlockFallibleCalls;
+    }
+
+    // explore with the given set of visited states, which must start out empty
+    template <typename U, typename V, typename F, typename C = no_stats> bool explore_with(V& visited, F& f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt, C* counters = nullptr, budget_tracker* budget = nullptr) const {
         std::queue<edge_state<T, U>> to_explore;
-        std::unordered_set<edge_state<T, U>> visited;
         std::vector<edge_state<T, U>> possible_states;
+        std::vector<lock_state<lock>> batch_locks;
+        return walk<false>(visited, to_explore, possible_states, batch_locks, f, init_val, start_state, counters, budget);
+    }
+
+    // explore with scratch's bitmap and queue, sized for this function's keys; only for functions where
+    // explores_dense() holds
+    template <typename U, typename F, typename C> bool explore_dense(dense_scratch<U>& scratch, F& f, U init_val, std::optional<edge_state<T, U>> start_state, C* counters, budget_tracker* budget) const {
+        const auto layout = key_layout();
+        scratch.reserve(layout.fallible_bits + layout.lock_bits + layout.bb_bits);
+        scratch.busy = true;
+        dense_visited_states<T, U> visited(layout, scratch.visited.data());
+        dense_state_queue<T, U> to_explore(layout, scratch.keys.data(), scratch.added.data());
+        inline_vector<edge_state<T, U>, (size_t)1 << kDenseBlockFallibleCalls> possible_states;
+        inline_vector<lock_state<lock>, (size_t)1 << kDenseBlockFallibleCalls> batch_locks;
+        const bool finished = walk<true>(visited, to_explore, possible_states, batch_locks, f, init_val, start_state, counters, budget);
+
+        // every state that was marked visited was queued, so only their bits need clearing; the values
+        // they were queued with are dropped too, so the scratch doesn't keep anything of f's alive
+        for (uint32_t i = 0; i < to_explore.tail; i++) {
+            scratch.visited[scratch.keys[i] / 64] = 0;
+            scratch.added[i] = U{};
+        }
+        scratch.busy = false;
+        return finished;
+    }
+
+    // the breadth first walk behind explore_with and explore_dense; with QueueOnce states are marked
+    // visited as they're queued rather than as they're taken off the queue, which visits the same
+    // states in the same order but never queues one twice
+    template <bool QueueOnce, typename U, typename V, typename Q, typename S, typename L, typename F, typename C>
+    bool walk(V& visited, Q& to_explore, S& possible_states, L& batch_locks, F& f, U init_val, std::optional<edge_state<T, U>> start_state, C* counters, budget_tracker* budget) const {
+        auto push = [&](edge_state<T, U> es) {
+            es.fallible_locks = es.fallible_locks & live[*es.bb_idx];
+            if (QueueOnce && !visited.insert(es)) {
+                return;
+            }
+            to_explore.push(es);
+            if constexpr (C::enabled) {
+                counters->enqueued(to_explore.size());
+            }
+        };
 
         if (start_state) {
-            to_explore.push(*start_state);
+            push(*start_state);
         } else {
-            to_explore.push({{0}, start_bb, {0}, init_val});
+            push({{0}, start_bb, {0}, init_val});
         }
         while (!to_explore.empty()) {
             possible_states.clear();
@@ -218,96 +912,588 @@ template <typename T> struct func {
             auto e = to_explore.front();
             to_explore.pop();
 
-            if (visited.find(e) != visited.end()) {
+            if (!QueueOnce && !visited.insert(e)) {
                 continue;
             }
-            visited.insert(e);
+            if constexpr (C::enabled) {
+                counters->visited();
+            }
+            if (budget && !budget->charge()) {
+                return false;
+            }
 
             //fprintf(stderr, "accessing bb %d\n", *e.bb_idx);
-            const auto &bb = bbs[*e.bb_idx];
+            const int b = *e.bb_idx;
 
             if (e.bb_idx == end_bb) {
-                f(e, bb, { kEnd });
+                visit_states(f, &e, 1, end_action(), batch_locks);
+                continue;
+            }
+
+            if (step_block(b, e, f)) {
+                for_each_successor(b, e, push);
                 continue;
             }
 
             possible_states.push_back(e);
-            for (const auto& a: bb.actions) {
-                for (auto& es: possible_states) {
-                    f(es, bb, a);
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                const auto a = action_at(i);
+                visit_states(f, possible_states.data(), possible_states.size(), a, batch_locks);
+
+                apply_action(a, possible_states);
+            }
+
+            // propagate to the next basic block
+            for (auto& es: possible_states) {
+                for_each_successor(b, es, push);
+            }
+        }
+        return true;
+    }
+
+    uint32_t most_fallible_calls_in_a_block() const {
+        uint32_t most = 0;
+        for (size_t b = 0; b < num_bbs(); b++) {
+            uint32_t n = 0;
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                n += tags[i] == kFallibleLock;
+            }
+            most = std::max(most, n);
+        }
+        return most;
+    }
+
+    state_key_layout key_layout() const {
+        uint32_t bb_bits = 1;
+        while (bb_bits < 32 && (num_bbs() >> bb_bits) != 0) {
+            bb_bits++;
+        }
+        return {fallible_calls, (uint32_t)locks.size(), bb_bits};
+    }
+
+    // position of each basic block in a reverse postorder walk from start_bb; unreachable blocks are -1
+    //
+    // worklists ordered by this handle every predecessor of a block before the block itself (ignoring back edges),
+    // so the states coming from different paths are merged before the block is walked
+    std::vector<int> reverse_postorder() const {
+        std::vector<int> order(num_bbs(), -1);
+        std::vector<std::pair<int, int>> stack; // bb index, next successor to visit
+        std::vector<int> postorder;
+        std::vector<bool> seen(num_bbs(), false);
+
+        stack.push_back({*start_bb, 0});
+        seen[*start_bb] = true;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            int succ = -1;
+            if (b != *end_bb) {
+                if (next == 0) {
+                    succ = on_true[b];
+                } else if (next == 1) {
+                    succ = on_false[b];
+                }
+            }
+            if (next < 2) {
+                next++;
+                if (succ >= 0 && succ < (int)num_bbs() && !seen[succ]) {
+                    seen[succ] = true;
+                    stack.push_back({succ, 0});
                 }
+                continue;
+            }
+            postorder.push_back(b);
+            stack.pop_back();
+        }
 
-                // modify current possible states based on f
-                if (a.typ == kLock) {
-                    auto lock_mask = (1 << **a.lock_id);
-                    for (auto &es: possible_states) {
-                        es.cur_lock_state = es.cur_lock_state | lock_mask;
-                    }
-                } else if (a.typ == kFallibleLock) {
-                    //assert(a.call_id.has_val());
-                    auto call_mask = a.call_id->mask();
-                    auto lock_mask = a.lock_id->mask();
+        for (size_t i = 0; i < postorder.size(); i++) {
+            order[postorder[postorder.size() - 1 - i]] = i;
+        }
+        return order;
+    }
 
-                    if ((e.cur_lock_state & lock_mask) != 0) {
-                        // do nothing; the lock can only fail, which is the default state
-                    } else {
-                        // add the states where the lock was successfully taken
-                        //assert(!(es[i].fallible_locks & mask));
-
-                        int len = possible_states.size();
-                        for (int i = 0; i < len; i++) {
-                            possible_states.push_back({
-                                possible_states[i].fallible_locks | call_mask,
-                                possible_states[i].bb_idx,
-                                e.cur_lock_state | lock_mask,
-                                possible_states[i].added
-                            });
+    // for each basic block, the fallible lock calls whose results can still be checked by a branch
+    // before being overwritten by the call happening again (ie the live variables at the start of the block)
+    //
+    // the other bits in edge_state::fallible_locks can never change where the function goes, so the explore
+    // engines clear them; states that only differ in dead bits then end up as the same state
+    std::vector<lock_state<fallible_lock>> live_fallible_calls() const {
+        std::vector<lock_state<fallible_lock>> uses(num_bbs(), {0}), defs(num_bbs(), {0}), live_in(num_bbs(), {0});
+        for (size_t b = 0; b < num_bbs(); b++) {
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                if (tags[i] == kFallibleLock) {
+                    defs[b] = defs[b] | action_at(i).call_id.mask();
+                }
+            }
+            if (depends_on[b] >= 0) {
+                uses[b] = idx<fallible_lock>{depends_on[b]}.mask();
+            }
+        }
+
+        // the branch is checked after every action in the block, so a block's own uses are the only ones its defs hide
+        const auto order = reverse_postorder();
+        std::vector<int> backwards;
+        for (size_t b = 0; b < num_bbs(); b++) {
+            backwards.push_back(b);
+        }
+        std::sort(backwards.begin(), backwards.end(), [&](int a, int b) {
+            return order[a] > order[b];
+        });
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int b: backwards) {
+                if (b == *end_bb) {
+                    continue;
+                }
+                lock_state<fallible_lock> live_out = uses[b];
+                if (on_true[b] >= 0 && on_true[b] < (int)num_bbs()) {
+                    live_out = live_out | live_in[on_true[b]];
+                }
+                if (on_false[b] >= 0) {
+                    live_out = live_out | live_in[on_false[b]];
+                }
+
+                auto new_live_in = live_out & ~defs[b];
+                if (new_live_in != live_in[b]) {
+                    live_in[b] = new_live_in;
+                    changed = true;
+                }
+            }
+        }
+        return live_in;
+    }
+
+    // symbolic version of explore; instead of queueing a separate edge_state for every combination
+    // of fallible lock call results, all the combinations that reach a basic block with a given lock state
+    // are stored together as a bdd, and a block is only walked again when that set grows
+    //
+    // f sees the same (action, cur_lock_state) pairs as with explore, but only once per distinct lock state
+    // each time the set grows; es.fallible_locks is one of the combinations in the set
+    template <typename U, typename F, typename C = no_stats> bool explore_symbolic(F f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt, C* counters = nullptr, budget_tracker* budget = nullptr) const {
+        const uint32_t num_vars = fallible_calls;
+
+        bdd sets;
+        std::unordered_map<uint64_t, bdd::ref> reached; // (bb idx, lock state) -> fallible lock results seen
+        std::unordered_map<uint64_t, bdd::ref> pending; // the part of reached that hasn't been walked yet
+        std::set<std::pair<int, uint64_t>> to_explore; // ordered by reverse postorder of the basic block
+        const auto order = reverse_postorder();
+
+        const uint32_t all_vars = num_vars >= 32 ? ~0u : (1u << num_vars) - 1;
+
+        auto add = [&](idx<bb<T>> bb_idx, lock_state<lock> lock_state_, bdd::ref s) {
+            s = sets.clear_all(s, all_vars & ~live[*bb_idx].state);
+            const uint64_t key = ((uint64_t)*bb_idx << 32) | lock_state_.state;
+            auto& seen = reached[key];
+            auto grown = sets.diff(s, seen);
+            if (grown == bdd::kFalse) {
+                return;
+            }
+            seen = sets.or_(seen, grown);
+
+            auto& p = pending[key];
+            if (p == bdd::kFalse) {
+                to_explore.insert({order[*bb_idx], key});
+                if constexpr (C::enabled) {
+                    counters->enqueued(to_explore.size());
+                }
+            }
+            p = sets.or_(p, grown);
+        };
+
+        U added = init_val;
+        if (start_state) {
+            added = start_state->added;
+            add(start_state->bb_idx, start_state->cur_lock_state, sets.single(start_state->fallible_locks.state, num_vars));
+        } else {
+            add(start_bb, {0}, sets.single(0, num_vars));
+        }
+
+        // every lock state reachable inside the current basic block, along with the results that lead to it
+        std::vector<std::pair<lock_state<lock>, bdd::ref>> possible_states, next_states;
+        std::vector<edge_state<T, U>> batch_states;
+        std::vector<lock_state<lock>> batch_locks;
+        auto merge_into = [&](std::vector<std::pair<lock_state<lock>, bdd::ref>>& dst, lock_state<lock> lock_state_, bdd::ref s) {
+            if (s == bdd::kFalse) {
+                return;
+            }
+            for (auto& [l, r]: dst) {
+                if (l == lock_state_) {
+                    r = sets.or_(r, s);
+                    return;
+                }
+            }
+            dst.push_back({lock_state_, s});
+        };
+
+        while (!to_explore.empty()) {
+            const uint64_t key = to_explore.begin()->second;
+            to_explore.erase(to_explore.begin());
+
+            const idx<bb<T>> bb_idx = {(int)(key >> 32)};
+            const int b = *bb_idx;
+            const lock_state<lock> entry_state = {(uint32_t)key};
+            const bdd::ref entry_set = pending[key];
+            pending.erase(key);
+            if constexpr (C::enabled) {
+                counters->visited();
+            }
+            if (budget && !budget->charge()) {
+                return false;
+            }
+
+            auto to_edge_state = [&](lock_state<lock> l, bdd::ref s) {
+                return edge_state<T, U>{{sets.any(s)}, bb_idx, l, added};
+            };
+
+            if (bb_idx == end_bb) {
+                auto es = to_edge_state(entry_state, entry_set);
+                visit_states(f, &es, 1, end_action(), batch_locks);
+                continue;
+            }
+
+            possible_states.clear();
+            possible_states.push_back({entry_state, entry_set});
+            uint32_t first_action = action_begin[b];
+            if constexpr (has_clean_block_hook<F, edge_state<T, U>>::value) {
+                auto es = to_edge_state(entry_state, entry_set);
+                if (step_block(b, es, f)) {
+                    // nothing left to replay
+                    possible_states[0].first = es.cur_lock_state;
+                    first_action = action_end[b];
+                }
+            }
+            for (uint32_t i = first_action; i < action_end[b]; i++) {
+                const auto a = action_at(i);
+                batch_states.clear();
+                for (auto& [l, s]: possible_states) {
+                    batch_states.push_back(to_edge_state(l, s));
+                }
+                visit_states(f, batch_states.data(), batch_states.size(), a, batch_locks);
+
+                if (a.typ != kLock && a.typ != kFallibleLock && a.typ != kUnlock) {
+                    continue;
+                }
+
+                const auto lock_mask = a.lock_id.mask();
+                next_states.clear();
+                for (auto& [l, s]: possible_states) {
+                    if (a.typ == kLock) {
+                        merge_into(next_states, l | lock_mask, s);
+                    } else if (a.typ == kFallibleLock) {
+                        const uint32_t call_var = *a.call_id;
+                        merge_into(next_states, l, sets.assign(s, call_var, false));
+                        if ((l & lock_mask) == 0) {
+                            merge_into(next_states, l | lock_mask, sets.assign(s, call_var, true));
                         }
-                    }
-                } else if (a.typ == kUnlock) {
-                    auto lock_mask = a.lock_id->mask();
-                    for (auto &es: possible_states) {
-                        es.cur_lock_state = es.cur_lock_state & ~lock_mask;
+                    } else {
+                        merge_into(next_states, l & ~lock_mask, s);
                     }
                 }
-                // NOTE: we ignore calls here; calls should not affect the lock state
-                // TODO add support for lock helper
+                std::swap(possible_states, next_states);
             }
 
             // propagate to the next basic block
-            for (auto& es: possible_states) {
-                if (bb.next.depends_on.has_value()) {
-                    idx<fallible_lock> i = *bb.next.depends_on;
-                    if ((es.fallible_locks & i.mask()) != 0) {
-                        to_explore.push(edge_state<T, U>{es.fallible_locks, bb.next.on_true, es.cur_lock_state, es.added});
-                        //fprintf(stderr, "queued bb %d from %d\n", *bb.next.on_true, *e.bb_idx);
+            for (auto& [l, s]: possible_states) {
+                if (depends_on[b] >= 0) {
+                    auto taken = sets.var(depends_on[b]);
+                    add(on_true[b], l, sets.and_(s, taken));
+                    add(on_false[b], l, sets.diff(s, taken));
+                } else {
+                    add(on_true[b], l, s);
+                    if (on_false[b] >= 0) {
+                        add(on_false[b], l, s);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // dataflow version of explore; every basic block keeps the set of (lock state, fallible lock results)
+    // facts that reach it, and is only walked again for the facts that are new since the last time it was walked
+    //
+    // all the new facts for a block are walked through its actions together, so every action is visited
+    // once per block per change instead of once per queued state; f is called with exactly the same states
+    // as with explore
+    template <typename U, typename F, typename C = no_stats> bool explore_dataflow(F f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt, C* counters = nullptr, budget_tracker* budget = nullptr) const {
+        visited_states<T, U> reached(key_layout());
+        std::vector<std::vector<edge_state<T, U>>> pending(num_bbs()); // facts in reached that haven't been walked yet
+        std::set<std::pair<int, int>> to_explore; // ordered by reverse postorder of the basic block
+        const auto order = reverse_postorder();
+        std::vector<edge_state<T, U>> possible_states;
+        std::vector<lock_state<lock>> batch_locks;
+
+        auto add = [&](edge_state<T, U> es) {
+            const int b = *es.bb_idx;
+            es.fallible_locks = es.fallible_locks & live[b];
+            if (!reached.insert(es)) {
+                return;
+            }
+            if (pending[b].empty()) {
+                to_explore.insert({order[b], b});
+            }
+            pending[b].push_back(es);
+            if constexpr (C::enabled) {
+                counters->enqueued(to_explore.size());
+            }
+        };
+
+        if (start_state) {
+            add(*start_state);
+        } else {
+            add({{0}, start_bb, {0}, init_val});
+        }
+        while (!to_explore.empty()) {
+            const int b = to_explore.begin()->second;
+            to_explore.erase(to_explore.begin());
+
+            possible_states.clear();
+            std::swap(possible_states, pending[b]);
+            if constexpr (C::enabled) {
+                counters->states_visited += possible_states.size();
+            }
+            if (budget && !budget->charge(possible_states.size())) {
+                return false;
+            }
+
+            if (b == *end_bb) {
+                visit_states(f, possible_states.data(), possible_states.size(), end_action(), batch_locks);
+                continue;
+            }
+
+            if constexpr (has_clean_block_hook<F, edge_state<T, U>>::value) {
+                // states that can step over the block in one go don't need to be replayed
+                size_t kept = 0;
+                for (auto& es: possible_states) {
+                    if (step_block(b, es, f)) {
+                        for_each_successor(b, es, add);
                     } else {
-                        to_explore.push(edge_state<T, U>{es.fallible_locks, *bb.next.on_false, es.cur_lock_state, es.added});
-                        //fprintf(stderr, "queued bb %d from %d\n", **bb.next.on_false, *e.bb_idx);
+                        possible_states[kept++] = es;
                     }
-                } else {
-                    // the conditional does not depend on a fallible lock call (as far as we can tell),
-                    // continue on both branches
-                    to_explore.push(edge_state<T, U>{es.fallible_locks, bb.next.on_true, es.cur_lock_state, es.added});
-                    //fprintf(stderr, "queued bb %d from %d\n", *bb.next.on_true, *e.bb_idx);
-                    if (bb.next.on_false.has_value()) {
-                        to_explore.push(edge_state<T, U>{es.fallible_locks, *bb.next.on_false, es.cur_lock_state, es.added});
-                        //fprintf(stderr, "queued bb %d from %d\n", **bb.next.on_false, *e.bb_idx);
+                }
+                possible_states.resize(kept);
+            }
+
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                const auto a = action_at(i);
+                visit_states(f, possible_states.data(), possible_states.size(), a, batch_locks);
+                apply_action(a, possible_states);
+            }
+
+            for (auto& es: possible_states) {
+                for_each_successor(b, es, add);
+            }
+        }
+        return true;
+    }
+
+    // over-approximating version of explore, for functions too big to explore exactly
+    //
+    // fallible lock call results aren't tracked; instead a lock taken by a fallible call is "maybe held"
+    // until a branch on that call's result makes it held (on the true edge) or not held (on the false edge),
+    // or it's given or taken again. a state is (basic block, held locks, maybe held locks), so there are
+    // at most bbs * 3^locks of them however many fallible calls there are
+    //
+    // f is called with every maybe held lock held, and again with none of them held; each check file_checker
+    // makes is about a single lock, so between them it sees every error explore would, plus possibly some
+    // on paths that can't happen. es.fallible_locks is always 0
+    template <typename U, typename F, typename C = no_stats> void explore_approximate(F f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt, C* counters = nullptr) const {
+        std::vector<lock_state<lock>> call_lock(fallible_calls, lock_state<lock>{0}); // the lock each fallible call takes
+        for (uint32_t i = 0; i < num_actions(); i++) {
+            if (tags[i] == kFallibleLock) {
+                const auto a = action_at(i);
+                call_lock[*a.call_id] = a.lock_id.mask();
+            }
+        }
+
+        // while exploring, edge_state::fallible_locks holds the maybe held locks
+        std::queue<edge_state<T, U>> to_explore;
+        visited_states<T, U> visited(state_key_layout{(uint32_t)locks.size(), (uint32_t)locks.size(), key_layout().bb_bits});
+        auto push = [&](idx<bb<T>> bb_idx, lock_state<lock> held, lock_state<lock> maybe, U added) {
+            to_explore.push({{maybe.state}, bb_idx, held, added});
+            if constexpr (C::enabled) {
+                counters->enqueued(to_explore.size());
+            }
+        };
+        std::vector<lock_state<lock>> batch_locks;
+        auto visit = [&](const edge_state<T, U>& es, const action_ref<T>& a) {
+            edge_state<T, U> both[2] = {
+                {{0}, es.bb_idx, es.cur_lock_state | es.fallible_locks.state, es.added},
+                {{0}, es.bb_idx, es.cur_lock_state, es.added},
+            };
+            visit_states(f, both, es.fallible_locks != 0 ? 2 : 1, a, batch_locks);
+        };
+
+        if (start_state) {
+            push(start_state->bb_idx, start_state->cur_lock_state, {0}, start_state->added);
+        } else {
+            push(start_bb, {0}, {0}, init_val);
+        }
+        while (!to_explore.empty()) {
+            auto es = to_explore.front();
+            to_explore.pop();
+
+            if (!visited.insert(es)) {
+                continue;
+            }
+            if constexpr (C::enabled) {
+                counters->visited();
+            }
+
+            const int b = *es.bb_idx;
+            if (es.bb_idx == end_bb) {
+                visit(es, end_action());
+                continue;
+            }
+
+            lock_state<lock> held = es.cur_lock_state;
+            lock_state<lock> maybe = {es.fallible_locks.state};
+            for (uint32_t i = action_begin[b]; i < action_end[b]; i++) {
+                const auto a = action_at(i);
+                visit({{maybe.state}, es.bb_idx, held, es.added}, a);
+
+                const auto lock_mask = a.lock_id.mask();
+                if (a.typ == kLock) {
+                    held = held | lock_mask;
+                    maybe = maybe & ~lock_mask;
+                } else if (a.typ == kFallibleLock) {
+                    // fails if the lock is already held, otherwise it might go either way
+                    if ((held & lock_mask) == 0) {
+                        maybe = maybe | lock_mask;
                     }
+                } else if (a.typ == kUnlock) {
+                    held = held & ~lock_mask;
+                    maybe = maybe & ~lock_mask;
+                }
+            }
+
+            // a branch on the result of the call that made a lock maybe held settles it either way
+            if (depends_on[b] >= 0 && (maybe & call_lock[depends_on[b]]) != 0) {
+                const auto l = call_lock[depends_on[b]];
+                push(on_true[b], held | l, maybe & ~l, es.added);
+                if (on_false[b] >= 0) {
+                    push(on_false[b], held, maybe & ~l, es.added);
                 }
+                continue;
+            }
+            push(on_true[b], held, maybe, es.added);
+            if (on_false[b] >= 0) {
+                push(on_false[b], held, maybe, es.added);
             }
         }
     }
+
+    // runs whichever exploration engine is selected; the callback and arguments are the same for all of them
+    //
+    // returns false if the engine ran out of budget before finishing; kApproximate has no budget and always finishes
+    template <typename U, typename F, typename C = no_stats> bool explore_using(explore_engine engine, F f, U init_val, std::optional<edge_state<T, U>> start_state = std::nullopt, C* counters = nullptr, budget_tracker* budget = nullptr) const {
+        switch (engine) {
+        case kSymbolic:
+            return explore_symbolic<U>(f, init_val, start_state, counters, budget);
+        case kDataflow:
+            return explore_dataflow<U>(f, init_val, start_state, counters, budget);
+        case kApproximate:
+            explore_approximate<U>(f, init_val, start_state, counters);
+            return true;
+        case kBreadthFirst:
+        default:
+            return explore<U>(f, init_val, start_state, counters, budget);
+        }
+    }
 };
 
+// builds a cfg<T> one basic block at a time; the blocks can be added in any order,
+// but all the actions for a block have to be added between its begin_block and end_block
+template <typename T> struct cfg_builder {
+    using Loc = typename T::Location;
+
+    cfg<T> graph;
+    func_table<T>& funcs;
+    int cur_bb = -1;
+
+    cfg_builder(func_table<T>& funcs_, size_t num_bbs): funcs(funcs_) {
+        graph.action_begin.resize(num_bbs, 0);
+        graph.action_end.resize(num_bbs, 0);
+        graph.on_true.resize(num_bbs, -1);
+        graph.on_false.resize(num_bbs, -1);
+        graph.depends_on.resize(num_bbs, -1);
+        graph.transfers.resize(num_bbs);
+    }
+
+    void begin_block(int b) {
+        cur_bb = b;
+        graph.action_begin[b] = graph.tags.size();
+    }
+
+    void lock_(Loc loc, idx<lock> lock_id) {
+        push(kLock, loc, *lock_id);
+    }
+    void fallible_lock_(Loc loc, idx<lock> lock_id, idx<fallible_lock> call_id) {
+        push(kFallibleLock, loc, *lock_id | (*call_id << 8));
+        graph.fallible_calls = std::max(graph.fallible_calls, (uint32_t)*call_id + 1);
+    }
+    void unlock_(Loc loc, idx<lock> lock_id) {
+        push(kUnlock, loc, *lock_id);
+    }
+    void call_(Loc loc, const typename T::FuncId& called_func) {
+        push(kCall, loc, funcs.intern(called_func));
+    }
+    void add(const action<T>& a) {
+        switch (a.typ) {
+        case kLock: lock_(a.loc, *a.lock_id); break;
+        case kFallibleLock: fallible_lock_(a.loc, *a.lock_id, *a.call_id); break;
+        case kUnlock: unlock_(a.loc, *a.lock_id); break;
+        case kCall: call_(a.loc, *a.called_func); break;
+        default: break;
+        }
+    }
+
+    void end_block(const cond_edge<T>& next) {
+        graph.action_end[cur_bb] = graph.tags.size();
+        graph.transfers[cur_bb] = graph.transfer_of(cur_bb);
+        graph.on_true[cur_bb] = *next.on_true;
+        graph.on_false[cur_bb] = next.on_false ? **next.on_false : -1;
+        graph.depends_on[cur_bb] = next.depends_on ? **next.depends_on : -1;
+        cur_bb = -1;
+    }
+
+    cfg<T> finish(idx<bb<T>> start_bb, idx<bb<T>> end_bb, Loc end_line) {
+        graph.start_bb = start_bb;
+        graph.end_bb = end_bb;
+        graph.end_line = end_line;
+        graph.live = graph.live_fallible_calls();
+        graph.block_fallible_calls = graph.most_fallible_calls_in_a_block();
+        return std::move(graph);
+    }
+
+private:
+    void push(action_type typ, Loc loc, uint32_t operand) {
+        graph.tags.push_back(typ);
+        graph.operands.push_back(operand);
+        graph.locs.push_back(loc);
+    }
+};
+
+template <typename T> cfg<T> cfg<T>::build(const func<T>& f, func_table<T>& funcs) {
+    cfg_builder<T> builder(funcs, f.bbs.size());
+    builder.graph.locks = f.locks;
+    for (size_t b = 0; b < f.bbs.size(); b++) {
+        builder.begin_block(b);
+        for (const auto& a: f.bbs[b].actions) {
+            builder.add(a);
+        }
+        builder.end_block(f.bbs[b].next);
+    }
+    return builder.finish(f.start_bb, f.end_bb, f.end_line);
+}
+
 }
 
 template<typename T, typename U> struct std::hash<lock_checker::edge_state<T, U>> {
     std::size_t operator()(const lock_checker::edge_state<T, U>& es) const {
-        std::size_t a = std::hash<uint32_t>{}(es.fallible_locks.state);
-        std::size_t b = std::hash<int>{}(*es.bb_idx);
-        std::size_t c = std::hash<uint32_t>{}(es.cur_lock_state.state);
-        return a ^ (b << 1) ^ (c << 2);
+        uint64_t a = ((uint64_t)(uint32_t)*es.bb_idx << 32) | es.cur_lock_state.state;
+        return lock_checker::mix_hash(lock_checker::mix_hash(a) ^ es.fallible_locks.state);
     }
 };
 
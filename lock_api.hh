@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+// the functions the checker treats as taking or giving a lock, instead of as calls into other code
+//
+// the plugin resolves each name to the compiler's identifier once, so recognizing a call is one hash
+// lookup on the callee; more functions (like wrappers around the rtos calls) can be added from a file
+// given with apis=FILE, one per line:
+//
+//     # name kind nargs [lock=N] [delay=N]
+//     rtos_mutex_lock take 2 lock=0 delay=1
+//     rtos_mutex_unlock give 1
+//
+// where kind is take, give, recursive_take, recursive_give or create, and arguments count from 0
+
+namespace lock_checker {
+
+enum lock_api_kind : uint8_t {
+    kTake, // blocks until it gets the lock if the delay is portMAX_DELAY, otherwise it can fail
+    kGive,
+    // the checker doesn't count how many times a recursive mutex is held, so these are recognized
+    // (and kept out of the call graph) but not checked
+    kRecursiveTake,
+    kRecursiveGive,
+    kCreate, // makes a new lock; nothing to check, but it's not a call into other code either
+};
+
+struct lock_api {
+    std::string name;
+    lock_api_kind kind;
+    int nargs;
+    int lock_arg = 0; // for takes and gives, which argument is the lock
+    int delay_arg = -1; // for takes, the timeout argument; -1 if the call never waits, so it can always fail
+};
+
+struct lock_api_registry {
+    std::vector<lock_api> apis;
+
+    // what FreeRTOS provides
+    static lock_api_registry freertos() {
+        return {{
+            {"xSemaphoreTake", kTake, 2, 0, 1},
+            {"xSemaphoreGive", kGive, 1, 0},
+            {"xSemaphoreTakeRecursive", kRecursiveTake, 2, 0, 1},
+            {"xSemaphoreGiveRecursive", kRecursiveGive, 1, 0},
+            {"xSemaphoreTakeFromISR", kTake, 2, 0, -1},
+            {"xSemaphoreGiveFromISR", kGive, 2, 0},
+            {"xSemaphoreCreateMutex", kCreate, 0},
+            {"xSemaphoreCreateRecursiveMutex", kCreate, 0},
+            {"xSemaphoreCreateBinary", kCreate, 0},
+            {"xSemaphoreCreateStatic", kCreate, 1},
+        }};
+    }
+
+    // adds an api, replacing any with the same name
+    void add(const lock_api& api) {
+        for (auto& existing: apis) {
+            if (existing.name == api.name) {
+                existing = api;
+                return;
+            }
+        }
+        apis.push_back(api);
+    }
+
+    // one line of a config file; nullopt if it's malformed
+    static std::optional<lock_api> parse_line(const std::string& line) {
+        static const std::pair<const char*, lock_api_kind> kinds[] = {
+            {"take", kTake},
+            {"give", kGive},
+            {"recursive_take", kRecursiveTake},
+            {"recursive_give", kRecursiveGive},
+            {"create", kCreate},
+        };
+
+        std::vector<std::string> words;
+        for (size_t i = 0; i < line.size();) {
+            const size_t start = line.find_first_not_of(" \t\r", i);
+            if (start == std::string::npos) {
+                break;
+            }
+            const size_t end = std::min(line.find_first_of(" \t\r", start), line.size());
+            words.push_back(line.substr(start, end - start));
+            i = end;
+        }
+        if (words.size() < 3) {
+            return std::nullopt;
+        }
+
+        lock_api api = {words[0], kTake, 0};
+        bool found = false;
+        for (const auto& [name, kind]: kinds) {
+            if (words[1] == name) {
+                api.kind = kind;
+                found = true;
+            }
+        }
+        if (!found || !parse_int(words[2], api.nargs)) {
+            return std::nullopt;
+        }
+        for (size_t i = 3; i < words.size(); i++) {
+            const auto& w = words[i];
+            if (w.rfind("lock=", 0) == 0 && parse_int(w.substr(5), api.lock_arg)) {
+                continue;
+            }
+            if (w.rfind("delay=", 0) == 0 && parse_int(w.substr(6), api.delay_arg)) {
+                continue;
+            }
+            return std::nullopt;
+        }
+
+        const bool uses_lock = api.kind != kCreate;
+        if (uses_lock && api.lock_arg >= api.nargs) {
+            return std::nullopt;
+        }
+        if (api.delay_arg >= api.nargs) {
+            return std::nullopt;
+        }
+        return api;
+    }
+
+    // adds everything in a config file; bad lines are skipped with a warning, and false means the file couldn't be read
+    bool load(const char* path) {
+        FILE* in = fopen(path, "r");
+        if (in == nullptr) {
+            return false;
+        }
+        char buf[512];
+        int line_no = 0;
+        while (fgets(buf, sizeof(buf), in) != nullptr) {
+            line_no++;
+            std::string line = buf;
+            line = line.substr(0, line.find_first_of("#\n"));
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            if (auto api = parse_line(line)) {
+                add(*api);
+            } else {
+                fprintf(stderr, "W: %s:%d: unable to parse lock api \"%s\"\n", path, line_no, line.c_str());
+            }
+        }
+        fclose(in);
+        return true;
+    }
+
+private:
+    static bool parse_int(const std::string& s, int& out) {
+        char* end;
+        const long v = strtol(s.c_str(), &end, 10);
+        if (s.empty() || *end != '\0' || v < 0) {
+            return false;
+        }
+        out = (int)v;
+        return true;
+    }
+};
+
+}
@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "log.hh"
+#include "object_file.hh"
+#include "program_checker.hh"
+#include "unit_summary.hh"
+
+// the whole-program check for builds that don't use lto: reads the .lock_checker section the plugin
+// writes into every object compiled with -fplugin-arg-lock_checker-whole_program, and checks the
+// calls between them
+//
+//     lock_checker_link [-v] FILE...
+//
+// where each file is an object or an archive of them; objects without the section are skipped.
+// errors are printed like the compiler's, and the exit status is 1 if there were any. the program as a
+// whole can have any number of locks, but a unit's summary only has room for 32
+
+using namespace lock_checker;
+
+int main(int argc, char** argv) {
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            log_verbosity = kProgress;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        fprintf(stderr, "usage: %s [-v] FILE...\n", argv[0]);
+        return 2;
+    }
+
+    // every file stays mapped until the end; the summaries are only read where they lie
+    std::vector<mapped_file> files(paths.size());
+    program_checker program;
+    size_t objects = 0, summary_bytes = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!files[i].open(paths[i])) {
+            fprintf(stderr, "W: unable to read %s\n", paths[i]);
+            continue;
+        }
+        const byte_range file = {(const uint8_t*)files[i].data, files[i].size};
+        std::vector<byte_range> members = {file};
+        if (auto in_archive = archive_members(file)) {
+            members = *in_archive;
+        }
+
+        for (const auto& member: members) {
+            objects++;
+            auto section = find_elf_section(member, ".lock_checker");
+            if (!section) {
+                continue;
+            }
+            auto summaries = split_summaries(section->data, section->size);
+            if (!summaries) {
+                fprintf(stderr, "W: unable to read the lock_checker summary in %s, skipping it\n", paths[i]);
+                continue;
+            }
+            summary_bytes += section->size;
+            for (const auto& unit: *summaries) {
+                program.add_unit(unit);
+            }
+        }
+    }
+    LOCK_CHECKER_LOG(kProgress, "read %zu summaries (%zu bytes) from %zu objects, with %zu functions\n",
+            program.units, summary_bytes, objects, program.num_functions());
+    if (program.truncated_units != 0) {
+        fprintf(stderr, "W: %zu summaries have more than 32 locks, only the first 32 of each are checked\n", program.truncated_units);
+    }
+
+    // the merge only ever adds calls made with a blocking lock held
+    size_t found = 0;
+    for (const auto& [loc, err]: program.new_errors()) {
+        fprintf(stderr, "%s:%u: error: call to function will block\n", loc.file.c_str(), loc.line);
+        found++;
+    }
+    for (const auto& cycle: program.new_cycles()) {
+        const size_t n = cycle.locks.size();
+        fprintf(stderr, "%s:%u: error: lock order inversion: %s taken while holding %s, which can deadlock with the takes below\n",
+                cycle.sites[0].file.c_str(), cycle.sites[0].line, cycle.locks[1 % n].c_str(), cycle.locks[0].c_str());
+        for (size_t i = 1; i < n; i++) {
+            fprintf(stderr, "%s:%u: note: %s taken here while holding %s\n", cycle.sites[i].file.c_str(), cycle.sites[i].line,
+                    cycle.locks[(i + 1) % n].c_str(), cycle.locks[i].c_str());
+        }
+        found++;
+    }
+    return found == 0 ? 0 : 1;
+}
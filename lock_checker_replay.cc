@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cfg_corpus.hh"
+#include "file_checker.hh"
+#include "log.hh"
+#include "object_file.hh"
+#include "stats.hh"
+
+// runs the checker on a corpus recorded by the plugin with capture=FILE, without the compiler, so
+// it can be profiled and benchmarked on real code
+//
+//     lock_checker_replay [-j N] [-e ENGINE] [-s MAX_STATES] [-l] [-r REPEAT] [-p] CORPUS...
+//
+// every unit gets a fresh file_checker, as it would in the compiler; -j, -e, -s and -l are the plugin's
+// jobs=, the engine, max_states= and slice_locks, -r runs everything that many times and reports the
+// fastest, and -p prints every error found (from the last run)
+
+using namespace lock_checker;
+
+struct replay_totals {
+    size_t units = 0, functions = 0, errors = 0, cycles = 0, malformed = 0, too_many_locks = 0;
+};
+
+static replay_totals replay_all(const std::vector<corpus_unit>& units, explore_engine engine, uint64_t max_states, bool slice_locks, unsigned jobs, bool print) {
+    replay_totals totals;
+    for (const auto& unit: units) {
+        file_checker<ReplayAdapter> fc;
+        fc.engine = engine;
+        fc.budget.max_states = max_states;
+        fc.slice_locks = slice_locks;
+        std::unordered_map<uint64_t, errors> line_errors;
+        totals.malformed += !unit.replay(fc, line_errors, jobs);
+        totals.units++;
+        totals.functions += unit.num_functions();
+        totals.cycles += fc.order_cycles.size();
+        totals.too_many_locks += fc.too_many_locks.size();
+        for (const auto& [loc, errs]: line_errors) {
+            totals.errors += errs.errs.size();
+        }
+
+        if (print) {
+            std::vector<uint64_t> locs;
+            for (const auto& [loc, _]: line_errors) {
+                locs.push_back(loc);
+            }
+            std::sort(locs.begin(), locs.end());
+            static const char* const messages[] = {"double take", "give without take", "mutex not given at end of function", "call to function will block"};
+            for (const auto loc: locs) {
+                for (const auto& e: line_errors[loc].errs) {
+                    printf("%s:%u: error: %s\n", unit.string(loc >> 32), (uint32_t)loc, messages[e.typ]);
+                }
+            }
+            for (const auto& cycle: fc.order_cycles) {
+                printf("%s:%u: error: lock order inversion: %s taken while holding %s\n", unit.string(cycle.sites[0] >> 32), (uint32_t)cycle.sites[0],
+                        unit.string(cycle.locks[1 % cycle.locks.size()]), unit.string(cycle.locks[0]));
+            }
+        }
+    }
+    return totals;
+}
+
+int main(int argc, char** argv) {
+    unsigned jobs = 1;
+    explore_engine engine = kBreadthFirst;
+    uint64_t max_states = 1000000; // the plugin's default
+    int repeat = 1;
+    bool print = false;
+    bool slice_locks = false;
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-j") == 0 && has_value) {
+            jobs = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-e") == 0 && has_value) {
+            const char* name = argv[++i];
+            bool found = false;
+            for (auto e: {kBreadthFirst, kSymbolic, kDataflow, kApproximate}) {
+                if (strcmp(engine_name(e), name) == 0) {
+                    engine = e;
+                    found = true;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "unknown engine %s\n", name);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+            max_states = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-l") == 0) {
+            slice_locks = true;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            print = true;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        fprintf(stderr, "usage: %s [-j N] [-e ENGINE] [-s MAX_STATES] [-l] [-r REPEAT] [-p] CORPUS...\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<mapped_file> files(paths.size());
+    std::vector<corpus_unit> units;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!files[i].open(paths[i])) {
+            fprintf(stderr, "W: unable to read %s\n", paths[i]);
+            continue;
+        }
+        const uint8_t* data = (const uint8_t*)files[i].data;
+        size_t at = 0;
+        while (at < files[i].size) {
+            auto unit = corpus_unit::open(data + at, files[i].size - at);
+            if (!unit) {
+                fprintf(stderr, "W: %s is damaged after %zu bytes, skipping the rest of it\n", paths[i], at);
+                break;
+            }
+            units.push_back(*unit);
+            at += unit->size;
+        }
+    }
+
+    double best_ms = 0;
+    replay_totals totals;
+    for (int r = 0; r < repeat; r++) {
+        const auto start = std::chrono::steady_clock::now();
+        totals = replay_all(units, engine, max_states, slice_locks, jobs, print && r + 1 == repeat);
+        const double ms = ms_since(start);
+        best_ms = r == 0 ? ms : std::min(best_ms, ms);
+    }
+    fprintf(stderr, "%zu units, %zu functions, %zu errors, %zu lock order cycles; %.3f ms (%s engine%s, best of %d)\n",
+            totals.units, totals.functions, totals.errors, totals.cycles, best_ms, engine_name(engine), slice_locks ? ", sliced" : "", repeat);
+    if (totals.too_many_locks != 0) {
+        fprintf(stderr, "W: %zu functions weren't checked, they'd have taken their unit past %zu locks\n", totals.too_many_locks, file_checker<ReplayAdapter>::kMaxLocks);
+    }
+    if (totals.malformed != 0) {
+        fprintf(stderr, "W: %zu units were damaged and only partly replayed\n", totals.malformed);
+    }
+    return 0;
+}
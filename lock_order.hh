@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// the order locks are taken in across a translation unit, to find locks that are taken in opposite
+// orders in different places (and so can deadlock)
+//
+// there's an edge held -> taken when taken is acquired while held is held; edges and their transitive
+// closure are kept as dense bit matrices over the global lock indices, one row of 64-bit words per lock,
+// so updating the closure for a new edge is one word-wide or per row instead of a walk over the graph
+
+namespace lock_checker {
+
+template <typename Loc> struct lock_order {
+    struct edge {
+        uint32_t held, taken;
+        Loc site; // where the edge was first seen
+    };
+
+    size_t num_locks = 0;
+    size_t words = 0; // per row
+    std::vector<uint64_t> after; // row i: the locks taken while i is held
+    std::vector<uint64_t> reach; // row i: the locks taken while i is held, directly or through other locks
+    std::unordered_map<uint64_t, Loc> sites; // (held << 32 | taken) -> where that edge was first seen
+
+    bool has_edge(uint32_t held, uint32_t taken) const {
+        return held < num_locks && taken < num_locks && test(after, held, taken);
+    }
+    bool reaches(uint32_t from, uint32_t to) const {
+        return from < num_locks && to < num_locks && test(reach, from, to);
+    }
+
+    // records that taken was acquired at site while held was held; if this closes a cycle, returns
+    // the cycle's edges, starting with this one and ending with the one that takes held again
+    std::optional<std::vector<edge>> add(uint32_t held, uint32_t taken, const Loc& site) {
+        if (held == taken) {
+            return std::nullopt; // a double take, which is reported separately
+        }
+        grow(std::max(held, taken) + 1);
+        if (test(after, held, taken)) {
+            return std::nullopt;
+        }
+        set(after, held, taken);
+        sites.emplace(key(held, taken), site);
+
+        const bool cycle = test(reach, taken, held);
+
+        // everything that reaches held (and held itself) now reaches taken and everything after it
+        uint64_t* taken_reach = &reach[taken * words];
+        for (size_t i = 0; i < num_locks; i++) {
+            if (i == held || test(reach, i, held)) {
+                uint64_t* row = &reach[i * words];
+                for (size_t w = 0; w < words; w++) {
+                    row[w] |= taken_reach[w];
+                }
+                set(reach, i, taken);
+            }
+        }
+
+        if (!cycle) {
+            return std::nullopt;
+        }
+        std::vector<edge> edges = {{held, taken, site}};
+        for (uint32_t lock: path(taken, held)) {
+            const uint32_t from = edges.back().taken;
+            edges.push_back({from, lock, sites.at(key(from, lock))});
+        }
+        return edges;
+    }
+
+private:
+    static uint64_t key(uint32_t held, uint32_t taken) {
+        return ((uint64_t)held << 32) | taken;
+    }
+    bool test(const std::vector<uint64_t>& m, size_t row, size_t col) const {
+        return (m[row * words + col / 64] >> (col % 64)) & 1;
+    }
+    void set(std::vector<uint64_t>& m, size_t row, size_t col) {
+        m[row * words + col / 64] |= 1ull << (col % 64);
+    }
+
+    void grow(size_t n) {
+        if (n <= num_locks) {
+            return;
+        }
+        const size_t new_words = (n + 63) / 64;
+        if (new_words != words) {
+            // rows get wider; copy each one over
+            std::vector<uint64_t> new_after(n * new_words, 0), new_reach(n * new_words, 0);
+            for (size_t i = 0; i < num_locks; i++) {
+                std::copy(&after[i * words], &after[i * words] + words, &new_after[i * new_words]);
+                std::copy(&reach[i * words], &reach[i * words] + words, &new_reach[i * new_words]);
+            }
+            after = std::move(new_after);
+            reach = std::move(new_reach);
+            words = new_words;
+        } else {
+            after.resize(n * words, 0);
+            reach.resize(n * words, 0);
+        }
+        num_locks = n;
+    }
+
+    // the locks after from on a shortest path of edges from one lock to the other, ending with to
+    std::vector<uint32_t> path(uint32_t from, uint32_t to) const {
+        std::vector<int64_t> parent(num_locks, -1);
+        std::vector<uint32_t> queue = {from};
+        parent[from] = from;
+        for (size_t q = 0; q < queue.size() && parent[to] < 0; q++) {
+            const uint32_t cur = queue[q];
+            for (size_t w = 0; w < words; w++) {
+                for (uint64_t bits = after[cur * words + w]; bits != 0; bits &= bits - 1) {
+                    const uint32_t next = w * 64 + __builtin_ctzll(bits);
+                    if (parent[next] < 0) {
+                        parent[next] = cur;
+                        queue.push_back(next);
+                    }
+                }
+            }
+        }
+
+        std::vector<uint32_t> locks;
+        for (uint32_t cur = to; cur != from; cur = parent[cur]) {
+            locks.push_back(cur);
+        }
+        return {locks.rbegin(), locks.rend()};
+    }
+};
+
+}
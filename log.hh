@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdio>
+
+// leveled logging for the plugin's own output (not the errors it reports, those go through gcc's diagnostics)
+//
+// LOCK_CHECKER_LOG only evaluates and formats its arguments if the level is enabled, and levels
+// above LOCK_CHECKER_MAX_LOG_LEVEL are compiled out entirely
+
+#ifndef LOCK_CHECKER_MAX_LOG_LEVEL
+#define LOCK_CHECKER_MAX_LOG_LEVEL 3
+#endif
+
+namespace lock_checker {
+
+enum log_level : int {
+    kQuiet = 0, // nothing but the errors found in the code being compiled
+    kWarnings = 1, // code the plugin didn't understand and skipped
+    kProgress = 2, // a line per function and translation unit
+    kDebug = 3, // every lock, call and branch found while extracting a function
+};
+
+// set from verbose=N when the plugin is loaded, before any pass runs
+inline int log_verbosity = kQuiet;
+
+inline bool log_enabled(int level) {
+    return level <= LOCK_CHECKER_MAX_LOG_LEVEL && level <= log_verbosity;
+}
+
+}
+
+#define LOCK_CHECKER_LOG(level, ...) \
+    do { \
+        if (::lock_checker::log_enabled(level)) { \
+            fprintf(stderr, __VA_ARGS__); \
+        } \
+    } while (0)
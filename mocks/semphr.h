@@ -12,3 +12,12 @@ SemaphoreHandle_t xSemaphoreCreateStatic(StaticSemaphore_t*);
 
 bool xSemaphoreTake(SemaphoreHandle_t sem, int timeout);
 void xSemaphoreGive(SemaphoreHandle_t sem);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+
+bool xSemaphoreTakeRecursive(SemaphoreHandle_t sem, int timeout);
+bool xSemaphoreGiveRecursive(SemaphoreHandle_t sem);
+bool xSemaphoreTakeFromISR(SemaphoreHandle_t sem, bool* higher_priority_task_woken);
+bool xSemaphoreGiveFromISR(SemaphoreHandle_t sem, bool* higher_priority_task_woken);
@@ -1,5 +1,11 @@
 #include <algorithm>
+#include <chrono>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "gcc-plugin.h"
 #include "plugin.h"
@@ -11,13 +17,22 @@
 #include "tree.h"
 #include "tree-pass.h"
 #include "basic-block.h"
+#include "cgraph.h"
 #include "gimple.h"
 #include "gimple-iterator.h"
 #include "gimple-pretty-print.h"
 #include "tree-pretty-print.h"
+#include "langhooks.h"
+#include "varasm.h"
 
+#include "cfg_corpus.hh"
 #include "file_checker.hh"
 #include "func_walker.hh"
+#include "lock_api.hh"
+#include "log.hh"
+#include "program_checker.hh"
+#include "truth_table.hh"
+#include "unit_summary.hh"
 
 // Define plugin information
 int plugin_is_GPL_compatible; // Set to 1 for GPL compatibility
@@ -33,6 +48,24 @@ static const struct pass_data my_pass_data = {
     .properties_provided = PROP_ssa | PROP_cfg,
 };
 
+static const struct pass_data summary_pass_data = {
+    .type = SIMPLE_IPA_PASS,
+    .name = "lock_checker_summary",
+    .optinfo_flags = OPTGROUP_NONE,
+    .tv_id = TV_NONE,
+};
+
+static const struct pass_data link_pass_data = {
+    .type = IPA_PASS,
+    .name = "lock_checker_link",
+    .optinfo_flags = OPTGROUP_NONE,
+    .tv_id = TV_NONE,
+};
+
+// with whole_program, each unit's summary goes into its lto object as a static variable with this
+// name; the variables are renamed if they clash at link time, but DECL_NAME stays the same
+static const char* const summary_var_name = "__lock_checker_summary";
+
 static tree follow_ssa(tree v) {
     while (v != NULL && TREE_CODE(v) == SSA_NAME) {
         auto* stmt = SSA_NAME_DEF_STMT(v);
@@ -62,153 +95,93 @@ static tree follow_var_decl(tree v) {
     return nullptr;
 }
 
-template <typename T> void dump_vals(T& t) {
-    fprintf(stderr, "[");
-    for (auto v: t) {
-        fprintf(stderr, "%d ", v);
-    }
-    fprintf(stderr, "]");
-}
-
-using possible_vals = std::optional<std::pair<std::vector<int64_t>, std::vector<int>>>;
-
-template <typename F> possible_vals merge_vals(possible_vals& a, possible_vals& b, F op) {
-    if (!a.has_value()) {
-        //fprintf(stderr, "merge_vals a empty\n");
-        return std::nullopt;
-    }
-    if (!b.has_value()) {
-        //fprintf(stderr, "merge_vals b empty\n");
-        return std::nullopt;
-    }
-    auto& [a_vals, a_list] = *a;
-    auto& [b_vals, b_list] = *b;
-    if (a_vals.size() != (size_t)(1 << a_list.size())) {
-        fprintf(stderr, "ERROR: possibility list has the wrong size");
-        return std::nullopt;
-    }
-    if (b_vals.size() != (size_t)(1 << b_list.size())) {
-        fprintf(stderr, "ERROR: possibility list has the wrong size");
+// works out the possible values of expressions in one function, assuming they consist only of
+// constants and the results of fallible lock calls
+//
+// conditions often share operands, so the value of every ssa name is kept once it's worked out
+struct value_calculator {
+    const std::unordered_map<gimple*, int>& lock_calls;
+    std::unordered_map<tree, truth_table> memo;
+
+    value_calculator(const std::unordered_map<gimple*, int>& lock_calls_): lock_calls(lock_calls_) {}
+
+    // returns nullopt if there is anything else in the expression
+    std::optional<truth_table> calc_vals(tree v) {
+        // i'm pretty sure by this pass everything's been lowered to gimple,
+        // so it should only be ssa assignments
+        if (TREE_CODE(v) == SSA_NAME) {
+            if (auto it = memo.find(v); it != memo.end()) {
+                return it->second;
+            }
+            auto result = calc_ssa(v);
+            // failures aren't kept; the lock call an ssa name comes from might not have been seen yet
+            if (result) {
+                memo[v] = *result;
+            }
+            return result;
+        } else if (TREE_CODE(v) == INTEGER_CST) {
+            //fprintf(stderr, "found const\n");
+            return truth_table::constant(tree_to_shwi(v));
+        } else {
+            LOCK_CHECKER_LOG(kWarnings, "W: UNKNOWN tree code in calc_vals %d for %p\n", TREE_CODE(v), v);
+        }
         return std::nullopt;
     }
 
-    std::vector<int> merged_list(a_list);
-    std::vector<int> b_idx_map;
-    for (auto &b_l: b_list) {
-        bool found = false;
-        for (size_t idx = 0; idx < merged_list.size(); idx++) {
-            if (b_l == merged_list[idx]) {
-                b_idx_map.push_back(idx);
-                found = true;
-                break;
-            }
+    template <typename F> std::optional<truth_table> calc_binary(gimple* stmt, F op) {
+        auto left = calc_vals(gimple_assign_rhs1(stmt));
+        if (!left) {
+            return std::nullopt;
         }
-        if (!found) {
-            merged_list.push_back(b_l);
-            b_idx_map.push_back(b_list.size() - 1);
-        }
-    }
-    std::vector<int64_t> merged_vals((1 << merged_list.size()), 0);
-    //fprintf(stderr, "a sz %d b sz %d merge_vals sz %d\n", a_vals.size(), b_vals.size(), merged_vals.size());
-    const int a_mask = (1 << a_list.size()) - 1;
-    for (size_t i = 0; i < merged_vals.size(); i++) {
-        int a_idx = i & a_mask;
-        int b_idx = 0;
-        for (size_t j = 0; j < b_list.size(); j++) {
-            int bit = 1 << b_idx_map[j];
-            if ((i & bit) != 0) {
-                b_idx |= (1 << j);
-            }
+        auto right = calc_vals(gimple_assign_rhs2(stmt));
+        if (!right) {
+            return std::nullopt;
         }
-        merged_vals[i] = op(a_vals[a_idx], b_vals[b_idx]);
+        return truth_table::combine(*left, *right, op);
     }
 
-    return std::pair<std::vector<int64_t>, std::vector<int>> {
-        merged_vals,
-        merged_list
-    };
-}
-
-// attempts to calculate the possible results for a expression, assuming the expression
-// consists only of constants and references to lock calls
-// returns nullopt if there is anything else in the expression
-static std::optional<std::pair<std::vector<int64_t>, std::vector<int>>> calc_vals(tree v, const std::unordered_map<gimple*, int>& lock_calls) {
-    std::vector<int64_t> results;
-    //fprintf(stderr, "calc vals %p\n", v);
-
-    // i'm pretty sure by this pass everything's been lowered to gimple,
-    // so it should only be ssa assignments
-    tree base = follow_ssa(v);
-    if (TREE_CODE(v) == SSA_NAME) {
+    std::optional<truth_table> calc_ssa(tree v) {
         auto* stmt = SSA_NAME_DEF_STMT(v);
         if (auto it = lock_calls.find(stmt); it != lock_calls.end()) {
             //fprintf(stderr, "found lock\n");
             // we found it
-            return std::pair<std::vector<int64_t>, std::vector<int>>{
-                std::vector<int64_t>{0, 1}, // pdFAIL, pdPASS
-                std::vector<int>{it->second}
-            };
+            return truth_table::call_result(it->second);
         }
         if (gimple_code(stmt) == GIMPLE_ASSIGN) {
-            auto assign = as_a<gassign*>(stmt);
             auto subcode = gimple_assign_rhs_code(stmt);
             if (subcode == INTEGER_CST) {
                 //fprintf(stderr, "found const\n");
-                return std::pair<std::vector<int64_t>, std::vector<int>>{
-                    std::vector<int64_t>{tree_to_shwi(gimple_assign_rhs1(stmt))},
-                    std::vector<int>{}
-                };
+                return truth_table::constant(tree_to_shwi(gimple_assign_rhs1(stmt)));
             } else if (subcode == PLUS_EXPR) {
-                //fprintf(stderr, "+ merging %p %p\n", gimple_assign_rhs1(stmt), gimple_assign_rhs2(stmt));
-                auto left = calc_vals(gimple_assign_rhs1(stmt), lock_calls);
-                auto right = calc_vals(gimple_assign_rhs2(stmt), lock_calls); 
-                return merge_vals(left, right, [](int64_t a, int64_t b) {
-                           return a + b;
-                           });
+                return calc_binary(stmt, [](int64_t a, int64_t b) -> int64_t {
+                    return a + b;
+                });
             } else if (subcode == MINUS_EXPR) {
-                //fprintf(stderr, "- merging %p %p\n", gimple_assign_rhs1(stmt), gimple_assign_rhs2(stmt));
-                auto left = calc_vals(gimple_assign_rhs1(stmt), lock_calls);
-                auto right = calc_vals(gimple_assign_rhs2(stmt), lock_calls); 
-                return merge_vals(left, right, [](int64_t a, int64_t b) {
-                           return a + b;
-                           });
+                return calc_binary(stmt, [](int64_t a, int64_t b) -> int64_t {
+                    return a - b;
+                });
             } else if (subcode == EQ_EXPR) {
-                //fprintf(stderr, "eq merging %p %p\n", gimple_assign_rhs1(stmt), gimple_assign_rhs2(stmt));
-                auto left = calc_vals(gimple_assign_rhs1(stmt), lock_calls);
-                auto right = calc_vals(gimple_assign_rhs2(stmt), lock_calls); 
-                return merge_vals(left, right, [](int64_t a, int64_t b) {
-                           return a == b;
-                           });
+                return calc_binary(stmt, [](int64_t a, int64_t b) -> int64_t {
+                    return a == b;
+                });
             } else if (subcode == NE_EXPR) {
-                //fprintf(stderr, "ne merging %p %p\n", gimple_assign_rhs1(stmt), gimple_assign_rhs2(stmt));
-                auto left = calc_vals(gimple_assign_rhs1(stmt), lock_calls);
-                auto right = calc_vals(gimple_assign_rhs2(stmt), lock_calls); 
-                return merge_vals(left, right, [](int64_t a, int64_t b) {
-                           return a != b;
-                           });
+                return calc_binary(stmt, [](int64_t a, int64_t b) -> int64_t {
+                    return a != b;
+                });
             } else if (subcode == SSA_NAME) {
                 //fprintf(stderr, "found ssa\n");
-                return calc_vals(gimple_assign_rhs1(stmt), lock_calls);
+                return calc_vals(gimple_assign_rhs1(stmt));
             } else if (subcode == VAR_DECL) {
                 return std::nullopt;
             } else {
-                fprintf(stderr, "W: UNKNOWN subcode in calc_vals %d for %p\n", subcode, v);
+                LOCK_CHECKER_LOG(kWarnings, "W: UNKNOWN subcode in calc_vals %d for %p\n", subcode, v);
             }
         } else {
-            fprintf(stderr, "W: UNEXPECTED gimple code %d\n", gimple_code(stmt));
+            LOCK_CHECKER_LOG(kWarnings, "W: UNEXPECTED gimple code %d\n", gimple_code(stmt));
         }
         return std::nullopt;
-    } else if (TREE_CODE(v) == INTEGER_CST) {
-            //fprintf(stderr, "found const\n");
-            return std::pair<std::vector<int64_t>, std::vector<int>>{
-                std::vector<int64_t>{tree_to_shwi(v)},
-                std::vector<int>{}
-            };
-    } else {
-        fprintf(stderr, "W: UNKNOWN tree code in calc_vals %d for %p\n", TREE_CODE(v), v);
     }
-    return std::nullopt;
-}
+};
 
 tree call_decl(gcall* stmt) {
     tree fn = gimple_call_fn(stmt);
@@ -222,25 +195,60 @@ tree call_decl(gcall* stmt) {
     return nullptr;
 
 }
-static bool match_call(gcall* stmt, const char* fname, int nargs) {
-    tree decl = call_decl(stmt);
-    if (decl == nullptr) {
-        return false;
+// the lock apis by identifier; identifiers are interned, so the DECL_NAME of a callee can be
+// looked up by pointer instead of comparing names
+struct lock_api_table {
+    std::unordered_map<tree, lock_api> by_id;
+
+    explicit lock_api_table(const lock_api_registry& registry) {
+        for (const auto& api: registry.apis) {
+            by_id[get_identifier(api.name.c_str())] = api;
+        }
     }
 
-    const char* name = IDENTIFIER_POINTER(decl);
-    if (name == nullptr) {
-        return false;
+    const lock_api* find(tree name) const {
+        if (name == nullptr) {
+            return nullptr;
+        }
+        const auto it = by_id.find(name);
+        return it == by_id.end() ? nullptr : &it->second;
     }
 
-    if (strcmp(name, fname) == 0) {
-        if (gimple_call_num_args(stmt) == nargs) {
-            return true;
-        } else {
-            fprintf(stderr, "W: found matching function call for %s with incorrect number of arguments\n", name);
+    // the api stmt calls, or nullptr if it's a call to anything else
+    const lock_api* match(gcall* stmt) const {
+        const lock_api* api = find(call_decl(stmt));
+        if (api == nullptr) {
+            return nullptr;
+        }
+        if ((int)gimple_call_num_args(stmt) != api->nargs) {
+            LOCK_CHECKER_LOG(kWarnings, "W: found matching function call for %s with incorrect number of arguments\n", api->name.c_str());
+            return nullptr;
+        }
+        return api;
+    }
+};
+
+// the functions f calls directly, from its cgraph edges, or nullopt if it takes or gives a lock
+// (or has no cgraph node to look at); other lock apis aren't calls into anything, so they're left out
+static std::optional<std::vector<std::pair<location_t, std::string>>> lock_free_calls(function* f, const lock_api_table& apis) {
+    cgraph_node* node = cgraph_node::get(f->decl);
+    if (node == nullptr) {
+        return std::nullopt;
+    }
+    std::vector<std::pair<location_t, std::string>> calls;
+    for (cgraph_edge* e = node->callees; e != nullptr; e = e->next_callee) {
+        tree name = DECL_NAME(e->callee->decl);
+        if (const lock_api* api = apis.find(name)) {
+            if (api->kind == kTake || api->kind == kGive) {
+                return std::nullopt;
+            }
+            continue;
+        }
+        if (name != nullptr) {
+            calls.push_back({e->call_stmt ? e->call_stmt->location : UNKNOWN_LOCATION, IDENTIFIER_POINTER(name)});
         }
     }
-    return false;
+    return calls;
 }
 
 struct GccAdapter {
@@ -249,33 +257,286 @@ struct GccAdapter {
     using LockId = tree;
 };
 
-struct pass: public gimple_opt_pass {
+// everything that can be set with -fplugin-arg-lock_checker-<key>[=<value>]
+struct plugin_options {
+    unsigned jobs = 1; // jobs=N: check the functions in a unit on N threads
+    bool stats = false; // stats[=FILE]: write counters and timings for every function as a line of json, appended to FILE (or to stderr)
+    std::string stats_path;
+    int verbose = kQuiet; // verbose[=N]: how much the plugin logs to stderr, see log_level; verbose alone is kProgress
+    // max_states=N, max_ms=N: past either (0 is no limit), a function is checked with the approximate engine instead
+    explore_budget budget = {1000000, 0};
+    bool slice_locks = false; // slice_locks: explore each lock of a function separately, see cfg::slices
+    lock_api_registry apis = lock_api_registry::freertos(); // apis=FILE: more lock functions, see lock_api.hh
+    // whole_program: also check calls between units, see unit_summary.hh; with -flto that's done when
+    // they're linked, otherwise each object gets a .lock_checker section for lock_checker_link
+    bool whole_program = false;
+    std::string cache_dir; // cache=DIR: keep what exploring each function found in DIR, and reuse it in later builds
+    std::string capture_path; // capture=FILE: append every function checked to FILE, for lock_checker_replay
+
+    static plugin_options parse(const plugin_name_args* plugin_info) {
+        plugin_options options;
+        for (int i = 0; i < plugin_info->argc; i++) {
+            const char* key = plugin_info->argv[i].key;
+            const char* value = plugin_info->argv[i].value;
+            if (strcmp(key, "jobs") == 0 && value) {
+                options.jobs = std::max(1, atoi(value));
+            } else if (strcmp(key, "stats") == 0) {
+                options.stats = true;
+                options.stats_path = value ? value : "";
+            } else if (strcmp(key, "verbose") == 0) {
+                options.verbose = value ? std::clamp(atoi(value), (int)kQuiet, (int)kDebug) : kProgress;
+            } else if (strcmp(key, "max_states") == 0 && value) {
+                options.budget.max_states = strtoull(value, nullptr, 10);
+            } else if (strcmp(key, "max_ms") == 0 && value) {
+                options.budget.max_ms = atof(value);
+            } else if (strcmp(key, "slice_locks") == 0) {
+                options.slice_locks = true;
+            } else if (strcmp(key, "cache") == 0 && value) {
+                options.cache_dir = value;
+            } else if (strcmp(key, "capture") == 0 && value) {
+                options.capture_path = value;
+            } else if (strcmp(key, "whole_program") == 0) {
+                options.whole_program = true;
+            } else if (strcmp(key, "apis") == 0 && value) {
+                if (!options.apis.load(value)) {
+                    fprintf(stderr, "W: unable to open %s for the lock_checker apis\n", value);
+                }
+            } else {
+                fprintf(stderr, "W: unknown lock_checker argument %s\n", key);
+            }
+        }
+        return options;
+    }
+};
+
+// S is the stats policy the checker is built with (see stats.hh); the stats=... argument picks
+// collect_stats, otherwise none of the instrumentation is compiled in
+template <typename S> struct pass: public gimple_opt_pass {
 public:
-    pass(gcc::context* ctx): gimple_opt_pass(my_pass_data, ctx) {}
+    pass(gcc::context* ctx, const plugin_options& options_): gimple_opt_pass(my_pass_data, ctx), options(options_), apis(options.apis) {
+        checker.budget = options.budget;
+        checker.slice_locks = options.slice_locks;
+        if (!options.cache_dir.empty()) {
+            cache = std::make_unique<analysis_cache<GccAdapter>>(options.cache_dir, lock_name);
+            checker.cache = cache.get();
+        }
+    }
+
+    plugin_options options;
+    lock_api_table apis;
+    file_checker<GccAdapter, S> checker;
+    std::unique_ptr<analysis_cache<GccAdapter>> cache;
+    corpus_writer capture; // with capture=FILE, the unit so far
+
+    // static locks with the same name in different units are taken to be the same lock
+    static std::string lock_name(tree lock) {
+        return IDENTIFIER_POINTER(lock);
+    }
+    static source_location where(location_t loc) {
+        const expanded_location e = expand_location(loc);
+        return source_location{e.file ? e.file : "", (uint32_t)e.line};
+    }
+
+    // with more than one job, functions are collected here and checked in parallel at the end of the unit
+    std::vector<std::pair<std::string, cfg<GccAdapter>>> pending;
+    std::unordered_map<std::string, location_t> function_locs; // to point budget warnings at
+    std::unordered_set<std::string> local_functions; // static ones, which other units can have their own of
+    size_t functions_seen = 0, functions_skipped = 0; // in this unit, see lock_free_calls
+
+    void report_over_budget() {
+        for (const auto& [name, limit]: checker.over_budget) {
+            // gcc's diagnostics only know a few printf formats, so the limit is formatted here
+            char what[64];
+            if (limit == kTimeLimit) {
+                snprintf(what, sizeof(what), "took over %g ms to check", options.budget.max_ms);
+            } else {
+                snprintf(what, sizeof(what), "has over %llu lock states", (unsigned long long)options.budget.max_states);
+            }
+            warning_at(function_locs[name], 0, "lock_checker: %s %s; checked it approximately instead, so errors in it may be false positives",
+                    name.c_str(), what);
+        }
+        checker.over_budget.clear();
+
+        for (const auto& name: checker.too_many_locks) {
+            warning_at(function_locs[name], 0, "lock_checker: %s would take this unit past %zu locks; it wasn't checked, only its calls were",
+                    name.c_str(), checker.kMaxLocks);
+        }
+        checker.too_many_locks.clear();
+    }
+
+    void report_lock_order() {
+        for (const auto& cycle: checker.order_cycles) {
+            const size_t n = cycle.locks.size();
+            error_at(cycle.sites[0], "lock order inversion: %s taken while holding %s, which can deadlock with the takes below",
+                    IDENTIFIER_POINTER(cycle.locks[1 % n]), IDENTIFIER_POINTER(cycle.locks[0]));
+            for (size_t i = 1; i < n; i++) {
+                inform(cycle.sites[i], "%s taken here while holding %s", IDENTIFIER_POINTER(cycle.locks[(i + 1) % n]), IDENTIFIER_POINTER(cycle.locks[i]));
+            }
+        }
+        checker.order_cycles.clear();
+    }
 
-    file_checker<GccAdapter> checker;
+    static void report_errors(std::unordered_map<location_t, errors>& all_errors) {
+        LOCK_CHECKER_LOG(kProgress, "found %zu errors\n", all_errors.size());
+        std::vector<location_t> all_lines;
+        for (auto& [loc, _]: all_errors) {
+            all_lines.push_back(loc);
+        }
+        std::sort(all_lines.begin(), all_lines.end());
+        for (auto &loc: all_lines) {
+            for (auto &e: all_errors[loc].errs) {
+                if (e.typ == error::kDoubleTake) {
+                    error_at(loc, "double take");
+                } else if (e.typ == error::kGiveWithoutTake) {
+                    error_at(loc, "give without take");
+                } else if (e.typ == error::kTakeWithoutGive) {
+                    error_at(loc, "mutex not given at end of function");
+                } else if (e.typ = error::kCallWithBlockingLock) {
+                    error_at(loc, "call to function will block");
+                }
+            }
+        }
+    }
+
+    // checks anything collected for jobs > 1
+    void check_pending() {
+        if (!pending.empty()) {
+            LOCK_CHECKER_LOG(kProgress, "checking %zu functions with %u jobs\n", pending.size(), options.jobs);
+
+            std::unordered_map<location_t, errors> all_errors;
+            checker.process_functions(std::move(pending), all_errors, options.jobs);
+            pending.clear();
+            report_errors(all_errors);
+            report_over_budget();
+            report_lock_order();
+        }
+    }
+
+    void finish_unit() {
+        LOCK_CHECKER_LOG(kProgress, "skipped %zu of %zu functions that never take or give a lock\n", functions_skipped, functions_seen);
+        functions_seen = functions_skipped = 0;
+        check_pending();
+        if (cache) {
+            LOCK_CHECKER_LOG(kProgress, "cache: %llu hits, %llu misses (%.1f%% hit rate), %llu entries written, %llu failed\n",
+                    (unsigned long long)cache->hits, (unsigned long long)cache->misses, 100 * cache->hit_rate(),
+                    (unsigned long long)cache->stores, (unsigned long long)cache->failed_stores);
+        }
+        if (options.whole_program && !flag_lto) {
+            write_summary_section();
+        }
+        if (!options.capture_path.empty()) {
+            write_capture();
+        }
+
+        if constexpr (S::enabled) {
+            if (options.stats_path.empty()) {
+                checker.write_stats_json(stderr, main_input_filename ? main_input_filename : "");
+            } else {
+                write_stats_file();
+            }
+        }
+    }
+
+    // every unit built with the same stats=FILE appends its line to FILE, in one write like the capture
+    void write_stats_file() {
+        char* buf = nullptr;
+        size_t len = 0;
+        FILE* out = open_memstream(&buf, &len);
+        if (out == nullptr) {
+            fprintf(stderr, "W: unable to write the lock_checker stats to %s\n", options.stats_path.c_str());
+            return;
+        }
+        checker.write_stats_json(out, main_input_filename ? main_input_filename : "");
+        fclose(out);
+        const int fd = open(options.stats_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (fd < 0 || write(fd, buf, len) != (ssize_t)len) {
+            fprintf(stderr, "W: unable to write the lock_checker stats to %s\n", options.stats_path.c_str());
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(buf);
+    }
+
+    // everything the unit passes on to the link time check
+    std::string unit_summary_bytes() const {
+        const std::string unit = main_input_filename ? main_input_filename : "";
+        return summarize_unit(checker, lock_name, [&](const std::string& name) {
+            return local_functions.count(name) != 0 ? name + "@" + unit : name;
+        }, where).serialize();
+    }
+
+    // the whole unit goes in with one write, so compilers running in parallel can append to the same file
+    void write_capture() {
+        if (capture.empty()) {
+            return;
+        }
+        const std::string bytes = capture.finish(main_input_filename ? main_input_filename : "");
+        const int fd = open(options.capture_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (fd < 0 || write(fd, bytes.data(), bytes.size()) != (ssize_t)bytes.size()) {
+            fprintf(stderr, "W: unable to write the lock_checker capture to %s\n", options.capture_path.c_str());
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // without lto, the summary goes straight into the object file, in a section that's left out of
+    // anything linked from it; lock_checker_link reads it back from the objects
+    void write_summary_section() {
+        if (checker.blocking_locks_used.empty()) {
+            return;
+        }
+        const std::string bytes = unit_summary_bytes();
+        LOCK_CHECKER_LOG(kProgress, "writing a %zu byte summary of %zu functions\n", bytes.size(), checker.blocking_locks_used.size());
+        switch_to_section(get_section(".lock_checker", SECTION_DEBUG | SECTION_EXCLUDE, NULL));
+        assemble_align(unit_summary::kSectionAlign * BITS_PER_UNIT);
+        assemble_string(bytes.data(), bytes.size());
+    }
 
     virtual unsigned int execute(function* f) override {
         std::string name = IDENTIFIER_POINTER(DECL_NAME(f->decl));
-        fprintf(stderr, "in function %s", name.c_str());
+        LOCK_CHECKER_LOG(kProgress, "in function %s\n", name.c_str());
+        function_locs[name] = f->function_start_locus;
+        if (!TREE_PUBLIC(f->decl)) {
+            local_functions.insert(name);
+        }
+
+        std::chrono::steady_clock::time_point extract_start;
+        if constexpr (S::enabled) {
+            extract_start = std::chrono::steady_clock::now();
+        }
+
+        functions_seen++;
+        if (auto calls = lock_free_calls(f, apis)) {
+            // most functions never touch a lock; all the checker needs from them is who they call
+            functions_skipped++;
+            if constexpr (S::enabled) {
+                checker.stats[name].extract_ms = ms_since(extract_start);
+            }
+            if (!options.capture_path.empty()) {
+                capture.add_lock_free_function(name, *calls, where);
+            }
+            std::unordered_map<location_t, errors> fun_errors;
+            checker.process_lock_free_function(name, *calls, fun_errors);
+            report_errors(fun_errors);
+            report_lock_order();
+            return 0;
+        }
 
         std::unordered_map<gimple*, int> lock_calls; // lock calls
+        value_calculator values(lock_calls);
         std::unordered_map<tree, int> lock_decl_idx; // declaration linked with a lock
         int num_locks = 0;
         int num_calls = 0;
 
-        func<GccAdapter> fun = {};
+        // block indices can have gaps, so size the cfg by the largest index instead of the number of blocks
+        cfg_builder<GccAdapter> builder(checker.func_ids, last_basic_block_for_fn(f));
 
-        int num_bbs = 0;
         basic_block bb;
         FOR_ALL_BB_FN(bb, f) {
-            num_bbs++;
-        }
-
-        fun.bbs.resize(num_bbs);
-
-        FOR_ALL_BB_FN(bb, f) {
-            lock_checker::bb<GccAdapter> cur_bb = {};
+            cond_edge<GccAdapter> next = {};
+            builder.begin_block(bb->index);
 
             edge e;
             edge_iterator ei;
@@ -285,12 +546,12 @@ public:
 
                 if (e->flags & EDGE_FALLTHRU || e->flags & EDGE_TRUE_VALUE || e->flags == 0) {
                     //fprintf(stderr, "found true edge\n");
-                    cur_bb.next.on_true = dest->index;
+                    next.on_true = dest->index;
                 } else if (e->flags & EDGE_FALSE_VALUE) {
                     //fprintf(stderr, "found false edge\n");
-                    cur_bb.next.on_false = dest->index;
+                    next.on_false = dest->index;
                 } else {
-                    fprintf(stderr, "unknown edge type %04x", e->flags);
+                    LOCK_CHECKER_LOG(kWarnings, "unknown edge type %04x\n", e->flags);
                 }
             }
 
@@ -314,18 +575,19 @@ public:
                     auto* stmt = as_a<gcall*>(gs);
 
                     std::optional<idx<lock>> cur_lock_idx = std::nullopt;
+                    const lock_api* api = apis.match(stmt);
 
-                    if (match_call(stmt, "xSemaphoreTake", 2) || match_call(stmt, "xSemaphoreGive", 1)) {
-                        auto rhs = gimple_call_arg(stmt, 0);
+                    if (api != nullptr && (api->kind == kTake || api->kind == kGive)) {
+                        auto rhs = gimple_call_arg(stmt, api->lock_arg);
                         auto real_rhs = follow_var_decl(follow_ssa(rhs));
 
                         if (real_rhs != nullptr) {
                             auto decl_id = DECL_NAME(real_rhs);
                             if (auto it = lock_decl_idx.find(decl_id); it == lock_decl_idx.end()) {
-                                fprintf(stderr, "\t\tfound new lock for %p, decl_id %d\n", decl_id, num_locks);
+                                LOCK_CHECKER_LOG(kDebug, "\t\tfound new lock for %p, decl_id %d\n", decl_id, num_locks);
                                 //warning_at(stmt->location, 0, "found new lock for %p, decl_id %d\n", decl_id, num_locks);
 
-                                fun.locks.push_back(decl_id);
+                                builder.graph.locks.push_back(decl_id);
                                 lock_decl_idx[decl_id] = num_locks;
                                 num_locks++;
                             }
@@ -333,139 +595,222 @@ public:
                             cur_lock_idx = lock_decl_idx[decl_id];
                         } else {
                             // shouldn't happen
-                            fprintf(stderr, "\t\tunable to find lock argument, skipping %p\n", stmt);
+                            LOCK_CHECKER_LOG(kWarnings, "\t\tunable to find lock argument, skipping %p\n", stmt);
                             continue;
                         }
                     }
 
-                    if (match_call(stmt, "xSemaphoreTake", 2)) {
-                        auto delay = gimple_call_arg(stmt, 1);
-                        auto delay_val = calc_vals(delay, lock_calls);
-                        if (!delay_val) {
-                            // TODO post warning
-                            // if we can't convert the delay to a constant you're doing something terribly wrong
-                            fprintf(stderr, "\t\tunable to determine delay argument, skipping %p\n", stmt);
-                            continue;
-                        } else {
-                            auto &[delay_vals, delay_list] = *delay_val;
-                            if ((delay_vals.size() != 1) || delay_vals[0] != 65535) {
-                                if (delay_vals.size() != 1) {
-                                    fprintf(stderr, "\t\tunable to determine the delay for a given lock; assuming it's fallible\n");
-                                }
-                                lock_calls[stmt] = num_calls;
-                                fprintf(stderr, "\t\tfound fallible lock for %d id %d!\n", **cur_lock_idx, num_calls);
-                                cur_bb.actions.push_back(action<GccAdapter>::fallible_lock_(stmt->location, *cur_lock_idx, {num_calls}));
-                                num_calls++;
-                            } else {
-                                fprintf(stderr, "\t\tfound lock %d!\n", **cur_lock_idx);
-                                cur_bb.actions.push_back(action<GccAdapter>::lock_(stmt->location, *cur_lock_idx));
+                    if (api != nullptr && api->kind == kTake) {
+                        bool blocking = false;
+                        if (api->delay_arg >= 0) {
+                            auto delay = gimple_call_arg(stmt, api->delay_arg);
+                            auto delay_val = values.calc_vals(delay);
+                            if (!delay_val) {
+                                // TODO post warning
+                                // if we can't convert the delay to a constant you're doing something terribly wrong
+                                LOCK_CHECKER_LOG(kWarnings, "\t\tunable to determine delay argument, skipping %p\n", stmt);
+                                continue;
+                            }
+                            auto delay_const = delay_val->constant_value();
+                            if (!delay_const) {
+                                LOCK_CHECKER_LOG(kWarnings, "\t\tunable to determine the delay for a given lock; assuming it's fallible\n");
                             }
+                            blocking = delay_const && *delay_const == 65535;
+                        }
+
+                        if (blocking) {
+                            LOCK_CHECKER_LOG(kDebug, "\t\tfound lock %d!\n", **cur_lock_idx);
+                            builder.lock_(stmt->location, *cur_lock_idx);
+                        } else {
+                            lock_calls[stmt] = num_calls;
+                            LOCK_CHECKER_LOG(kDebug, "\t\tfound fallible lock for %d id %d!\n", **cur_lock_idx, num_calls);
+                            builder.fallible_lock_(stmt->location, *cur_lock_idx, {num_calls});
+                            num_calls++;
                         }
-                    } else if (match_call(stmt, "xSemaphoreGive", 1)) {
+                    } else if (api != nullptr && api->kind == kGive) {
                         if (cur_lock_idx.has_value()) {
-                            fprintf(stderr, "\tfound unlock %d! %p\n", **cur_lock_idx, stmt);
-                            cur_bb.actions.push_back(action<GccAdapter>::unlock_(stmt->location, *cur_lock_idx));
+                            LOCK_CHECKER_LOG(kDebug, "\tfound unlock %d! %p\n", **cur_lock_idx, stmt);
+                            builder.unlock_(stmt->location, *cur_lock_idx);
                         } else {
-                            fprintf(stderr, "\t\tw: could not find lock id; bug in plugin!\n");
+                            LOCK_CHECKER_LOG(kWarnings, "\t\tw: could not find lock id; bug in plugin!\n");
                         }
+                    } else if (api != nullptr) {
+                        LOCK_CHECKER_LOG(kDebug, "\t\tignoring call to %s\n", api->name.c_str());
                     } else {
                         tree decl = call_decl(stmt);
                         if (decl != NULL) {
-                            cur_bb.actions.push_back(action<GccAdapter>::call_(stmt->location, IDENTIFIER_POINTER(decl)));
-                            fprintf(stderr, "\t\tfound call to %s\n", IDENTIFIER_POINTER(decl));
+                            builder.call_(stmt->location, IDENTIFIER_POINTER(decl));
+                            LOCK_CHECKER_LOG(kDebug, "\t\tfound call to %s\n", IDENTIFIER_POINTER(decl));
                         } else {
-                            fprintf(stderr, "\t\tunable to find function for call; this is a bug in the plugin\n");
+                            LOCK_CHECKER_LOG(kWarnings, "\t\tunable to find function for call; this is a bug in the plugin\n");
                         }
                     }
                 }
                 if (gs->code == GIMPLE_COND) {
-                    fprintf(stderr, "\tfound cond\n");
+                    LOCK_CHECKER_LOG(kDebug, "\tfound cond\n");
                     gcond* stmt = as_a<gcond*>(gs);
 
                     tree lhs = gimple_cond_lhs(stmt);
                     tree rhs = gimple_cond_rhs(stmt);
-                    auto maybe_lhs = calc_vals(lhs, lock_calls);
-                    auto maybe_rhs = calc_vals(rhs, lock_calls);
+                    auto maybe_lhs = values.calc_vals(lhs);
+                    auto maybe_rhs = values.calc_vals(rhs);
 
                     auto code = gimple_cond_code(stmt);
 
-                    auto process_result = [&](possible_vals& result) {
+                    auto process_result = [&](const std::optional<truth_table>& result) {
                         if (result) {
-                            auto &[result_vals, result_list] = *result;
-                            if (result_vals.size() == 2) {
-                                if (result_vals[0] == 1 && result_vals[1] == 0) {
-                                    cur_bb.next.depends_on = {result_list[0]};
+                            if (auto cond = result->as_condition()) {
+                                auto [call, true_on_success] = *cond;
+                                next.depends_on = {call};
+                                if (!true_on_success) {
                                     // need to flip the branches
-                                    std::swap(cur_bb.next.on_true, *cur_bb.next.on_false);
-                                } else if (result_vals[0] == 0 && result_vals[1] == 1) {
-                                    cur_bb.next.depends_on = {result_list[0]};
-                                } else {
-                                    fprintf(stderr, "w: constant expression found in cond statement\n");
-                                    // here both results are either 0 or 1, so it's either always
-                                    // true or always false
-                                    // maybe warn? don't need to do anything, it doesn't really depend on 
-                                    // the lock statement
+                                    std::swap(next.on_true, *next.on_false);
                                 }
+                            } else if (result->constant_value()) {
+                                LOCK_CHECKER_LOG(kWarnings, "w: constant expression found in cond statement\n");
+                                // here both results are either 0 or 1, so it's either always
+                                // true or always false
+                                // maybe warn? don't need to do anything, it doesn't really depend on 
+                                // the lock statement
                             } else {
-                                fprintf(stderr, "unknown cond case\n");
-                                fprintf(stderr, "cond vals ");
-                                dump_vals(result_vals);
-                                fprintf(stderr, "\n");
+                                if (log_enabled(kWarnings)) {
+                                    fprintf(stderr, "unknown cond case\ncond vals ");
+                                    result->dump();
+                                    fprintf(stderr, "\n");
+                                }
                             }
                         } else {
-                            fprintf(stderr, "branch unrelated to locks\n");
+                            LOCK_CHECKER_LOG(kDebug, "branch unrelated to locks\n");
+                        }
+                    };
+                    auto compare = [&](auto op) -> std::optional<truth_table> {
+                        if (!maybe_lhs || !maybe_rhs) {
+                            return std::nullopt;
                         }
+                        return truth_table::combine(*maybe_lhs, *maybe_rhs, op);
                     };
                     if (code == EQ_EXPR) {
-                        auto result = merge_vals(maybe_lhs, maybe_rhs, [](int64_t a, int64_t b) -> bool {
+                        process_result(compare([](int64_t a, int64_t b) -> int64_t {
                             return a == b;
-                        });
-                        process_result(result);
+                        }));
                     } else if (code == NE_EXPR) {
-                        auto result = merge_vals(maybe_lhs, maybe_rhs, [](int64_t a, int64_t b) -> bool {
+                        process_result(compare([](int64_t a, int64_t b) -> int64_t {
                             return a != b;
-                        });
-                        process_result(result);
+                        }));
                     } else {
-                        fprintf(stderr, "\t\tUNKNOWN cond code %d\n", code);
-                        fprintf(stderr, "branch unrelated to locks\n");
+                        LOCK_CHECKER_LOG(kWarnings, "\t\tUNKNOWN cond code %d\n", code);
                     }
                 }
             }
 
-            //fprintf(stderr, "next depends_on %d true %d false %d\n", (cur_bb.next.depends_on ? **cur_bb.next.depends_on:-1), *cur_bb.next.on_true, (cur_bb.next.on_false ? **cur_bb.next.on_false : -1));
-            fun.bbs[bb->index] = std::move(cur_bb);
+            //fprintf(stderr, "next depends_on %d true %d false %d\n", (next.depends_on ? **next.depends_on:-1), *next.on_true, (next.on_false ? **next.on_false : -1));
+            builder.end_block(next);
+        }
+        auto fun = builder.finish({ENTRY_BLOCK_PTR_FOR_FN(f)->index}, {EXIT_BLOCK_PTR_FOR_FN(f)->index}, f->function_end_locus);
+        if constexpr (S::enabled) {
+            checker.stats[name].extract_ms = ms_since(extract_start);
         }
-        fun.start_bb = {ENTRY_BLOCK_PTR_FOR_FN(f)->index};
-        fun.end_bb = {EXIT_BLOCK_PTR_FOR_FN(f)->index};
-        fun.end_line = f->function_end_locus;
 
         //fprintf(stderr, "func %s\n", name.c_str());
-        //fun.dump();
+        //fun.dump(checker.func_ids);
+        if (!options.capture_path.empty()) {
+            capture.add_function(name, fun, checker.func_ids, lock_name, where);
+        }
+
+        if (options.jobs > 1) {
+            // analyzed all at once when the translation unit is done
+            pending.push_back({name, std::move(fun)});
+            return 0;
+        }
 
         std::unordered_map<location_t, errors> fun_errors;
-        checker.process_function(name, fun, fun_errors);
+        checker.process_function(name, std::move(fun), fun_errors);
 
-        fprintf(stderr, "found %d errors\n", fun_errors.size());
-        std::vector<location_t> all_lines;
-        for (auto& [loc, _]: fun_errors) {
-            all_lines.push_back(loc);
+        report_errors(fun_errors);
+        report_over_budget();
+        report_lock_order();
+        return 0;
+    }
+};
+
+// runs once the function pass has seen every function in the unit, and puts the unit's summary in
+// a variable in section .lock_checker so it's streamed into the lto object with everything else
+template <typename S> struct summary_pass: public simple_ipa_opt_pass {
+    summary_pass(gcc::context* ctx, pass<S>* checker_pass_): simple_ipa_opt_pass(summary_pass_data, ctx), checker_pass(checker_pass_) {}
+
+    pass<S>* checker_pass;
+
+    virtual unsigned int execute(function*) override {
+        checker_pass->check_pending();
+        if (checker_pass->checker.blocking_locks_used.empty()) {
+            return 0;
         }
-        std::sort(all_lines.begin(), all_lines.end());
-        for (auto &loc: all_lines) {
-            for (auto &e: fun_errors[loc].errs) {
-                if (e.typ == error::kDoubleTake) {
-                    error_at(loc, "double take");
-                } else if (e.typ == error::kGiveWithoutTake) {
-                    error_at(loc, "give without take");
-                } else if (e.typ == error::kTakeWithoutGive) {
-                    error_at(loc, "mutex not given at end of function");
-                } else if (e.typ = error::kCallWithBlockingLock) {
-                    error_at(loc, "call to function will block");
-                }
+        const std::string bytes = checker_pass->unit_summary_bytes();
+        LOCK_CHECKER_LOG(kProgress, "writing a %zu byte summary of %zu functions\n", bytes.size(), checker_pass->checker.blocking_locks_used.size());
+
+        tree type = build_array_type_nelts(char_type_node, bytes.size());
+        tree init = build_string(bytes.size(), bytes.data());
+        TREE_TYPE(init) = type;
+        tree decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier(summary_var_name), type);
+        TREE_STATIC(decl) = 1;
+        TREE_READONLY(decl) = 1;
+        DECL_ARTIFICIAL(decl) = 1;
+        DECL_PRESERVE_P(decl) = 1;
+        DECL_INITIAL(decl) = init;
+        set_decl_section_name(decl, ".lock_checker");
+        varpool_node::finalize_decl(decl);
+        return 0;
+    }
+};
+
+// the whole-program check, run by lto1 over the summaries of every unit being linked; no function
+// bodies are read, so this costs about as much as merging the summaries
+//
+// an ipa pass, rather than a simple one, because those are the only ones that run at link time; it
+// doesn't need any of the summary hooks, the data comes in through the variables summary_pass made
+struct link_pass: public ipa_opt_pass_d {
+    explicit link_pass(gcc::context* ctx): ipa_opt_pass_d(link_pass_data, ctx, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL) {}
+
+    virtual unsigned int execute(function*) override {
+        program_checker program;
+        varpool_node* node;
+        FOR_EACH_VARIABLE(node) {
+            tree name = DECL_NAME(node->decl);
+            if (name == nullptr || strcmp(IDENTIFIER_POINTER(name), summary_var_name) != 0) {
+                continue;
+            }
+            tree init = node->get_constructor();
+            auto unit = init != nullptr && TREE_CODE(init) == STRING_CST
+                ? summary_view::open(TREE_STRING_POINTER(init), TREE_STRING_LENGTH(init))
+                : std::nullopt;
+            if (unit) {
+                program.add_unit(*unit);
+            } else {
+                LOCK_CHECKER_LOG(kWarnings, "W: unable to read a lock_checker summary, skipping it\n");
             }
+            // nothing needs it after this, so it can be left out of the output
+            node->force_output = false;
+            DECL_PRESERVE_P(node->decl) = 0;
+        }
+        LOCK_CHECKER_LOG(kProgress, "checking %zu units with %zu functions together\n", program.units, program.num_functions());
+        if (program.truncated_units != 0) {
+            LOCK_CHECKER_LOG(kWarnings, "W: %zu lock_checker summaries have more than 32 locks, only the first 32 of each are checked\n", program.truncated_units);
         }
 
+        // there are no source locations at link time, so they're put in the messages instead; the
+        // merge only ever adds calls made with a blocking lock held
+        for (const auto& [loc, err]: program.new_errors()) {
+            error_at(UNKNOWN_LOCATION, "%s:%u: call to function will block", loc.file.c_str(), loc.line);
+        }
+        for (const auto& cycle: program.new_cycles()) {
+            const size_t n = cycle.locks.size();
+            error_at(UNKNOWN_LOCATION, "%s:%u: lock order inversion: %s taken while holding %s, which can deadlock with the takes below",
+                    cycle.sites[0].file.c_str(), cycle.sites[0].line, cycle.locks[1 % n].c_str(), cycle.locks[0].c_str());
+            for (size_t i = 1; i < n; i++) {
+                inform(UNKNOWN_LOCATION, "%s:%u: %s taken here while holding %s", cycle.sites[i].file.c_str(), cycle.sites[i].line,
+                        cycle.locks[(i + 1) % n].c_str(), cycle.locks[i].c_str());
+            }
+        }
         return 0;
     }
 };
@@ -476,7 +821,38 @@ public:
 static void my_callback(void *gcc_data, void *user_data) {
     // This function will be called at a specific point during compilation
     // You can add your custom logic here, e.g., print a message.
-    fprintf(stderr, "GCC Plugin: My callback was invoked!\n");
+    LOCK_CHECKER_LOG(lock_checker::kProgress, "GCC Plugin: My callback was invoked!\n");
+}
+
+template <typename S> static void finish_unit_callback(void *gcc_data, void *user_data) {
+    static_cast<lock_checker::pass<S>*>(user_data)->finish_unit();
+}
+
+// registers the function pass (and with whole_program under -flto, the pass writing the unit's summary;
+// without lto it's written when the unit is finished)
+template <typename S> static void register_passes(plugin_name_args *plugin_info, const lock_checker::plugin_options& options) {
+    auto* checker_pass = new lock_checker::pass<S>(g, options);
+    register_callback(plugin_info->base_name, PLUGIN_FINISH_UNIT, finish_unit_callback<S>, checker_pass);
+
+    // slim lto objects stop after the ipa passes, so the function pass has to run before them
+    const bool summarize = options.whole_program && flag_lto;
+    struct register_pass_info pass_info = {
+        .pass = checker_pass,
+        .reference_pass_name = summarize ? "ssa" : "nrv",
+        .ref_pass_instance_number = 1,
+        .pos_op = PASS_POS_INSERT_AFTER,
+    };
+    register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+
+    if (summarize) {
+        struct register_pass_info summary_info = {
+            .pass = new lock_checker::summary_pass<S>(g, checker_pass),
+            .reference_pass_name = "opt_local_passes",
+            .ref_pass_instance_number = 1,
+            .pos_op = PASS_POS_INSERT_AFTER,
+        };
+        register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &summary_info);
+    }
 }
 
 
@@ -487,19 +863,37 @@ int plugin_init(plugin_name_args *plugin_info, plugin_gcc_version *version) {
         return 1; // Incompatible version
     }
 
-    struct register_pass_info pass_info = {
-        .pass = new lock_checker::pass(g),
-        .reference_pass_name = "nrv",
-        .ref_pass_instance_number = 1,
-        .pos_op = PASS_POS_INSERT_AFTER,
-    };
+    const auto options = lock_checker::plugin_options::parse(plugin_info);
+    lock_checker::log_verbosity = options.verbose;
 
     // Register the callback
     // Here, we register it for the 'PLUGIN_START_UNIT' event,
     // which occurs at the beginning of compiling a translation unit.
     register_callback(plugin_info->base_name, PLUGIN_START_UNIT, my_callback, NULL);
-    register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
 
-    fprintf(stderr, "GCC Plugin: My plugin loaded successfully!\n");
+    if (strcmp(lang_hooks.name, "GNU GIMPLE") == 0) {
+        // lto1: every function was already checked when its unit was compiled, so with whole_program
+        // only the summaries are looked at, once (the ltrans processes don't run ipa passes)
+        if (options.whole_program && !flag_ltrans) {
+            struct register_pass_info link_info = {
+                .pass = new lock_checker::link_pass(g),
+                .reference_pass_name = "whole-program",
+                .ref_pass_instance_number = 1,
+                .pos_op = PASS_POS_INSERT_AFTER,
+            };
+            register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &link_info);
+        }
+        if (options.whole_program) {
+            return 0;
+        }
+    }
+
+    if (options.stats) {
+        register_passes<lock_checker::collect_stats>(plugin_info, options);
+    } else {
+        register_passes<lock_checker::no_stats>(plugin_info, options);
+    }
+
+    LOCK_CHECKER_LOG(lock_checker::kProgress, "GCC Plugin: My plugin loaded successfully!\n");
     return 0; // Success
 }
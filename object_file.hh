@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+// finding a section in an ELF object file, or in each object of an ar archive, without copying
+// anything out of it; everything here works on a buffer the caller has mapped and returns pointers
+// into it
+//
+// only the headers and the section itself are touched, so looking through an object costs a few pages
+// however big it is; headers are read with memcpy, since archive members are only 2-byte aligned
+
+namespace lock_checker {
+
+struct byte_range {
+    const uint8_t* data;
+    size_t size;
+};
+
+// a whole file mapped read-only, until this goes away
+struct mapped_file {
+    void* data = MAP_FAILED;
+    size_t size = 0;
+
+    bool open(const char* path) {
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = st.st_size;
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        return data != MAP_FAILED;
+    }
+    ~mapped_file() {
+        if (data != MAP_FAILED) {
+            munmap(data, size);
+        }
+    }
+};
+
+template <typename Ehdr, typename Shdr> std::optional<byte_range> find_elf_section(byte_range file, const char* name) {
+    Ehdr eh;
+    if (file.size < sizeof(eh)) {
+        return std::nullopt;
+    }
+    memcpy(&eh, file.data, sizeof(eh));
+    if (eh.e_shentsize != sizeof(Shdr) || eh.e_shoff > file.size || (file.size - eh.e_shoff) / sizeof(Shdr) < eh.e_shnum) {
+        return std::nullopt;
+    }
+    auto section = [&](size_t i) {
+        Shdr sh;
+        memcpy(&sh, file.data + eh.e_shoff + i * sizeof(Shdr), sizeof(sh));
+        return sh;
+    };
+    auto contents = [&](const Shdr& sh) -> std::optional<byte_range> {
+        if (sh.sh_type == SHT_NOBITS || sh.sh_offset > file.size || sh.sh_size > file.size - sh.sh_offset) {
+            return std::nullopt;
+        }
+        return byte_range{file.data + sh.sh_offset, (size_t)sh.sh_size};
+    };
+
+    if (eh.e_shstrndx >= eh.e_shnum) {
+        return std::nullopt;
+    }
+    const auto names = contents(section(eh.e_shstrndx));
+    if (!names) {
+        return std::nullopt;
+    }
+    const size_t len = strlen(name);
+    for (size_t i = 0; i < eh.e_shnum; i++) {
+        const Shdr sh = section(i);
+        if (sh.sh_name < names->size && names->size - sh.sh_name > len
+                && memcmp(names->data + sh.sh_name, name, len + 1) == 0) {
+            return contents(sh);
+        }
+    }
+    return std::nullopt;
+}
+
+// the contents of the section with the given name, or nullopt if file isn't a little endian ELF file
+// or doesn't have one
+inline std::optional<byte_range> find_elf_section(byte_range file, const char* name) {
+    if (file.size < EI_NIDENT || memcmp(file.data, ELFMAG, SELFMAG) != 0 || file.data[EI_DATA] != ELFDATA2LSB) {
+        return std::nullopt;
+    }
+    if (file.data[EI_CLASS] == ELFCLASS64) {
+        return find_elf_section<Elf64_Ehdr, Elf64_Shdr>(file, name);
+    }
+    if (file.data[EI_CLASS] == ELFCLASS32) {
+        return find_elf_section<Elf32_Ehdr, Elf32_Shdr>(file, name);
+    }
+    return std::nullopt;
+}
+
+// the members of an ar archive (without its symbol and long name tables), or nullopt if file isn't
+// one; thin archives don't have the objects in them, so they aren't understood either
+inline std::optional<std::vector<byte_range>> archive_members(byte_range file) {
+    static const char magic[] = "!<arch>\n";
+    constexpr size_t header_size = 60;
+    if (file.size < 8 || memcmp(file.data, magic, 8) != 0) {
+        return std::nullopt;
+    }
+    std::vector<byte_range> members;
+    size_t at = 8;
+    while (at + header_size <= file.size) {
+        const char* header = (const char*)file.data + at;
+        if (memcmp(header + 58, "`\n", 2) != 0) {
+            return std::nullopt;
+        }
+        char size_field[11] = {};
+        memcpy(size_field, header + 48, 10);
+        const size_t size = strtoull(size_field, nullptr, 10);
+        at += header_size;
+        if (size > file.size - at) {
+            return std::nullopt;
+        }
+        // "/" is the symbol table and "//" the long names; bsd archives put long names before the contents
+        if (header[0] != '/') {
+            size_t name_len = 0;
+            if (memcmp(header, "#1/", 3) == 0) {
+                name_len = std::min<size_t>(strtoull(header + 3, nullptr, 10), size);
+            }
+            members.push_back({file.data + at + name_len, size - name_len});
+        }
+        at += size + (size & 1);
+    }
+    return members;
+}
+
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "file_checker.hh"
+#include "lock_order.hh"
+#include "unit_summary.hh"
+
+// the interprocedural part of the check for a whole program, put together from the summaries of its
+// units (see unit_summary.hh) without looking at any function bodies
+//
+// every unit was already checked on its own when it was compiled, so only what the whole program
+// adds is reported: calls that block on a lock the caller holds where the blocking take is in
+// another unit, and lock order cycles made of edges no single unit has all of
+//
+// a unit has at most 32 locks, like everything file_checker checks, but a program can have any number
+// of them; so this keeps its own call graph, with sets of locks as wide as the program needs
+
+namespace lock_checker {
+
+// a set of program-wide lock indices
+struct lock_set {
+    std::vector<uint64_t> words;
+
+    void insert(uint32_t lock) {
+        if (words.size() <= lock / 64) {
+            words.resize(lock / 64 + 1, 0);
+        }
+        words[lock / 64] |= 1ull << (lock % 64);
+    }
+    bool contains(uint32_t lock) const {
+        return lock / 64 < words.size() && (words[lock / 64] >> (lock % 64)) & 1;
+    }
+    bool empty() const {
+        return std::all_of(words.begin(), words.end(), [](uint64_t w) {
+            return w == 0;
+        });
+    }
+    bool intersects(const lock_set& other) const {
+        for (size_t w = 0; w < std::min(words.size(), other.words.size()); w++) {
+            if ((words[w] & other.words[w]) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // adds everything in other; true if that added anything
+    bool add(const lock_set& other) {
+        if (words.size() < other.words.size()) {
+            words.resize(other.words.size(), 0);
+        }
+        bool grew = false;
+        for (size_t w = 0; w < other.words.size(); w++) {
+            grew |= (other.words[w] & ~words[w]) != 0;
+            words[w] |= other.words[w];
+        }
+        return grew;
+    }
+    template <typename F> void for_each(F f) const {
+        for (size_t w = 0; w < words.size(); w++) {
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+                f((uint32_t)(w * 64 + __builtin_ctzll(bits)));
+            }
+        }
+    }
+};
+
+struct program_checker {
+    struct call {
+        source_location loc;
+        std::string callee;
+        lock_set held; // held on any path reaching the call
+    };
+    struct function {
+        lock_set blocking; // taken with a blocking call by the function itself
+        std::vector<call> calls;
+    };
+    // some functions, and the lock order edges seen in them, by program-wide lock index
+    struct call_graph {
+        std::vector<std::string> names; // in the order they were first added
+        std::unordered_map<std::string, function> functions;
+        std::vector<lock_order<source_location>::edge> edges;
+    };
+    // what checking a call graph finds
+    struct findings {
+        std::unordered_map<source_location, errors> line_errors;
+        std::vector<lock_order_cycle<SummaryAdapter>> order_cycles;
+        std::unordered_map<std::string, lock_set> blocking_locks_used; // taken by the function or anything it calls
+    };
+
+    std::vector<std::string> locks; // by program-wide index
+    std::unordered_map<std::string, uint32_t> lock_idx;
+    size_t units = 0;
+    size_t truncated_units = 0; // with more than 32 locks, so the ones past 32 couldn't be in any of their lock sets
+
+    // adds one unit's functions to the call graph
+    //
+    // a function defined in more than one unit (which only happens for static functions that weren't
+    // given unit-specific names) has the call sites of the last one added
+    void add_unit(const summary_view& unit) {
+        units++;
+        truncated_units += unit.num_locks() > 32;
+        call_graph alone;
+        add_to(alone, unit);
+        for (const auto& [loc, _]: check(alone).line_errors) {
+            unit_errors.insert(loc);
+        }
+        auto& edges = unit_edges.emplace_back();
+        for (uint32_t i = 0; i < unit.num_edges(); i++) {
+            const auto e = unit.edge(i);
+            edges.insert({unit.lock(e.held), unit.lock(e.taken)});
+        }
+
+        add_to(program, unit);
+        checked = false;
+    }
+
+    size_t num_functions() const {
+        return program.names.size();
+    }
+
+    // everything the whole program finds, worked out again if a unit was added since the last time
+    const findings& result() {
+        if (!checked) {
+            found = check(program);
+            checked = true;
+        }
+        return found;
+    }
+
+    // errors the whole program has that none of its units had on their own, sorted by location
+    std::vector<std::pair<source_location, error>> new_errors() {
+        std::vector<std::pair<source_location, error>> out;
+        for (const auto& [loc, errs]: result().line_errors) {
+            if (unit_errors.count(loc) != 0) {
+                continue;
+            }
+            for (const auto& err: errs.errs) {
+                out.push_back({loc, err});
+            }
+        }
+        std::stable_sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+        return out;
+    }
+
+    // lock order cycles that only show up when the units are put together
+    std::vector<lock_order_cycle<SummaryAdapter>> new_cycles() {
+        std::vector<lock_order_cycle<SummaryAdapter>> out;
+        for (const auto& cycle: result().order_cycles) {
+            const bool in_one_unit = std::any_of(unit_edges.begin(), unit_edges.end(), [&](const auto& edges) {
+                for (size_t i = 0; i < cycle.locks.size(); i++) {
+                    if (edges.count({cycle.locks[i], cycle.locks[(i + 1) % cycle.locks.size()]}) == 0) {
+                        return false;
+                    }
+                }
+                return true;
+            });
+            if (!in_one_unit) {
+                out.push_back(cycle);
+            }
+        }
+        return out;
+    }
+
+    // the names of every lock the function can block on, directly or through what it calls
+    std::vector<std::string> blocking_locks(const std::string& name) {
+        std::vector<std::string> out;
+        if (auto it = result().blocking_locks_used.find(name); it != found.blocking_locks_used.end()) {
+            it->second.for_each([&](uint32_t lock) {
+                out.push_back(locks[lock]);
+            });
+        }
+        return out;
+    }
+
+private:
+    call_graph program;
+    findings found;
+    bool checked = true;
+    std::unordered_set<source_location> unit_errors; // everywhere a unit found an error on its own
+    std::vector<std::set<std::pair<std::string, std::string>>> unit_edges; // (held, taken) lock names, per unit
+
+    void add_to(call_graph& graph, const summary_view& unit) {
+        std::vector<uint32_t> global;
+        for (uint32_t i = 0; i < unit.num_locks(); i++) {
+            const std::string name = unit.lock(i);
+            auto [it, inserted] = lock_idx.try_emplace(name, locks.size());
+            if (inserted) {
+                locks.push_back(name);
+            }
+            global.push_back(it->second);
+        }
+        // a unit's masks only have room for its first 32 locks
+        auto to_global = [&](uint32_t mask) {
+            lock_set out;
+            for (uint32_t m = mask; m != 0; m &= m - 1) {
+                const uint32_t bit = __builtin_ctz(m);
+                if (bit < global.size()) {
+                    out.insert(global[bit]);
+                }
+            }
+            return out;
+        };
+
+        for (uint32_t i = 0; i < unit.num_edges(); i++) {
+            const auto e = unit.edge(i);
+            graph.edges.push_back({global[e.held], global[e.taken], {unit.string(e.file), e.line}});
+        }
+        for (uint32_t i = 0; i < unit.num_functions(); i++) {
+            const auto f = unit.function(i);
+            const std::string name = unit.string(f.name);
+            if (graph.functions.count(name) == 0) {
+                graph.names.push_back(name);
+            }
+            function& fun = graph.functions[name];
+            fun.blocking = to_global(f.blocking_locks);
+            fun.calls.clear();
+            for (uint32_t j = f.first_call; j < f.first_call + f.num_calls; j++) {
+                const auto c = unit.call(j);
+                fun.calls.push_back({{unit.string(c.file), c.line}, unit.string(c.callee), to_global(c.held)});
+            }
+        }
+    }
+
+    // pushes every function's blocking locks up to everything that calls it, then looks at every call:
+    // one made holding a lock the callee can block on is an error, and every lock held there comes
+    // before every lock the callee takes
+    findings check(const call_graph& graph) const {
+        findings out;
+        std::unordered_map<std::string, std::vector<const std::string*>> callers;
+        std::vector<const std::string*> work;
+        for (const auto& name: graph.names) {
+            const function& fun = graph.functions.at(name);
+            out.blocking_locks_used[name] = fun.blocking;
+            for (const auto& c: fun.calls) {
+                callers[c.callee].push_back(&name);
+            }
+            if (!fun.blocking.empty()) {
+                work.push_back(&name);
+            }
+        }
+        while (!work.empty()) {
+            const std::string* callee = work.back();
+            work.pop_back();
+            const lock_set added = out.blocking_locks_used[*callee];
+            if (auto it = callers.find(*callee); it != callers.end()) {
+                for (const std::string* caller: it->second) {
+                    if (out.blocking_locks_used[*caller].add(added)) {
+                        work.push_back(caller);
+                    }
+                }
+            }
+        }
+
+        lock_order<source_location> order;
+        auto add_edge = [&](uint32_t held, uint32_t taken, const source_location& loc) {
+            if (auto cycle = order.add(held, taken, loc)) {
+                lock_order_cycle<SummaryAdapter> c;
+                for (const auto& e: *cycle) {
+                    c.locks.push_back(locks[e.held]);
+                    c.sites.push_back(e.site);
+                }
+                out.order_cycles.push_back(std::move(c));
+            }
+        };
+        for (const auto& e: graph.edges) {
+            add_edge(e.held, e.taken, e.site);
+        }
+        for (const auto& name: graph.names) {
+            for (const auto& c: graph.functions.at(name).calls) {
+                auto it = out.blocking_locks_used.find(c.callee);
+                if (it == out.blocking_locks_used.end()) {
+                    continue;
+                }
+                if (c.held.intersects(it->second)) {
+                    out.line_errors[c.loc].add(errors::call_with_blocking_lock(""));
+                }
+                c.held.for_each([&](uint32_t held) {
+                    it->second.for_each([&](uint32_t taken) {
+                        add_edge(held, taken, c.loc);
+                    });
+                });
+            }
+        }
+        return out;
+    }
+};
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// an open addressing hash set of 64-bit keys, used to track visited states while exploring
+//
+// every state the explore engines track fits in a single integer (see state_key_layout in func_walker.hh),
+// so this stores the keys inline in one flat array instead of allocating a node per state like
+// std::unordered_set does; collisions are resolved with robin hood hashing, which keeps probe
+// sequences short even when the table is mostly full
+
+namespace lock_checker {
+
+// finalizer from splitmix64; every input bit affects every output bit, which matters because
+// the packed keys are mostly small integers in the low bits
+inline uint64_t mix_hash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+struct state_set {
+    std::vector<uint64_t> keys;
+    std::vector<uint8_t> dists; // 0 for an empty slot, otherwise 1 + how far the key is from its home slot
+    size_t count = 0;
+    size_t mask = 0;
+
+    // total number of slots looked at by insert/contains, for measuring how well the hash spreads keys
+    uint64_t probes = 0;
+
+    static constexpr uint8_t kMaxDist = 255;
+
+    explicit state_set(size_t expected = 0) {
+        size_t cap = 16;
+        while (cap * 7 / 8 < expected) {
+            cap *= 2;
+        }
+        reset(cap);
+    }
+
+    size_t size() const {
+        return count;
+    }
+    size_t capacity() const {
+        return keys.size();
+    }
+
+    bool contains(uint64_t key) {
+        size_t pos = mix_hash(key) & mask;
+        for (uint8_t dist = 1;; dist++) {
+            probes++;
+            if (dists[pos] < dist) {
+                // a key this far from home would have displaced this slot
+                return false;
+            }
+            if (dists[pos] == dist && keys[pos] == key) {
+                return true;
+            }
+            pos = (pos + 1) & mask;
+        }
+    }
+
+    // returns true if the key wasn't already in the set
+    bool insert(uint64_t key) {
+        if ((count + 1) * 8 > capacity() * 7) {
+            grow();
+        }
+
+        size_t pos = mix_hash(key) & mask;
+        uint8_t dist = 1;
+        for (;; dist++) {
+            probes++;
+            if (dists[pos] < dist) {
+                break;
+            }
+            if (dists[pos] == dist && keys[pos] == key) {
+                return false;
+            }
+            pos = (pos + 1) & mask;
+        }
+
+        // the key is new; put it here and shift everything closer to home along
+        count++;
+        for (;;) {
+            if (dists[pos] == 0) {
+                keys[pos] = key;
+                dists[pos] = dist;
+                return true;
+            }
+            if (dists[pos] < dist) {
+                std::swap(keys[pos], key);
+                std::swap(dists[pos], dist);
+            }
+            pos = (pos + 1) & mask;
+            if (++dist == kMaxDist) {
+                place_after_grow(key);
+                return true;
+            }
+        }
+    }
+
+    // the most slots a lookup of a key in the set has to look at
+    size_t longest_probe() const {
+        return dists.empty() ? 0 : *std::max_element(dists.begin(), dists.end());
+    }
+
+    void clear() {
+        std::fill(dists.begin(), dists.end(), 0);
+        count = 0;
+    }
+
+    template <typename F> void for_each(F f) const {
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (dists[i] != 0) {
+                f(keys[i]);
+            }
+        }
+    }
+
+private:
+    void reset(size_t cap) {
+        keys.assign(cap, 0);
+        dists.assign(cap, 0);
+        mask = cap - 1;
+        count = 0;
+    }
+
+    void grow() {
+        std::vector<uint64_t> old_keys;
+        std::vector<uint8_t> old_dists;
+        std::swap(old_keys, keys);
+        std::swap(old_dists, dists);
+        reset(old_keys.size() * 2);
+        for (size_t i = 0; i < old_keys.size(); i++) {
+            if (old_dists[i] != 0) {
+                insert(old_keys[i]);
+            }
+        }
+    }
+
+    // a probe sequence got too long for the distance to fit in a byte; this can only happen with
+    // a pathological hash, but growing the table fixes it
+    void place_after_grow(uint64_t key) {
+        count--;
+        grow();
+        insert(key);
+    }
+};
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+// optional instrumentation for the checker
+//
+// file_checker and the explore engines take one of the policies below as a template parameter;
+// every counter update is behind `if constexpr (S::enabled)`, so with no_stats none of it is compiled in
+
+namespace lock_checker {
+
+// counters an explore engine updates as it runs
+struct explore_stats {
+    static constexpr bool enabled = true;
+
+    uint64_t states_enqueued = 0; // states (or state sets) added to the worklist
+    uint64_t states_visited = 0; // worklist entries actually walked
+    uint64_t peak_frontier = 0; // largest the worklist got
+
+    void enqueued(size_t frontier) {
+        states_enqueued++;
+        peak_frontier = std::max<uint64_t>(peak_frontier, frontier);
+    }
+    void visited() {
+        states_visited++;
+    }
+};
+
+// everything recorded about one function
+struct function_stats {
+    uint32_t bbs = 0;
+    uint32_t actions = 0;
+    uint32_t fallible_calls = 0;
+    explore_stats explore;
+    uint64_t callsites = 0;
+    bool skipped = false; // never takes or gives a lock, so only its calls were looked at
+    bool cached = false; // found in the analysis cache, so it wasn't explored
+    uint32_t slices = 0; // with slice_locks, how many slices it was explored in, or 0 if it was explored whole
+
+    // wall time in milliseconds
+    double extract_ms = 0; // building the cfg from the compiler's representation
+    double explore_ms = 0;
+    double check_callers_ms = 0;
+};
+
+struct no_stats {
+    static constexpr bool enabled = false;
+    struct record {};
+};
+
+struct collect_stats {
+    static constexpr bool enabled = true;
+    using record = function_stats;
+};
+
+inline double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline void write_json_string(FILE* out, const std::string& s) {
+    fputc('"', out);
+    for (unsigned char c: s) {
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+inline void write_json(FILE* out, const std::string& name, const function_stats& s) {
+    fprintf(out, "{\"name\": ");
+    write_json_string(out, name);
+    fprintf(out, ", \"bbs\": %u, \"actions\": %u, \"fallible_calls\": %u, ", s.bbs, s.actions, s.fallible_calls);
+    fprintf(out, "\"states_enqueued\": %llu, \"states_visited\": %llu, \"peak_frontier\": %llu, ",
+            (unsigned long long)s.explore.states_enqueued,
+            (unsigned long long)s.explore.states_visited,
+            (unsigned long long)s.explore.peak_frontier);
+    fprintf(out, "\"callsites\": %llu, \"skipped\": %s, \"cached\": %s, \"slices\": %u, ", (unsigned long long)s.callsites, s.skipped ? "true" : "false", s.cached ? "true" : "false", s.slices);
+    fprintf(out, "\"extract_ms\": %.3f, \"explore_ms\": %.3f, \"check_callers_ms\": %.3f}", s.extract_ms, s.explore_ms, s.check_callers_ms);
+}
+
+}
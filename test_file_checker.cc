@@ -1,9 +1,20 @@
+#include <algorithm>
+#include <map>
 #include <optional>
+#include <set>
 #include <string>
+#include <tuple>
 
 #include <gtest/gtest.h>
 
+#include "cfg_corpus.hh"
+#include "cfg_generator.hh"
 #include "file_checker.hh"
+#include "lock_api.hh"
+#include "log.hh"
+#include "object_file.hh"
+#include "program_checker.hh"
+#include "truth_table.hh"
 
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
@@ -17,7 +28,12 @@ struct BasicAdapter {
     using LockId = int;
 };
 
-TEST(test_file_checker, test_basic) {
+// every test in this suite is run once for each explore engine
+struct test_file_checker: public testing::TestWithParam<explore_engine> {};
+
+INSTANTIATE_TEST_SUITE_P(engines, test_file_checker, testing::Values(kBreadthFirst, kSymbolic, kDataflow, kApproximate));
+
+TEST_P(test_file_checker, test_basic) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -84,13 +100,15 @@ TEST(test_file_checker, test_basic) {
 
     file_checker<BasicAdapter> fc;
 
+    fc.engine = GetParam();
+
     std::unordered_map<int, errors> line_errors;
 
     fc.process_function("foo", std::move(foo), line_errors);
     ASSERT_EQ(line_errors.size(), 0);
 }
 
-TEST(test_file_checker, test_basic_blocking_call) {
+TEST_P(test_file_checker, test_basic_blocking_call) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -186,6 +204,8 @@ TEST(test_file_checker, test_basic_blocking_call) {
 
     file_checker<BasicAdapter> fc;
 
+    fc.engine = GetParam();
+
     std::unordered_map<int, errors> line_errors;
 
     fc.process_function("f", std::move(f), line_errors);
@@ -194,7 +214,7 @@ TEST(test_file_checker, test_basic_blocking_call) {
     ASSERT_NE(line_errors.size(), 0);
 }
 
-TEST(test_file_checker, test_basic_blocking_call2) {
+TEST_P(test_file_checker, test_basic_blocking_call2) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -290,6 +310,8 @@ TEST(test_file_checker, test_basic_blocking_call2) {
 
     file_checker<BasicAdapter> fc;
 
+    fc.engine = GetParam();
+
     std::unordered_map<int, errors> line_errors;
 
     // swap the order around
@@ -300,7 +322,7 @@ TEST(test_file_checker, test_basic_blocking_call2) {
 }
 
 
-TEST(test_file_checker, test_missing_give) {
+TEST_P(test_file_checker, test_missing_give) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -367,6 +389,8 @@ TEST(test_file_checker, test_missing_give) {
 
     file_checker<BasicAdapter> fc;
 
+    fc.engine = GetParam();
+
     std::unordered_map<int, errors> line_errors;
 
     // swap the order around
@@ -374,7 +398,7 @@ TEST(test_file_checker, test_missing_give) {
     ASSERT_NE(line_errors.size(), 0);
 }
 
-TEST(test_file_checker, test_missing_give_return) {
+TEST_P(test_file_checker, test_missing_give_return) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -441,6 +465,8 @@ TEST(test_file_checker, test_missing_give_return) {
 
     file_checker<BasicAdapter> fc;
 
+    fc.engine = GetParam();
+
     std::unordered_map<int, errors> line_errors;
 
     // swap the order around
@@ -449,7 +475,7 @@ TEST(test_file_checker, test_missing_give_return) {
 }
 
 
-TEST(test_file_checker, test_missing_take) {
+TEST_P(test_file_checker, test_missing_take) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -516,6 +542,8 @@ TEST(test_file_checker, test_missing_take) {
 
     file_checker<BasicAdapter> fc;
 
+    fc.engine = GetParam();
+
     std::unordered_map<int, errors> line_errors;
 
     fc.process_function("foo", std::move(foo), line_errors);
@@ -523,7 +551,7 @@ TEST(test_file_checker, test_missing_take) {
 }
 
 
-TEST(test_file_checker, test_multiple_funcs) {
+TEST_P(test_file_checker, test_multiple_funcs) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -615,6 +643,7 @@ TEST(test_file_checker, test_multiple_funcs) {
 
     {
         file_checker<BasicAdapter> fc;
+        fc.engine = GetParam();
         std::unordered_map<int, errors> line_errors;
 
         fc.process_function("foo", foo, line_errors);
@@ -628,6 +657,7 @@ TEST(test_file_checker, test_multiple_funcs) {
     // test out different orders
     {
         file_checker<BasicAdapter> fc;
+        fc.engine = GetParam();
         std::unordered_map<int, errors> line_errors;
 
         fc.process_function("baz", baz, line_errors);
@@ -640,6 +670,7 @@ TEST(test_file_checker, test_multiple_funcs) {
 
     {
         file_checker<BasicAdapter> fc;
+        fc.engine = GetParam();
         std::unordered_map<int, errors> line_errors;
 
         fc.process_function("baz", baz, line_errors);
@@ -691,7 +722,7 @@ bb idx 4 depends_on -1 true 5 false -1
         unlock id 0
 bb idx 5 depends_on -1 true 1 false -1
 */
-TEST(test_file_checker, test_multiple_funcs_more_complicated) {
+TEST_P(test_file_checker, test_multiple_funcs_more_complicated) {
     using a = action<BasicAdapter>;
     using ix = idx<lock>;
 
@@ -763,6 +794,9 @@ TEST(test_file_checker, test_multiple_funcs_more_complicated) {
 
 
     file_checker<BasicAdapter> fc;
+
+
+    fc.engine = GetParam();
     std::unordered_map<int, errors> line_errors;
 
     fc.process_function("foo", foo, line_errors);
@@ -775,5 +809,2078 @@ TEST(test_file_checker, test_multiple_funcs_more_complicated) {
 }
 
 
+// builds n copies of
+//      if (lock(5) == pdTRUE) {
+//          unlock();
+//      }
+// in a row; each lock call is fallible
+static func<BasicAdapter> take_check_give_chain(int n) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    func<BasicAdapter> fun = {
+        .locks = { 0 },
+    };
+    fun.bbs.push_back({ .next = { {1} } }); // 0
+    for (int i = 0; i < n; i++) {
+        fun.bbs.push_back({ // take
+            .actions = { a::fallible_lock_(2*i + 1, ix{0}, {i}) },
+            .next = { {2*i + 2}, {2*i + 3}, {i} },
+        });
+        fun.bbs.push_back({ // give
+            .actions = { a::unlock_(2*i + 2, ix{0}) },
+            .next = { {2*i + 3} },
+        });
+    }
+    fun.bbs.push_back({ }); // end
+    fun.start_bb = {0};
+    fun.end_bb = {2*n + 1};
+    return fun;
+}
+
+// every (action location, action type, lock state) the engine calls back with, and the number of calls
+template <typename T> static std::pair<std::set<std::tuple<int, int, uint32_t>>, int> seen_states(const func<T>& fun, explore_engine engine) {
+    std::set<std::tuple<int, int, uint32_t>> seen;
+    int calls = 0;
+    func_table<T> funcs;
+    cfg<T>::build(fun, funcs).template explore_using<int>(engine, [&](edge_state<T, int>& es, const action_ref<T>& a) {
+        seen.insert({a.typ == kEnd ? -1 : a.loc, a.typ, es.cur_lock_state.state});
+        calls++;
+    }, 0);
+    return {seen, calls};
+}
+
+TEST(test_explore, test_symbolic_matches_bfs) {
+    auto fun = take_check_give_chain(10);
+
+    auto [bfs_seen, bfs_calls] = seen_states(fun, kBreadthFirst);
+    auto [sym_seen, sym_calls] = seen_states(fun, kSymbolic);
+    ASSERT_EQ(bfs_seen, sym_seen);
+    ASSERT_LT(sym_calls, 4 * 10);
+}
+
+// the parity of 32 variables is 63 nodes, but has 2^32 paths through them
+TEST(test_bdd, test_forget_shared_nodes) {
+    bdd sets;
+    bdd::ref odd = bdd::kFalse, even = bdd::kTrue;
+    for (uint32_t v = 32; v-- > 0;) {
+        const bdd::ref next_odd = sets.mk(v, odd, even);
+        even = sets.mk(v, even, odd);
+        odd = next_odd;
+    }
+    ASSERT_EQ(sets.count(odd, 32), 1ull << 31);
+
+    ASSERT_EQ(sets.forget(odd, 31), bdd::kTrue);
+    ASSERT_EQ(sets.forget_all(odd, 0xffff0000), bdd::kTrue);
+
+    // any value of the high half can make up the parity, so the low half is unconstrained
+    const bdd::ref cleared = sets.clear_all(odd, 0xffff0000);
+    ASSERT_EQ(sets.count(cleared, 32), 1ull << 16);
+    ASSERT_EQ(sets.and_(cleared, sets.var(20)), bdd::kFalse);
+
+    bdd::ref one_at_a_time = odd;
+    for (uint32_t v = 16; v < 32; v++) {
+        one_at_a_time = sets.assign(one_at_a_time, v, false);
+    }
+    ASSERT_EQ(one_at_a_time, cleared);
+}
+
+TEST(test_explore, test_generated_functions) {
+    generator_options options;
+    options.bbs = 48;
+    options.fallible_takes = 6;
+    options.loop_density = 0.2;
+    for (uint64_t seed = 1; seed <= 20; seed++) {
+        auto fun = random_func<BasicAdapter>(options, seed);
+        ASSERT_GE(fun.bbs.size(), 48);
+
+        // every segment gives back what it takes, so nothing is reported for any path
+        file_checker<BasicAdapter> fc;
+        std::unordered_map<int, errors> line_errors;
+        fc.process_function("f", fun, line_errors);
+        ASSERT_EQ(line_errors.size(), 0);
+
+        auto [bfs_seen, bfs_calls] = seen_states(fun, kBreadthFirst);
+        auto [sym_seen, sym_calls] = seen_states(fun, kSymbolic);
+        auto [dataflow_seen, dataflow_calls] = seen_states(fun, kDataflow);
+        ASSERT_EQ(bfs_seen, sym_seen);
+        ASSERT_EQ(bfs_seen, dataflow_seen);
+
+        // the same seed gives the same function
+        ASSERT_EQ(seen_states(random_func<BasicAdapter>(options, seed), kBreadthFirst), std::make_pair(bfs_seen, bfs_calls));
+    }
+}
+
+TEST(test_explore, test_dense_visited_states) {
+    // small functions are explored with a bitmap of states instead of a hash table; both have to
+    // visit the same states in the same order
+    for (const auto& [bbs, locks, takes]: std::vector<std::tuple<int, int, int>>{{8, 1, 1}, {32, 2, 4}, {64, 2, 6}}) {
+        generator_options options;
+        options.bbs = bbs;
+        options.locks = locks;
+        options.fallible_takes = takes;
+        for (uint64_t seed = 1; seed <= 10; seed++) {
+            func_table<BasicAdapter> funcs;
+            const auto graph = cfg<BasicAdapter>::build(random_func<BasicAdapter>(options, seed), funcs);
+
+            using visit = std::tuple<int, uint32_t, uint32_t, int, int>;
+            auto record = [](std::vector<visit>& out) {
+                return [&out](edge_state<BasicAdapter, int>& es, const action_ref<BasicAdapter>& a) {
+                    out.push_back({*es.bb_idx, es.cur_lock_state.state, es.fallible_locks.state, a.typ, a.loc});
+                };
+            };
+            std::vector<visit> dense, hashed;
+            explore_stats dense_counters, hashed_counters;
+            graph.explore<int>(record(dense), 0, std::nullopt, &dense_counters);
+            visited_states<BasicAdapter, int> visited(graph.key_layout());
+            auto f = record(hashed);
+            graph.explore_with<int>(visited, f, 0, std::nullopt, &hashed_counters);
+
+            ASSERT_TRUE(graph.explores_dense());
+            ASSERT_EQ(dense, hashed);
+            ASSERT_EQ(dense_counters.states_visited, hashed_counters.states_visited);
+        }
+    }
+}
+
+// records every state handed to it in batches, and checks the batches are put together right;
+// explore takes callbacks by value, so what's recorded goes somewhere else
+struct batch_recorder {
+    std::vector<std::tuple<int, uint32_t, uint32_t, int, int>>& seen;
+    size_t& largest;
+
+    void on_batch(const state_batch<BasicAdapter, int>& batch, const action_ref<BasicAdapter>& a) {
+        uint32_t any = 0, all = ~0u;
+        for (size_t i = 0; i < batch.size; i++) {
+            const auto& es = batch.states[i];
+            ASSERT_EQ(batch.locks[i], es.cur_lock_state);
+            any |= es.cur_lock_state.state;
+            all &= es.cur_lock_state.state;
+            seen.push_back({*es.bb_idx, es.cur_lock_state.state, es.fallible_locks.state, a.typ, a.loc});
+        }
+        ASSERT_EQ(batch.any(), any);
+        ASSERT_EQ(batch.all(), all);
+        largest = std::max(largest, batch.size);
+    }
+};
+
+TEST(test_explore, test_batched_callbacks) {
+    // a callback taking batches sees exactly the states a per state callback does, with every engine
+    generator_options options;
+    options.bbs = 48;
+    options.fallible_takes = 6;
+    for (uint64_t seed = 1; seed <= 5; seed++) {
+        func_table<BasicAdapter> funcs;
+        const auto graph = cfg<BasicAdapter>::build(random_func<BasicAdapter>(options, seed), funcs);
+        for (const auto engine: {kBreadthFirst, kSymbolic, kDataflow, kApproximate}) {
+            std::vector<std::tuple<int, uint32_t, uint32_t, int, int>> per_state;
+            graph.explore_using<int>(engine, [&](edge_state<BasicAdapter, int>& es, const action_ref<BasicAdapter>& a) {
+                per_state.push_back({*es.bb_idx, es.cur_lock_state.state, es.fallible_locks.state, a.typ, a.loc});
+            }, 0);
+            std::vector<std::tuple<int, uint32_t, uint32_t, int, int>> batched;
+            size_t largest = 0;
+            graph.explore_using<int>(engine, batch_recorder{batched, largest}, 0);
+
+            std::sort(per_state.begin(), per_state.end());
+            std::sort(batched.begin(), batched.end());
+            ASSERT_EQ(per_state, batched);
+            if (engine == kDataflow) {
+                // states from different paths reach a block together
+                ASSERT_GT(largest, 1);
+            }
+        }
+    }
+}
+
+TEST(test_explore, test_live_fallible_calls) {
+    auto fun = take_check_give_chain(10);
+    func_table<BasicAdapter> funcs;
+    auto live = cfg<BasicAdapter>::build(fun, funcs).live_fallible_calls();
+
+    // each result is only live between its take and the branch right after it
+    for (size_t i = 0; i < live.size(); i++) {
+        ASSERT_EQ(live[i].state, 0);
+    }
+
+    // without clearing the dead bits, every combination of results would be its own state
+    auto [bfs_seen, bfs_calls] = seen_states(fun, kBreadthFirst);
+    ASSERT_LT(bfs_calls, 4 * 10);
+    auto [dataflow_seen, dataflow_calls] = seen_states(fun, kDataflow);
+    ASSERT_EQ(bfs_calls, dataflow_calls);
+
+    // a result checked in a later block stays live until then
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+    auto late_check = func<BasicAdapter> {
+        .locks = { 0, 1 },
+        .bbs = {
+            { .next = { {1} } }, // 0
+            { // 1
+                .actions = { a::fallible_lock_(1, ix{0}, {0}) },
+                .next = { {2} },
+            },
+            { // 2
+                .actions = { a::fallible_lock_(2, ix{1}, {1}) },
+                .next = { {3}, {4}, {0} },
+            },
+            { // 3
+                .actions = { a::unlock_(3, ix{0}) },
+                .next = { {4} },
+            },
+            { }, // 4
+        },
+        .start_bb = {0},
+        .end_bb = {4},
+    };
+    live = cfg<BasicAdapter>::build(late_check, funcs).live_fallible_calls();
+    ASSERT_EQ(live[1].state, 0);
+    ASSERT_EQ(live[2].state, 1);
+    ASSERT_EQ(live[3].state, 0);
+}
+
+TEST_P(test_file_checker, test_fallible_errors) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    // foo() {
+    //      if (lock(5) != pdTRUE) {
+    //          unlock(); // 2, give without take
+    //      }
+    //      lock(5); // 3, fine, can only fail if held
+    //      lock(portMAX_DELAY); // 4, double take if the first call passed
+    //      unlock();
+    // }
+    auto foo = func<BasicAdapter> {
+        .locks = { 0 },
+        .bbs = {
+            { .next = { {1} } }, // 0
+            { // 1
+                .actions = { a::fallible_lock_(1, ix{0}, {0}) },
+                .next = { {3}, {2}, {0} },
+            },
+            { // 2
+                .actions = { a::unlock_(2, ix{0}) },
+                .next = { {3} },
+            },
+            { // 3
+                .actions = {
+                    a::fallible_lock_(3, ix{0}, {1}),
+                    a::lock_(4, ix{0}),
+                    a::unlock_(5, ix{0}),
+                },
+                .next = { {4} },
+            },
+            { }, // 4
+        },
+        .start_bb = {0},
+        .end_bb = {4},
+    };
+
+    file_checker<BasicAdapter> fc;
+    fc.engine = GetParam();
+    std::unordered_map<int, errors> line_errors;
+
+    fc.process_function("foo", foo, line_errors);
+    ASSERT_EQ(line_errors.size(), 2);
+    ASSERT_EQ(line_errors.count(2), 1);
+    ASSERT_EQ(line_errors.count(4), 1);
+
+    ASSERT_EQ(seen_states(foo, kBreadthFirst).first, seen_states(foo, GetParam()).first);
+}
+
+TEST_P(test_file_checker, test_fallible_chain) {
+    auto chain = take_check_give_chain(6);
+
+    file_checker<BasicAdapter> fc;
+    fc.engine = GetParam();
+    std::unordered_map<int, errors> line_errors;
+
+    fc.process_function("chain", chain, line_errors);
+    ASSERT_EQ(line_errors.size(), 0);
+}
+
+// error kinds reported at each location, sorted so they can be compared between runs
+static std::map<int, std::vector<int>> error_kinds(const std::unordered_map<int, errors>& line_errors) {
+    std::map<int, std::vector<int>> kinds;
+    for (const auto& [loc, errs]: line_errors) {
+        for (const auto& e: errs.errs) {
+            kinds[loc].push_back(e.typ);
+        }
+        std::sort(kinds[loc].begin(), kinds[loc].end());
+    }
+    return kinds;
+}
+
+// n timed takes of different locks, with every result checked (and the lock given) only after all of
+// them, so an exact engine has to track all 2^n combinations; then a double take and a give without take
+static func<BasicAdapter> take_all_then_check(int n) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    func<BasicAdapter> fun = {};
+    for (int i = 0; i < n; i++) {
+        fun.locks.push_back(i);
+        fun.bbs.push_back({ .actions = { a::fallible_lock_(i, ix{i}, {i}) }, .next = { {i + 1} } });
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        const int check = fun.bbs.size();
+        fun.bbs.push_back({ .next = { {check + 1}, {check + 2}, {i} } });
+        fun.bbs.push_back({ .actions = { a::unlock_(100 + i, ix{i}) }, .next = { {check + 2} } });
+    }
+    const int last = fun.bbs.size();
+    fun.bbs.push_back({
+        .actions = {
+            a::lock_(200, ix{0}),
+            a::lock_(201, ix{0}), // double take
+            a::unlock_(202, ix{0}),
+            a::unlock_(203, ix{1}), // give without take
+        },
+        .next = { {last + 1} },
+    });
+    fun.bbs.push_back({ });
+    fun.start_bb = {0};
+    fun.end_bb = {last + 1};
+    return fun;
+}
+
+TEST_P(test_file_checker, test_budget) {
+    auto fun = take_all_then_check(20);
+
+    file_checker<BasicAdapter> fc;
+    fc.engine = GetParam();
+    fc.budget.max_states = 1000;
+    std::unordered_map<int, errors> line_errors;
+    fc.process_function("foo", fun, line_errors);
+
+    // the approximate engine still finds both errors, and nothing else
+    ASSERT_EQ(line_errors.size(), 2);
+    ASSERT_EQ(line_errors[201].errs[0].typ, error::kDoubleTake);
+    ASSERT_EQ(line_errors[203].errs[0].typ, error::kGiveWithoutTake);
+    if (GetParam() == kApproximate) {
+        ASSERT_TRUE(fc.over_budget.empty());
+    } else {
+        ASSERT_EQ(fc.over_budget.size(), 1);
+        ASSERT_EQ(fc.over_budget[0], std::make_pair(std::string("foo"), kStateLimit));
+    }
+
+    // same thing with a time limit
+    if (GetParam() != kApproximate) {
+        file_checker<BasicAdapter> timed;
+        timed.engine = GetParam();
+        timed.budget.max_ms = 1;
+        std::unordered_map<int, errors> timed_errors;
+        timed.process_function("foo", take_all_then_check(28), timed_errors);
+        ASSERT_EQ(timed.over_budget.size(), 1);
+        ASSERT_EQ(timed.over_budget[0].second, kTimeLimit);
+        ASSERT_EQ(error_kinds(timed_errors), error_kinds(line_errors));
+    }
+
+    // small functions aren't affected
+    file_checker<BasicAdapter> small;
+    small.engine = GetParam();
+    small.budget.max_states = 1000;
+    std::unordered_map<int, errors> small_errors;
+    small.process_function("chain", take_check_give_chain(6), small_errors);
+    ASSERT_TRUE(small.over_budget.empty());
+    ASSERT_EQ(small_errors.size(), 0);
+}
+
+TEST(test_explore, test_dataflow_matches_bfs) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    // loop() {
+    //      for (;;) {
+    //          if (lock(5) == pdTRUE) { // 1
+    //              if (x) {
+    //                  unlock(); // 3
+    //              }
+    //          }
+    //          f(); // 4
+    //      }
+    // }
+    auto loop = func<BasicAdapter> {
+        .locks = { 0 },
+        .bbs = {
+            { .next = { {1} } }, // 0
+            { // 1
+                .actions = { a::fallible_lock_(1, ix{0}, {0}) },
+                .next = { {2}, {4}, {0} },
+            },
+            { .next = { {3}, {4} } }, // 2
+            { // 3
+                .actions = { a::unlock_(3, ix{0}) },
+                .next = { {4} },
+            },
+            { // 4
+                .actions = { a::call_(4, "f") },
+                .next = { {1}, {5} },
+            },
+            { }, // 5
+        },
+        .start_bb = {0},
+        .end_bb = {5},
+    };
+    auto chain = take_check_give_chain(8);
+
+    std::map<int, std::vector<int>> results[2];
+    int i = 0;
+    for (auto engine: {kBreadthFirst, kDataflow}) {
+        file_checker<BasicAdapter> fc;
+        fc.engine = engine;
+        std::unordered_map<int, errors> line_errors;
+
+        fc.process_function("chain", chain, line_errors);
+        fc.process_function("loop", loop, line_errors);
+        results[i++] = error_kinds(line_errors);
+    }
+    ASSERT_NE(results[0].size(), 0);
+    ASSERT_EQ(results[0], results[1]);
+
+    auto [bfs_seen, bfs_calls] = seen_states(loop, kBreadthFirst);
+    auto [dataflow_seen, dataflow_calls] = seen_states(loop, kDataflow);
+    ASSERT_EQ(bfs_seen, dataflow_seen);
+    ASSERT_EQ(bfs_calls, dataflow_calls);
+}
+
+TEST(test_explore, test_state_set) {
+    state_set visited;
+    std::set<uint64_t> expected;
+
+    // small keys that differ in only a few low bits, like packed states do
+    uint64_t x = 1;
+    for (int i = 0; i < 20000; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        uint64_t key = (x >> 40) & 0xfff;
+        if (i % 3 == 0) {
+            key <<= 32;
+        }
+        ASSERT_EQ(visited.insert(key), expected.insert(key).second);
+    }
+    ASSERT_EQ(visited.size(), expected.size());
+    for (auto key: expected) {
+        ASSERT_TRUE(visited.contains(key));
+        ASSERT_FALSE(visited.insert(key));
+    }
+    ASSERT_FALSE(visited.contains(1ull << 63));
+
+    size_t seen = 0;
+    visited.for_each([&](uint64_t key) {
+        ASSERT_EQ(expected.count(key), 1);
+        seen++;
+    });
+    ASSERT_EQ(seen, expected.size());
+}
+
+TEST(test_explore, test_state_key_layout) {
+    func_table<BasicAdapter> funcs;
+    auto layout = cfg<BasicAdapter>::build(take_check_give_chain(10), funcs).key_layout();
+    ASSERT_TRUE(layout.fits());
+    ASSERT_EQ(layout.fallible_bits, 10);
+    ASSERT_EQ(layout.lock_bits, 1);
+    ASSERT_EQ(layout.bb_bits, 5);
+
+    ASSERT_NE(layout.pack({1}, {0}, 0), layout.pack({0}, {1}, 0));
+    ASSERT_NE(layout.pack({0}, {1}, 0), layout.pack({0}, {0}, 1));
+}
+
+TEST(test_explore, test_block_transfer) {
+    const lock_state<lock> l0 = {1}, l1 = {2}, l2 = {4};
+
+    // give(1); take(0); take(1); give(2);
+    block_transfer t;
+    t.add(kUnlock, l1);
+    t.add(kLock, l0);
+    t.add(kLock, l1);
+    t.add(kUnlock, l2);
+    ASSERT_FALSE(t.replay);
+    ASSERT_EQ(t.must_hold, l1 | l2);
+    ASSERT_EQ(t.must_be_free, l0);
+    ASSERT_EQ(t.taken, l0 | l1);
+    ASSERT_TRUE(t.clean_for(l1 | l2));
+    ASSERT_EQ(t.apply(l1 | l2), l0 | l1);
+    ASSERT_FALSE(t.clean_for(l1)); // give(2) would be an error
+    ASSERT_FALSE(t.clean_for(l0 | l1 | l2)); // so would take(0)
+
+    // errors whatever the state is, and anything that isn't a take or give, always need a replay
+    block_transfer twice;
+    twice.add(kLock, l0);
+    twice.add(kLock, l0);
+    ASSERT_TRUE(twice.replay);
+    block_transfer call;
+    call.add(kCall, {0});
+    ASSERT_TRUE(call.replay);
+}
+
+TEST(test_explore, test_clean_blocks_match_replay) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    generator_options options;
+    options.bbs = 48;
+    options.loop_density = 0.2;
+    for (uint64_t seed = 1; seed <= 20; seed++) {
+        auto fun = random_func<BasicAdapter>(options, seed);
+        // add some stray takes and gives, so there are errors to find
+        generator_rng rng{seed};
+        for (int i = 0; i < 4; i++) {
+            auto& actions = fun.bbs[rng.below(fun.bbs.size() - 1)].actions;
+            const ix l = rng.below(options.locks);
+            const int loc = 1000 + i;
+            actions.insert(actions.begin() + rng.below(actions.size() + 1), rng.chance(0.5) ? a::lock_(loc, l) : a::unlock_(loc, l));
+        }
+        func_table<BasicAdapter> funcs;
+        const auto graph = cfg<BasicAdapter>::build(fun, funcs);
+
+        for (auto engine: {kBreadthFirst, kSymbolic, kDataflow}) {
+            std::set<std::pair<int, int>> replayed, stepped;
+            auto check = [](std::set<std::pair<int, int>>& errs) {
+                return [&errs](edge_state<BasicAdapter, int>& es, const action_ref<BasicAdapter>& a) {
+                    const auto held = es.cur_lock_state & a.lock_id.mask();
+                    if ((a.typ == kLock && held != 0) || (a.typ == kUnlock && held == 0) || (a.typ == kEnd && es.cur_lock_state != 0)) {
+                        errs.insert({a.loc, a.typ});
+                    }
+                };
+            };
+            int clean_blocks = 0;
+            auto on_clean = [&](const edge_state<BasicAdapter, int>&, const block_transfer&) {
+                clean_blocks++;
+            };
+
+            graph.explore_using<int>(engine, check(replayed), 0);
+            auto on_action = check(stepped);
+            graph.explore_using<int>(engine, clean_block_visitor<decltype(on_action), decltype(on_clean)>{on_action, on_clean}, 0);
+            ASSERT_EQ(replayed, stepped);
+            ASSERT_GT(clean_blocks, 0);
+        }
+    }
+}
+
+TEST(test_explore, test_cfg_layout) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    auto foo = func<BasicAdapter> {
+        .locks = { 0, 1 },
+        .bbs = {
+            { .next = { {1} } }, // 0
+            { // 1
+                .actions = {
+                    a::lock_(1, ix{1}),
+                    a::call_(2, "bar"),
+                    a::fallible_lock_(3, ix{0}, {2}),
+                },
+                .next = { {2}, {3}, {2} },
+            },
+            { // 2
+                .actions = {
+                    a::call_(4, "bar"),
+                    a::unlock_(5, ix{0}),
+                },
+                .next = { {3} },
+            },
+            { }, // 3
+        },
+        .start_bb = {0},
+        .end_bb = {3},
+        .end_line = 6,
+    };
+
+    func_table<BasicAdapter> funcs;
+    funcs.intern("baz");
+    auto g = cfg<BasicAdapter>::build(foo, funcs);
+
+    ASSERT_EQ(g.num_bbs(), 4);
+    ASSERT_EQ(g.num_actions(), 5);
+    ASSERT_EQ(g.fallible_calls, 3);
+    ASSERT_EQ(g.action_begin[1], 0);
+    ASSERT_EQ(g.action_end[1], 3);
+    ASSERT_EQ(g.action_begin[2], 3);
+    ASSERT_EQ(g.action_end[2], 5);
+    ASSERT_EQ(g.on_true[1], 2);
+    ASSERT_EQ(g.on_false[1], 3);
+    ASSERT_EQ(g.depends_on[1], 2);
+    ASSERT_EQ(g.on_false[2], -1);
+    ASSERT_EQ(g.depends_on[2], -1);
+
+    // both calls to bar share an id
+    ASSERT_EQ(funcs.size(), 2);
+    ASSERT_EQ(g.action_at(1).typ, kCall);
+    ASSERT_EQ(g.action_at(1).callee, g.action_at(3).callee);
+    ASSERT_EQ(funcs.name(g.action_at(1).callee), "bar");
+
+    auto fallible = g.action_at(2);
+    ASSERT_EQ(fallible.typ, kFallibleLock);
+    ASSERT_EQ(fallible.loc, 3);
+    ASSERT_EQ(*fallible.lock_id, 0);
+    ASSERT_EQ(*fallible.call_id, 2);
+    ASSERT_EQ(*g.action_at(4).lock_id, 0);
+    ASSERT_EQ(g.end_action().loc, 6);
+
+    // blocks can be added out of order, like gcc walks them
+    file_checker<BasicAdapter> fc;
+    cfg_builder<BasicAdapter> builder(fc.func_ids, 3);
+    builder.graph.locks = { 0 };
+    builder.begin_block(2);
+    builder.end_block({ {-1} });
+    builder.begin_block(1);
+    builder.lock_(1, ix{0});
+    builder.unlock_(2, ix{0});
+    builder.end_block({ {2} });
+    builder.begin_block(0);
+    builder.end_block({ {1} });
+
+    std::unordered_map<int, errors> line_errors;
+    fc.process_function("out_of_order", builder.finish({0}, {2}, 3), line_errors);
+    ASSERT_EQ(line_errors.size(), 0);
+    ASSERT_EQ(seen_states(foo, kBreadthFirst), seen_states(foo, kDataflow));
+}
+
+TEST_P(test_file_checker, test_call_sites_deduplicated) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    // foo() {
+    //      bool took = lock(5) == pdTRUE; // 1
+    //      g(); // 10
+    //      if (took) {
+    //          unlock(); // 11
+    //      }
+    //      g(); // 20
+    // }
+    auto foo = func<BasicAdapter> {
+        .locks = { 0 },
+        .bbs = {
+            { .next = { {1} } },
+            { .actions = { a::fallible_lock_(1, ix{0}, {0}) }, .next = { {2} } },
+            { .actions = { a::call_(10, std::string("g")) }, .next = { {3}, {4}, {0} } },
+            { .actions = { a::unlock_(11, ix{0}) }, .next = { {4} } },
+            { .actions = { a::call_(20, std::string("g")) }, .next = { {5} } },
+            { },
+        },
+        .start_bb = {0},
+        .end_bb = {5},
+    };
+    // g() {
+    //      lock(portMAX_DELAY); // 30
+    //      unlock(); // 31
+    // }
+    auto g = func<BasicAdapter> {
+        .locks = { 0 },
+        .bbs = {
+            { .next = { {1} } },
+            { .actions = { a::lock_(30, ix{0}), a::unlock_(31, ix{0}) }, .next = { {2} } },
+            { },
+        },
+        .start_bb = {0},
+        .end_bb = {2},
+    };
+
+    file_checker<BasicAdapter> fc;
+    fc.engine = GetParam();
+    std::unordered_map<int, errors> line_errors;
+
+    // the first call is reached with and without the lock held, but it's still one call site
+    fc.process_function("foo", foo, line_errors);
+    ASSERT_EQ(fc.called_by["g"].size(), 2);
+    for (const auto& cs: fc.called_by["g"]) {
+        ASSERT_EQ(cs.cur_lock_state, cs.loc == 10 ? 1 : 0);
+    }
+
+    // checking foo again replaces its call sites instead of adding more
+    fc.process_function("foo", foo, line_errors);
+    ASSERT_EQ(fc.called_by["g"].size(), 2);
+
+    fc.process_function("g", g, line_errors);
+    ASSERT_EQ(line_errors.size(), 1);
+    ASSERT_EQ(line_errors[10].errs.size(), 1);
+    ASSERT_EQ(line_errors[10].errs[0].typ, error::kCallWithBlockingLock);
+}
+
+// f0() { lock(); f1(); unlock(); }, fi() { f(i+1)(); }, ..., and the last one takes the lock
+static std::vector<std::pair<std::string, func<BasicAdapter>>> call_chain(int n) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    std::vector<std::pair<std::string, func<BasicAdapter>>> fs;
+    for (int i = 0; i < n; i++) {
+        std::vector<action<BasicAdapter>> actions;
+        if (i == 0) {
+            actions = { a::lock_(0, ix{0}), a::call_(1, std::string("f1")), a::unlock_(2, ix{0}) };
+        } else if (i + 1 < n) {
+            actions = { a::call_(i * 10, "f" + std::to_string(i + 1)) };
+        } else {
+            actions = { a::lock_(i * 10, ix{0}), a::unlock_(i * 10 + 1, ix{0}) };
+        }
+        fs.push_back({"f" + std::to_string(i), func<BasicAdapter> {
+            .locks = { 0 },
+            .bbs = {
+                { .next = { {1} } },
+                { .actions = actions, .next = { {2} } },
+                { },
+            },
+            .start_bb = {0},
+            .end_bb = {2},
+        }});
+    }
+    return fs;
+}
+
+TEST(test_check_callers, test_deep_chain) {
+    // callers first, so the lock taken at the bottom has to go all the way back up in one go;
+    // the recursive version of check_callers used to need one stack frame per function for this
+    auto fs = call_chain(20000);
+
+    file_checker<BasicAdapter> fc;
+    std::unordered_map<int, errors> line_errors;
+    for (auto& [name, fun]: fs) {
+        fc.process_function(name, std::move(fun), line_errors);
+    }
+
+    ASSERT_EQ(line_errors.size(), 1);
+    ASSERT_EQ(line_errors[1].errs.size(), 1);
+    ASSERT_EQ(line_errors[1].errs[0].typ, error::kCallWithBlockingLock);
+    ASSERT_EQ(fc.blocking_locks_used["f0"], 1);
+}
+
+TEST(test_check_callers, test_recursion) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    auto calls = [](int loc, std::vector<action<BasicAdapter>> actions) {
+        return func<BasicAdapter> {
+            .locks = { 0, 1 },
+            .bbs = {
+                { .next = { {1} } },
+                { .actions = actions, .next = { {2} } },
+                { },
+            },
+            .start_bb = {0},
+            .end_bb = {2},
+        };
+    };
+
+    // top() { lock(1); a(); unlock(1); }
+    // a() { b(); }
+    // b() { a(); c(); }
+    // c() { lock(0); unlock(0); lock(1); unlock(1); }
+    file_checker<BasicAdapter> fc;
+    std::unordered_map<int, errors> line_errors;
+    fc.process_function("top", calls(0, { a::lock_(0, ix{1}), a::call_(1, std::string("a")), a::unlock_(2, ix{1}) }), line_errors);
+    fc.process_function("a", calls(10, { a::call_(10, std::string("b")) }), line_errors);
+    fc.process_function("b", calls(20, { a::call_(20, std::string("a")), a::call_(21, std::string("c")) }), line_errors);
+    ASSERT_EQ(line_errors.size(), 0);
+
+    fc.process_function("c", calls(30, { a::lock_(30, ix{0}), a::unlock_(31, ix{0}), a::lock_(32, ix{1}), a::unlock_(33, ix{1}) }), line_errors);
+
+    // only the call made while holding lock 1 is an error, and it's reported once
+    ASSERT_EQ(line_errors.size(), 1);
+    ASSERT_EQ(line_errors[1].errs.size(), 1);
+    for (auto name: {"a", "b", "c", "top"}) {
+        ASSERT_EQ(fc.blocking_locks_used[name], 3);
+    }
+}
+
+// check_callers as it was before it was made iterative: every time a callee gains a lock, walk up
+// through its callers again, reporting each call made holding one of the callee's locks
+static void recursive_check_callers(file_checker<BasicAdapter>& fc, const std::string& callee, std::unordered_map<int, errors>& line_errors) {
+    if (const auto it = fc.called_by.find(callee); it != fc.called_by.end()) {
+        for (const auto& cs: it->second) {
+            if ((fc.blocking_locks_used[callee] & cs.cur_lock_state) != 0) {
+                line_errors[cs.loc].add(errors::call_with_blocking_lock("blocking lock used by caller"));
+            }
+            const auto old_locks = fc.blocking_locks_used[cs.caller];
+            fc.blocking_locks_used[cs.caller] = fc.blocking_locks_used[cs.caller] | fc.blocking_locks_used[callee];
+            if (old_locks != fc.blocking_locks_used[cs.caller]) {
+                recursive_check_callers(fc, cs.caller, line_errors);
+            }
+        }
+    }
+}
+
+TEST(test_check_callers, test_matches_recursive) {
+    using checker = file_checker<BasicAdapter>;
+
+    // a call graph with recursive cycles, a few leaves taking one of 4 locks, and some calls made
+    // holding one
+    generator_rng r{7};
+    const int n = 2000;
+    std::vector<std::pair<std::string, checker::function_summary>> fs;
+    checker names;
+    for (int i = 0; i < n; i++) {
+        checker::function_summary s;
+        if (r.below(100) < 5) {
+            s.blocking_locks = {1u << r.below(4)};
+        }
+        for (int c = 0, calls = 1 + r.below(3); c < calls; c++) {
+            const int callee = r.below(100) < 10 ? r.below(i + 1) : std::min(n - 1, i + 1 + r.below(50));
+            const uint32_t held = r.below(100) < 20 ? 1u << r.below(4) : 0;
+            s.calls.push_back({i * 10 + c, names.func_ids.intern("f" + std::to_string(callee)), {held}});
+        }
+        fs.push_back({"f" + std::to_string(i), std::move(s)});
+    }
+
+    using found = std::set<std::pair<int, int>>; // (location, error type)
+    auto unique = [](const std::unordered_map<int, errors>& line_errors) {
+        found out;
+        for (const auto& [loc, errs]: line_errors) {
+            for (const auto& e: errs.errs) {
+                out.insert({loc, e.typ});
+            }
+        }
+        return out;
+    };
+
+    // in either order, the iterative version may report a call fewer times but finds the same calls
+    for (const bool callers_first: {true, false}) {
+        if (!callers_first) {
+            std::reverse(fs.begin(), fs.end());
+        }
+        checker recursive, scc;
+        recursive.func_ids = scc.func_ids = names.func_ids;
+        recursive.add_locks(std::vector<int>{0, 1, 2, 3});
+        scc.add_locks(std::vector<int>{0, 1, 2, 3});
+        std::unordered_map<int, errors> recursive_errors, scc_errors;
+        for (const auto& [name, s]: fs) {
+            // merge, with the old propagation
+            lock_state<checker> blocking_locks = s.blocking_locks;
+            for (const auto& c: s.calls) {
+                const auto& called = recursive.func_ids.name(c.callee);
+                if (auto it = recursive.blocking_locks_used.find(called); it != recursive.blocking_locks_used.end()) {
+                    if ((c.held & it->second) != 0) {
+                        recursive_errors[c.loc].add(errors::call_with_blocking_lock(""));
+                    }
+                    blocking_locks = blocking_locks | it->second;
+                }
+                recursive.called_by[called].push_back(callsite<BasicAdapter>{c.loc, c.held, name});
+            }
+            recursive.blocking_locks_used[name] = blocking_locks;
+            recursive_check_callers(recursive, name, recursive_errors);
+
+            scc.merge(name, s, scc_errors);
+        }
+
+        ASSERT_GT(unique(scc_errors).size(), 10);
+        ASSERT_EQ(unique(scc_errors), unique(recursive_errors));
+        for (const auto& [name, _]: fs) {
+            ASSERT_EQ(scc.blocking_locks_used[name], recursive.blocking_locks_used[name]) << name;
+        }
+    }
+}
+
+TEST(test_file_checker_limits, test_too_many_locks) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    auto one_lock = [](int lock_id, std::vector<action<BasicAdapter>> actions) {
+        return func<BasicAdapter> {
+            .locks = { lock_id },
+            .bbs = {
+                { .next = { {1} } },
+                { .actions = actions, .next = { {2} } },
+                { },
+            },
+            .start_bb = {0},
+            .end_bb = {2},
+        };
+    };
+
+    // take<i>() { lock(i); unlock(i); } for 40 locks; past<i>() also calls take0()
+    for (const unsigned jobs: {1u, 4u}) {
+        file_checker<BasicAdapter> fc;
+        std::unordered_map<int, errors> line_errors;
+        std::vector<std::pair<std::string, cfg<BasicAdapter>>> batch;
+        for (int i = 0; i < 40; i++) {
+            const auto fun = i < 32
+                ? one_lock(i, { a::lock_(i * 10, ix{0}), a::unlock_(i * 10 + 1, ix{0}) })
+                : one_lock(i, { a::lock_(i * 10, ix{0}), a::unlock_(i * 10 + 1, ix{0}), a::call_(i * 10 + 2, std::string("take0")) });
+            batch.push_back({(i < 32 ? "take" : "past") + std::to_string(i), cfg<BasicAdapter>::build(fun, fc.func_ids)});
+        }
+        fc.process_functions(std::move(batch), line_errors, jobs);
+        ASSERT_EQ(fc.locks.size(), file_checker<BasicAdapter>::kMaxLocks);
+        ASSERT_EQ(fc.too_many_locks.size(), 8);
+        ASSERT_EQ(fc.too_many_locks[0], "past32");
+
+        // the functions that weren't checked still pass on what their callees block on
+        fc.process_function("top", one_lock(0, { a::lock_(1000, ix{0}), a::call_(1001, std::string("past35")), a::unlock_(1002, ix{0}) }), line_errors);
+        ASSERT_EQ(error_kinds(line_errors), (std::map<int, std::vector<int>>{{1001, {error::kCallWithBlockingLock}}}));
+        ASSERT_EQ(fc.blocking_locks_used["past35"], 1);
+    }
+}
+
+TEST_P(test_file_checker, test_lock_order) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    auto straight = [](std::vector<action<BasicAdapter>> actions) {
+        return func<BasicAdapter> {
+            .locks = { 0, 1 },
+            .bbs = {
+                { .next = { {1} } },
+                { .actions = actions, .next = { {2} } },
+                { },
+            },
+            .start_bb = {0},
+            .end_bb = {2},
+        };
+    };
+
+    // f() { lock(0); lock(1); unlock(1); unlock(0); }
+    // g() { lock(1); h(); unlock(1); }
+    // h() { lock(0); unlock(0); }
+    file_checker<BasicAdapter> fc;
+    fc.engine = GetParam();
+    std::unordered_map<int, errors> line_errors;
+    fc.process_function("f", straight({ a::lock_(1, ix{0}), a::lock_(2, ix{1}), a::unlock_(3, ix{1}), a::unlock_(4, ix{0}) }), line_errors);
+    fc.process_function("g", straight({ a::lock_(11, ix{1}), a::call_(12, std::string("h")), a::unlock_(13, ix{1}) }), line_errors);
+    ASSERT_EQ(fc.order_cycles.size(), 0);
+
+    // the cycle only shows up once h's lock is pushed up to the call in g
+    fc.process_function("h", straight({ a::lock_(21, ix{0}), a::unlock_(22, ix{0}) }), line_errors);
+    ASSERT_EQ(line_errors.size(), 0);
+    ASSERT_EQ(fc.order_cycles.size(), 1);
+    ASSERT_EQ(fc.order_cycles[0].locks, (std::vector<int>{1, 0}));
+    ASSERT_EQ(fc.order_cycles[0].sites, (std::vector<int>{12, 2}));
+
+    // seeing the same takes again doesn't report the cycle again
+    fc.order_cycles.clear();
+    fc.process_function("f", straight({ a::lock_(1, ix{0}), a::lock_(2, ix{1}), a::unlock_(3, ix{1}), a::unlock_(4, ix{0}) }), line_errors);
+    ASSERT_EQ(fc.order_cycles.size(), 0);
+
+    // an edge to a lock the checker doesn't have is dropped, rather than closing a cycle it can't name
+    fc.add_lock_order(5, 0, 31);
+    fc.add_lock_order(0, 5, 32);
+    ASSERT_EQ(fc.order_cycles.size(), 0);
+}
+
+TEST(test_lock_order, test_closure) {
+    // hundreds of locks, so rows take several words; the closure kept up as edges are added
+    // has to match a plain search, and a cycle is reported exactly when an edge closes one
+    constexpr uint32_t n = 300;
+    lock_order<int> order;
+    std::vector<std::vector<uint32_t>> edges(n);
+    auto reaches = [&](uint32_t from, uint32_t to) {
+        std::vector<bool> seen(n);
+        std::vector<uint32_t> stack = {from};
+        while (!stack.empty()) {
+            const uint32_t cur = stack.back();
+            stack.pop_back();
+            for (uint32_t next: edges[cur]) {
+                if (next == to) {
+                    return true;
+                }
+                if (!seen[next]) {
+                    seen[next] = true;
+                    stack.push_back(next);
+                }
+            }
+        }
+        return false;
+    };
+
+    generator_rng rng{1};
+    int cycles = 0;
+    for (int i = 0; i < 600; i++) {
+        // mostly low to high, so there are long chains and only some cycles
+        uint32_t held = rng.below(n), taken = rng.below(n);
+        if (held > taken && !rng.chance(0.05)) {
+            std::swap(held, taken);
+        }
+        const bool known = order.has_edge(held, taken);
+        const bool closes = held != taken && !known && reaches(taken, held);
+        const auto cycle = order.add(held, taken, i);
+        if (held != taken && !known) {
+            edges[held].push_back(taken);
+        }
+
+        ASSERT_EQ(cycle.has_value(), closes);
+        if (cycle) {
+            cycles++;
+            ASSERT_EQ(cycle->front().held, held);
+            ASSERT_EQ(cycle->front().taken, taken);
+            ASSERT_EQ(cycle->front().site, i);
+            ASSERT_EQ(cycle->back().taken, held);
+            for (size_t e = 1; e < cycle->size(); e++) {
+                ASSERT_EQ((*cycle)[e].held, (*cycle)[e - 1].taken);
+                ASSERT_TRUE(order.has_edge((*cycle)[e].held, (*cycle)[e].taken));
+            }
+        }
+    }
+    ASSERT_GT(cycles, 0);
+
+    for (uint32_t from = 0; from < n; from += 7) {
+        for (uint32_t to = 0; to < n; to++) {
+            ASSERT_EQ(order.reaches(from, to), reaches(from, to)) << from << " -> " << to;
+        }
+    }
+}
+
+TEST_P(test_file_checker, test_lock_free_functions) {
+    // f0 calls f1 with the lock held, f1..f3 only call the next function, f4 takes the lock
+    auto fs = call_chain(5);
+    for (const bool callers_first: {true, false}) {
+        if (!callers_first) {
+            std::reverse(fs.begin(), fs.end());
+        }
+
+        file_checker<BasicAdapter> full;
+        full.engine = GetParam();
+        std::unordered_map<int, errors> full_errors;
+        file_checker<BasicAdapter, collect_stats> skipping;
+        skipping.engine = GetParam();
+        std::unordered_map<int, errors> skipping_errors;
+        for (const auto& [name, fun]: fs) {
+            full.process_function(name, fun, full_errors);
+            if (name == "f0" || name == "f4") {
+                skipping.process_function(name, fun, skipping_errors);
+            } else {
+                const auto& call = fun.bbs[1].actions[0];
+                skipping.process_lock_free_function(name, {{call.loc, *call.called_func}}, skipping_errors);
+            }
+        }
+
+        ASSERT_EQ(full_errors.size(), 1);
+        ASSERT_EQ(error_kinds(full_errors), error_kinds(skipping_errors));
+        ASSERT_EQ(full.blocking_locks_used, skipping.blocking_locks_used);
+        ASSERT_TRUE(skipping.stats["f2"].skipped);
+        ASSERT_FALSE(skipping.stats["f4"].skipped);
+        ASSERT_EQ(skipping.function_locks.count("f2"), 0);
+    }
+}
+
+TEST_P(test_file_checker, test_stats) {
+    file_checker<BasicAdapter, collect_stats> fc;
+    fc.engine = GetParam();
+    std::unordered_map<int, errors> line_errors;
+
+    fc.process_function("chain", take_check_give_chain(3), line_errors);
+    fc.stats["caller"].extract_ms = 1.5;
+    fc.process_function("caller", call_chain(2)[0].second, line_errors);
+
+    const auto& chain = fc.stats["chain"];
+    ASSERT_EQ(chain.bbs, 8);
+    ASSERT_EQ(chain.actions, 6);
+    ASSERT_EQ(chain.fallible_calls, 3);
+    ASSERT_EQ(chain.callsites, 0);
+    ASSERT_GT(chain.explore.states_visited, 0);
+    ASSERT_GE(chain.explore.states_enqueued, chain.explore.states_visited);
+    ASSERT_GT(chain.explore.peak_frontier, 0);
+
+    const auto& caller = fc.stats["caller"];
+    ASSERT_EQ(caller.callsites, 1);
+    ASSERT_EQ(caller.extract_ms, 1.5);
+
+    char* buf = nullptr;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    fc.write_stats_json(out, "dir/\"unit\".c");
+    fclose(out);
+    const std::string json(buf, len);
+    free(buf);
+
+    ASSERT_EQ(json.find("{\"unit\": \"dir/\\\"unit\\\".c\""), 0) << json;
+    // one line per unit, so several units can share a file
+    ASSERT_EQ(json.find('\n'), json.size() - 1) << json;
+    // sorted by name
+    ASSERT_LT(json.find("\"name\": \"caller\""), json.find("\"name\": \"chain\"")) << json;
+    ASSERT_NE(json.find("\"fallible_calls\": 3"), std::string::npos) << json;
+    ASSERT_NE(json.find("\"extract_ms\": 1.500"), std::string::npos) << json;
+    ASSERT_NE(json.find("\"skipped_functions\": 0, \"skip_ratio\": 0.000"), std::string::npos) << json;
+}
+
+TEST(test_explore, test_stats_compile_away) {
+    // the default policy doesn't add anything to what's stored per function
+    ASSERT_TRUE(std::is_empty_v<no_stats::record>);
+    ASSERT_LT(sizeof(file_checker<BasicAdapter>::function_summary), sizeof(file_checker<BasicAdapter, collect_stats>::function_summary));
+}
+
+// n functions that call each other; some call while holding the lock, some take it with a blocking call,
+// and some are chains of fallible takes
+static std::vector<std::pair<std::string, func<BasicAdapter>>> random_functions(int n, unsigned seed) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    std::vector<std::pair<std::string, func<BasicAdapter>>> fs;
+    for (int i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        const int loc = i * 100;
+        const auto callee = "f" + std::to_string((seed >> 8) % n);
+        const auto other = "f" + std::to_string((seed >> 16) % n);
+
+        func<BasicAdapter> fun;
+        switch ((seed >> 4) % 4) {
+        case 0: // lock(); callee(); unlock();
+            fun = func<BasicAdapter> {
+                .locks = { 0 },
+                .bbs = {
+                    { .next = { {1} } },
+                    { .actions = { a::lock_(loc, ix{0}), a::call_(loc + 1, callee), a::unlock_(loc + 2, ix{0}) }, .next = { {2} } },
+                    { },
+                },
+                .start_bb = {0},
+                .end_bb = {2},
+            };
+            break;
+        case 1: // if (x) callee(); else other();
+            fun = func<BasicAdapter> {
+                .locks = { },
+                .bbs = {
+                    { .next = { {1}, {2} } },
+                    { .actions = { a::call_(loc, callee) }, .next = { {3} } },
+                    { .actions = { a::call_(loc + 1, other) }, .next = { {3} } },
+                    { },
+                },
+                .start_bb = {0},
+                .end_bb = {3},
+            };
+            break;
+        case 2: // lock(); unlock();
+            fun = func<BasicAdapter> {
+                .locks = { 0 },
+                .bbs = {
+                    { .next = { {1} } },
+                    { .actions = { a::lock_(loc, ix{0}), a::unlock_(loc + 1, ix{0}) }, .next = { {2} } },
+                    { },
+                },
+                .start_bb = {0},
+                .end_bb = {2},
+            };
+            break;
+        default:
+            fun = take_check_give_chain(4);
+            for (auto& b: fun.bbs) {
+                for (auto& act: b.actions) {
+                    act.loc += loc;
+                }
+            }
+            fun.bbs.back().actions.push_back(a::call_(loc + 50, callee));
+            break;
+        }
+        fs.push_back({"f" + std::to_string(i), fun});
+    }
+    return fs;
+}
+
+TEST_P(test_file_checker, test_parallel_matches_serial) {
+    for (unsigned seed = 0; seed < 4; seed++) {
+        auto fs = random_functions(300, seed);
+
+        file_checker<BasicAdapter> serial;
+        serial.engine = GetParam();
+        std::unordered_map<int, errors> serial_errors;
+        for (const auto& [name, fun]: fs) {
+            serial.process_function(name, fun, serial_errors);
+        }
+
+        for (unsigned threads: {1, 2, 8}) {
+            file_checker<BasicAdapter> parallel;
+            parallel.engine = GetParam();
+            std::vector<std::pair<std::string, cfg<BasicAdapter>>> batch;
+            for (const auto& [name, fun]: fs) {
+                batch.push_back({name, cfg<BasicAdapter>::build(fun, parallel.func_ids)});
+            }
+
+            std::unordered_map<int, errors> parallel_errors;
+            parallel.process_functions(std::move(batch), parallel_errors, threads);
+
+            ASSERT_EQ(error_kinds(serial_errors), error_kinds(parallel_errors));
+            ASSERT_EQ(serial.blocking_locks_used.size(), parallel.blocking_locks_used.size());
+            for (const auto& [name, used]: serial.blocking_locks_used) {
+                ASSERT_EQ(used, parallel.blocking_locks_used[name]);
+            }
+        }
+    }
+}
+
+TEST_P(test_file_checker, test_analysis_cache) {
+    char dir_template[] = "/tmp/lock_checker_cache_XXXXXX";
+    const std::string dir = mkdtemp(dir_template);
+    analysis_cache<BasicAdapter> cache(dir, [](int lock) {
+        return std::to_string(lock);
+    });
+
+    auto fs = random_functions(300, 7);
+    generator_options options;
+    options.bbs = 48;
+    for (auto& f: random_call_graph<BasicAdapter>(40, options, 3)) {
+        fs.push_back(std::move(f));
+    }
+    // the same functions with every line moved down, as if a header above them had changed
+    auto shifted = fs;
+    for (auto& [name, fun]: shifted) {
+        for (auto& bb: fun.bbs) {
+            for (auto& a: bb.actions) {
+                a.loc += 100000;
+            }
+        }
+        fun.end_line += 100000;
+    }
+
+    struct result {
+        std::map<int, std::vector<int>> errs;
+        std::map<std::string, uint32_t> blocking;
+        std::map<std::pair<uint32_t, uint32_t>, int> order;
+    };
+    auto run = [&](const std::vector<std::pair<std::string, func<BasicAdapter>>>& fs, analysis_cache<BasicAdapter>* with, unsigned threads) {
+        file_checker<BasicAdapter> fc;
+        fc.engine = GetParam();
+        fc.cache = with;
+        std::vector<std::pair<std::string, cfg<BasicAdapter>>> batch;
+        for (const auto& [name, fun]: fs) {
+            batch.push_back({name, cfg<BasicAdapter>::build(fun, fc.func_ids)});
+        }
+        std::unordered_map<int, errors> line_errors;
+        fc.process_functions(std::move(batch), line_errors, threads);
+
+        result r = {error_kinds(line_errors)};
+        for (const auto& [name, used]: fc.blocking_locks_used) {
+            r.blocking[name] = used.state;
+        }
+        for (const auto& [key, site]: fc.order.sites) {
+            r.order[{fc.locks[key >> 32], fc.locks[(uint32_t)key]}] = site;
+        }
+        return r;
+    };
+    auto expect_same = [](const result& a, const result& b) {
+        ASSERT_EQ(a.errs, b.errs);
+        ASSERT_EQ(a.blocking, b.blocking);
+        ASSERT_EQ(a.order, b.order);
+    };
+
+    const auto uncached = run(fs, nullptr, 1);
+    ASSERT_FALSE(uncached.errs.empty());
+
+    // the first run fills the cache, from several threads at once; functions that only differ in
+    // their lines share an entry, so some are hits already
+    expect_same(run(fs, &cache, 4), uncached);
+    ASSERT_GT(cache.hits, 0);
+    ASSERT_EQ(cache.hits + cache.misses, fs.size());
+    ASSERT_EQ(cache.stores, cache.misses);
+    ASSERT_EQ(cache.failed_stores, 0);
+
+    // after that everything's a hit, including with the lines moved
+    cache.hits = 0;
+    cache.misses = 0;
+    expect_same(run(fs, &cache, 1), uncached);
+    expect_same(run(shifted, &cache, 4), run(shifted, nullptr, 1));
+    ASSERT_EQ(cache.misses, 0);
+    ASSERT_EQ(cache.hits, 2 * fs.size());
+    ASSERT_EQ(cache.hit_rate(), 1.0);
+
+    // a different engine doesn't share entries
+    if (GetParam() != kApproximate) {
+        file_checker<BasicAdapter> fc;
+        fc.engine = kApproximate;
+        fc.cache = &cache;
+        std::unordered_map<int, errors> line_errors;
+        fc.process_function(fs[0].first, fs[0].second, line_errors);
+        ASSERT_EQ(cache.misses, 1);
+    }
+
+    // a damaged entry is a miss, and gets written again
+    file_checker<BasicAdapter> fc;
+    fc.engine = GetParam();
+    const auto fun = cfg<BasicAdapter>::build(fs[0].second, fc.func_ids);
+    const auto fp = cache.fingerprint(fun, fc.func_ids, fc.engine, fc.budget.max_states);
+    ASSERT_TRUE(cache.load(fp));
+    char name[40];
+    snprintf(name, sizeof(name), "/%02x/%016llx%016llx", (unsigned)(fp.key[0] >> 56), (unsigned long long)fp.key[0], (unsigned long long)fp.key[1]);
+    FILE* f = fopen((dir + name).c_str(), "r+");
+    ASSERT_NE(f, nullptr);
+    fputs("garbage", f);
+    fclose(f);
+    ASSERT_FALSE(cache.load(fp));
+    std::unordered_map<int, errors> line_errors;
+    fc.cache = &cache;
+    fc.process_function(fs[0].first, fs[0].second, line_errors);
+    ASSERT_TRUE(cache.load(fp));
+
+    ASSERT_EQ(system(("rm -rf " + dir).c_str()), 0);
+}
+
+TEST_P(test_file_checker, test_replay_corpus) {
+    auto fs = random_functions(300, 11);
+    generator_options options;
+    options.bbs = 48;
+    for (auto& f: random_call_graph<BasicAdapter>(40, options, 5)) {
+        fs.push_back(std::move(f));
+    }
+    const std::vector<std::pair<int, std::string>> lock_free_calls = {{900001, "f1"}, {900002, "f2"}};
+
+    // what the plugin would have found, and a recording of what it was given
+    file_checker<BasicAdapter> direct;
+    direct.engine = GetParam();
+    corpus_writer writer;
+    auto lock_name = [](int lock) {
+        return "lock" + std::to_string(lock);
+    };
+    auto where = [](int loc) {
+        return source_location{"f.c", (uint32_t)loc};
+    };
+    std::unordered_map<int, errors> direct_errors;
+    writer.add_lock_free_function("lock_free", lock_free_calls, where);
+    direct.process_lock_free_function("lock_free", lock_free_calls, direct_errors);
+    for (const auto& [name, fun]: fs) {
+        auto built = cfg<BasicAdapter>::build(fun, direct.func_ids);
+        writer.add_function(name, built, direct.func_ids, lock_name, where);
+        direct.process_function(name, std::move(built), direct_errors);
+    }
+    ASSERT_FALSE(direct_errors.empty());
+    const std::string first = writer.finish("f.c");
+    ASSERT_TRUE(writer.empty());
+    writer.add_lock_free_function("other", lock_free_calls, where);
+    const std::string corpus = first + writer.finish("g.c");
+
+    auto unit = corpus_unit::open(corpus.data(), corpus.size());
+    ASSERT_TRUE(unit);
+    ASSERT_EQ(unit->size, first.size());
+    ASSERT_EQ(unit->num_functions(), fs.size() + 1);
+    ASSERT_STREQ(unit->name(), "f.c");
+    auto second = corpus_unit::open(corpus.data() + unit->size, corpus.size() - unit->size);
+    ASSERT_TRUE(second);
+    ASSERT_STREQ(second->name(), "g.c");
+    ASSERT_EQ(unit->size + second->size, corpus.size());
+
+    for (unsigned jobs: {1, 4}) {
+        file_checker<ReplayAdapter> replayed;
+        replayed.engine = GetParam();
+        std::unordered_map<uint64_t, errors> replayed_errors;
+        ASSERT_TRUE(unit->replay(replayed, replayed_errors, jobs));
+
+        std::unordered_map<int, errors> by_line;
+        for (const auto& [loc, errs]: replayed_errors) {
+            ASSERT_STREQ(unit->string(loc >> 32), "f.c");
+            by_line[(uint32_t)loc] = errs;
+        }
+        ASSERT_EQ(error_kinds(by_line), error_kinds(direct_errors));
+        ASSERT_EQ(replayed.blocking_locks_used.size(), direct.blocking_locks_used.size());
+        for (const auto& [name, used]: direct.blocking_locks_used) {
+            ASSERT_EQ(used.state, replayed.blocking_locks_used[name].state);
+        }
+        ASSERT_EQ(replayed.order_cycles.size(), direct.order_cycles.size());
+    }
+
+    // a record cut short isn't a record, and one with a damaged function stops there
+    ASSERT_FALSE(corpus_unit::open(first.data(), first.size() - 4));
+    std::string damaged = first;
+    uint32_t bad_tag = 9;
+    memcpy(&damaged[4 * corpus_writer::kHeaderWords], &bad_tag, 4);
+    unit = corpus_unit::open(damaged.data(), damaged.size());
+    ASSERT_TRUE(unit);
+    file_checker<ReplayAdapter> replayed;
+    std::unordered_map<uint64_t, errors> replayed_errors;
+    ASSERT_FALSE(unit->replay(replayed, replayed_errors));
+}
+
+TEST(test_explore, test_slices) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+    using fx = idx<fallible_lock>;
+
+    // lock 0 is only taken, 1 is taken and branched on, 2 is given here and taken elsewhere
+    func_table<BasicAdapter> funcs;
+    const auto fun = cfg<BasicAdapter>::build(func<BasicAdapter> {
+        .locks = { 0, 1, 2 },
+        .bbs = {
+            { .actions = { a::lock_(1, ix{0}), a::fallible_lock_(2, ix{1}, fx{0}) }, .next = { {1}, {2}, {0} } },
+            { .actions = { a::call_(3, std::string("g")), a::unlock_(4, ix{1}) }, .next = { {2} } },
+            { .actions = { a::unlock_(5, ix{0}), a::unlock_(6, ix{2}) }, .next = { {3} } },
+            { },
+        },
+        .start_bb = {0},
+        .end_bb = {3},
+    }, funcs);
+
+    ASSERT_EQ(fun.branch_locks(), 2u);
+    const auto slices = fun.slices();
+    ASSERT_EQ(slices.size(), 2);
+    auto tags = [](const cfg<BasicAdapter>& c) {
+        return std::vector<int>(c.tags.begin(), c.tags.end());
+    };
+    // the slice for lock 0 keeps lock 1, which is branched on, and lock 2's give goes
+    ASSERT_EQ(tags(slices[0]), (std::vector<int>{kLock, kFallibleLock, kCall, kUnlock, kUnlock}));
+    ASSERT_EQ(tags(slices[1]), (std::vector<int>{kObservedLock, kFallibleLock, kCall, kUnlock, kUnlock}));
+    ASSERT_EQ(slices[1].operands[0], 0);
+    ASSERT_EQ(slices[1].locs[4], 6);
+    ASSERT_EQ(slices[1].on_true, fun.on_true);
+    ASSERT_EQ(slices[1].depends_on, fun.depends_on);
+    ASSERT_EQ(slices[1].transfers[0].observed, 1u);
+
+    // nothing to gain if only one lock isn't branched on
+    auto two_locks = fun;
+    two_locks.locks.pop_back();
+    ASSERT_TRUE(two_locks.slice({3}).slices().empty());
+    ASSERT_TRUE(cfg<BasicAdapter>::build(take_check_give_chain(4), funcs).slices().empty());
+}
+
+TEST_P(test_file_checker, test_sliced_matches_whole) {
+    auto fs = random_functions(300, 3);
+    generator_options options;
+    options.bbs = 48;
+    options.locks = 8;
+    options.fallible_takes = 3;
+    for (auto& f: random_call_graph<BasicAdapter>(60, options, 9)) {
+        fs.push_back(std::move(f));
+    }
+
+    struct result {
+        std::map<int, std::vector<int>> errs;
+        std::map<std::string, uint32_t> blocking;
+        std::set<std::pair<uint32_t, uint32_t>> order;
+        uint64_t states = 0;
+        size_t sliced = 0;
+    };
+    auto run = [&](bool slice_locks, unsigned threads) {
+        file_checker<BasicAdapter, collect_stats> fc;
+        fc.engine = GetParam();
+        fc.slice_locks = slice_locks;
+        std::unordered_map<int, errors> line_errors;
+        if (threads == 0) {
+            for (const auto& [name, fun]: fs) {
+                fc.process_function(name, fun, line_errors);
+            }
+        } else {
+            std::vector<std::pair<std::string, cfg<BasicAdapter>>> batch;
+            for (const auto& [name, fun]: fs) {
+                batch.push_back({name, cfg<BasicAdapter>::build(fun, fc.func_ids)});
+            }
+            fc.process_functions(std::move(batch), line_errors, threads);
+        }
+
+        result r = {error_kinds(line_errors)};
+        for (const auto& [name, used]: fc.blocking_locks_used) {
+            r.blocking[name] = used.state;
+        }
+        for (const auto& [key, site]: fc.order.sites) {
+            r.order.insert({fc.locks[key >> 32], fc.locks[(uint32_t)key]});
+        }
+        for (const auto& [name, st]: fc.stats) {
+            r.states += st.explore.states_visited;
+            r.sliced += st.slices != 0;
+        }
+        return r;
+    };
+    auto expect_same = [](const result& a, const result& b) {
+        ASSERT_EQ(a.errs, b.errs);
+        ASSERT_EQ(a.blocking, b.blocking);
+        ASSERT_EQ(a.order, b.order);
+    };
+
+    const auto whole = run(false, 0);
+    ASSERT_FALSE(whole.errs.empty());
+    ASSERT_EQ(whole.sliced, 0);
+    for (unsigned threads: {0, 1, 4}) {
+        const auto sliced = run(true, threads);
+        expect_same(sliced, whole);
+        ASSERT_GT(sliced.sliced, 0);
+    }
+}
+
+TEST_P(test_file_checker, test_sliced_states_add_up) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    // if (x) take(i); for each of n locks, so the whole function has 2^n lock states at the end
+    constexpr int n = 12;
+    func<BasicAdapter> fun = {};
+    for (int i = 0; i < n; i++) {
+        fun.locks.push_back(i);
+        fun.bbs.push_back({ .next = { {3 * i + 1}, {3 * i + 2} } });
+        fun.bbs.push_back({ .actions = { a::lock_(10 * i, ix{i}) }, .next = { {3 * i + 2} } });
+        fun.bbs.push_back({ .next = { {3 * i + 3} } });
+    }
+    fun.bbs.push_back({});
+    fun.start_bb = {0};
+    fun.end_bb = {3 * n};
+    fun.end_line = 1000;
+
+    auto run = [&](bool slice_locks, uint64_t max_states) {
+        file_checker<BasicAdapter, collect_stats> fc;
+        fc.engine = GetParam();
+        fc.slice_locks = slice_locks;
+        fc.budget.max_states = max_states;
+        std::unordered_map<int, errors> line_errors;
+        fc.process_function("f", fun, line_errors);
+        return std::make_tuple(error_kinds(line_errors), fc.stats["f"], fc.over_budget.size());
+    };
+    const auto [whole_errs, whole_stats, whole_over] = run(false, 0);
+    const auto [sliced_errs, sliced_stats, sliced_over] = run(true, 0);
+    ASSERT_EQ(sliced_errs, whole_errs);
+    ASSERT_EQ(sliced_errs.at(1000), std::vector<int>{error::kTakeWithoutGive});
+    ASSERT_EQ(sliced_stats.slices, n);
+    if (GetParam() == kBreadthFirst) {
+        ASSERT_GT(whole_stats.explore.states_visited, 1u << n);
+        ASSERT_LT(sliced_stats.explore.states_visited, 4 * n * (3 * n + 1));
+
+        // so a budget the whole function runs out of is plenty for its slices
+        ASSERT_EQ(std::get<2>(run(false, 10000)), 1);
+        ASSERT_EQ(std::get<2>(run(true, 10000)), 0);
+    }
+}
+
+// a location that keeps count of how many copies of it are alive, to see what the checker holds on to
+struct counted_location {
+    int line;
+    static inline int live = 0;
+
+    counted_location(int line_ = 0): line(line_) {
+        live++;
+    }
+    counted_location(const counted_location& other): line(other.line) {
+        live++;
+    }
+    counted_location& operator=(const counted_location&) = default;
+    ~counted_location() {
+        live--;
+    }
+
+    bool operator==(const counted_location& other) const {
+        return line == other.line;
+    }
+    bool operator<(const counted_location& other) const {
+        return line < other.line;
+    }
+};
+
+}
+
+template <> struct std::hash<lock_checker::counted_location> {
+    size_t operator()(const lock_checker::counted_location& loc) const {
+        return std::hash<int>()(loc.line);
+    }
+};
+
+namespace lock_checker {
+
+struct CountedAdapter {
+    using FuncId = std::string;
+    using Location = counted_location;
+    using LockId = int;
+};
+
+TEST_P(test_file_checker, test_bodies_freed) {
+    generator_options options;
+    options.bbs = 64;
+    const auto fs = random_call_graph<CountedAdapter>(40, options, 1);
+    const int before = counted_location::live;
+
+    for (unsigned threads: {0, 4}) {
+        file_checker<CountedAdapter> fc;
+        fc.engine = GetParam();
+        {
+            std::unordered_map<counted_location, errors> line_errors;
+            if (threads == 0) {
+                for (const auto& [name, fun]: fs) {
+                    fc.process_function(name, fun, line_errors);
+                }
+            } else {
+                std::vector<std::pair<std::string, cfg<CountedAdapter>>> batch;
+                for (const auto& [name, fun]: fs) {
+                    batch.push_back({name, cfg<CountedAdapter>::build(fun, fc.func_ids)});
+                }
+                fc.process_functions(std::move(batch), line_errors, threads);
+            }
+        }
+
+        // every location the checker still has is a call site or where one lock was first taken while
+        // holding another; none of the bodies are left
+        size_t callsites = 0;
+        for (const auto& [_, sites]: fc.called_by) {
+            callsites += sites.size();
+        }
+        size_t order_sites = fc.order.sites.size();
+        for (const auto& cycle: fc.order_cycles) {
+            order_sites += cycle.sites.size();
+        }
+        ASSERT_GT(callsites, 0);
+        ASSERT_EQ(counted_location::live - before, callsites + order_sites);
+        ASSERT_EQ(fc.function_locks.size(), fs.size());
+    }
+}
+
+TEST(test_work_pool, test_parallel_for) {
+    for (unsigned threads: {1, 3, 16}) {
+        std::vector<int> hits(1000, 0);
+        // uneven amounts of work so the threads have to steal
+        parallel_for(hits.size(), threads, [&](size_t i) {
+            volatile int spin = 0;
+            for (size_t k = 0; k < (i % 7) * 1000; k++) {
+                spin = spin + 1;
+            }
+            hits[i]++;
+        });
+        for (auto h: hits) {
+            ASSERT_EQ(h, 1);
+        }
+    }
+}
+
+// the value of t for one combination of call results, looked up the slow way
+static int64_t value_for(const truth_table& t, const std::map<int, bool>& results) {
+    size_t outcome = 0;
+    for (size_t i = 0; i < t.calls.size(); i++) {
+        if (results.at(t.calls[i])) {
+            outcome |= (size_t)1 << i;
+        }
+    }
+    for (const auto& [val, bits]: t.values) {
+        if ((bits[outcome / 64] >> (outcome % 64)) & 1) {
+            return val;
+        }
+    }
+    ADD_FAILURE() << "outcome " << outcome << " has no value";
+    return 0;
+}
+
+TEST(test_truth_table, test_long_chains) {
+    // take results with ids spread out, and enough of them that some outcome bits are whole words
+    const std::vector<int> takes = {0, 3, 4, 9, 12, 13, 20, 31, 32};
+
+    // each node is an op applied to two earlier nodes, or a take result or a constant
+    struct node {
+        char op;
+        int lhs, rhs;
+        int64_t val;
+    };
+    std::vector<node> nodes;
+    std::vector<truth_table> tables;
+    for (size_t i = 0; i < takes.size(); i++) {
+        nodes.push_back({'t', 0, 0, takes[i]});
+        tables.push_back(truth_table::call_result(takes[i]));
+    }
+    for (int64_t c = 0; c < 3; c++) {
+        nodes.push_back({'c', 0, 0, c});
+        tables.push_back(truth_table::constant(c));
+    }
+
+    unsigned seed = 1;
+    auto next = [&](unsigned n) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % n;
+    };
+    const char ops[] = {'+', '-', '=', '!'};
+    for (int i = 0; i < 300; i++) {
+        // mostly build on the last node so the chains get long, and sometimes reuse older ones
+        const int lhs = next(4) == 0 ? next(nodes.size()) : nodes.size() - 1;
+        const int rhs = next(nodes.size());
+        const char op = ops[next(4)];
+        nodes.push_back({op, lhs, rhs, 0});
+
+        auto t = truth_table::combine(tables[lhs], tables[rhs], [op](int64_t a, int64_t b) -> int64_t {
+            switch (op) {
+            case '+': return a + b;
+            case '-': return a - b;
+            case '=': return a == b;
+            default: return a != b;
+            }
+        });
+        ASSERT_TRUE(t.has_value());
+        tables.push_back(*t);
+    }
+
+    // check every node against evaluating the expression directly, for every combination of results
+    for (unsigned mask = 0; mask < (1u << takes.size()); mask++) {
+        std::map<int, bool> results;
+        for (size_t i = 0; i < takes.size(); i++) {
+            results[takes[i]] = (mask >> i) & 1;
+        }
+        std::vector<int64_t> expected;
+        for (const auto& n: nodes) {
+            int64_t v = 0;
+            switch (n.op) {
+            case 't': v = results[n.val]; break;
+            case 'c': v = n.val; break;
+            case '+': v = expected[n.lhs] + expected[n.rhs]; break;
+            case '-': v = expected[n.lhs] - expected[n.rhs]; break;
+            case '=': v = expected[n.lhs] == expected[n.rhs]; break;
+            case '!': v = expected[n.lhs] != expected[n.rhs]; break;
+            }
+            expected.push_back(v);
+        }
+        for (size_t i = 0; i < nodes.size(); i++) {
+            ASSERT_EQ(value_for(tables[i], results), expected[i]) << "node " << i << " mask " << mask;
+        }
+    }
+}
+
+TEST(test_truth_table, test_as_condition) {
+    auto plus = [](int64_t a, int64_t b) -> int64_t { return a + b; };
+    auto minus = [](int64_t a, int64_t b) -> int64_t { return a - b; };
+    auto eq = [](int64_t a, int64_t b) -> int64_t { return a == b; };
+    auto ne = [](int64_t a, int64_t b) -> int64_t { return a != b; };
+
+    const auto t1 = truth_table::call_result(1);
+    const auto t40 = truth_table::call_result(40);
+    const auto zero = truth_table::constant(0);
+    const auto one = truth_table::constant(1);
+
+    // if (take() == pdFALSE)
+    ASSERT_EQ(truth_table::combine(t40, zero, eq)->as_condition(), std::make_pair(40, false));
+    // if (take() != pdFALSE)
+    ASSERT_EQ(truth_table::combine(t40, zero, ne)->as_condition(), std::make_pair(40, true));
+
+    // if (a + b - a == 1) only depends on b, even though a shows up in it
+    auto sum = truth_table::combine(*truth_table::combine(t1, t40, plus), t1, minus);
+    ASSERT_EQ(sum->calls.size(), 2);
+    ASSERT_EQ(truth_table::combine(*sum, one, eq)->as_condition(), std::make_pair(40, true));
+
+    // if (a + b == 2) depends on both
+    auto both = truth_table::combine(*truth_table::combine(t1, t40, plus), truth_table::constant(2), eq);
+    ASSERT_FALSE(both->as_condition().has_value());
+
+    // if (a == a) is always true
+    auto same = truth_table::combine(t1, t1, eq);
+    ASSERT_FALSE(same->as_condition().has_value());
+    ASSERT_EQ(same->constant_value(), 1);
+
+    // the delay passed to a take is usually a constant
+    ASSERT_EQ(truth_table::combine(truth_table::constant(65000), truth_table::constant(535), plus)->constant_value(), 65535);
+}
+
+TEST(test_truth_table, test_too_many_calls) {
+    auto plus = [](int64_t a, int64_t b) -> int64_t { return a + b; };
+
+    truth_table sum = truth_table::constant(0);
+    for (int i = 0; i < (int)truth_table::kMaxCalls; i++) {
+        sum = *truth_table::combine(sum, truth_table::call_result(i), plus);
+    }
+    // the number of takes that succeeded
+    ASSERT_EQ(sum.values.size(), truth_table::kMaxCalls + 1);
+    ASSERT_FALSE(truth_table::combine(sum, truth_table::call_result(100), plus).has_value());
+}
+
+// a unit's file_checker after checking the given functions, each a straight line of actions over locks 0 and 1
+static file_checker<BasicAdapter> check_unit(const std::vector<std::pair<std::string, std::vector<action<BasicAdapter>>>>& fs, std::unordered_map<int, errors>& line_errors) {
+    file_checker<BasicAdapter> fc;
+    for (const auto& [name, actions]: fs) {
+        fc.process_function(name, func<BasicAdapter> {
+            .locks = { 0, 1 },
+            .bbs = {
+                { .next = { {1} } },
+                { .actions = actions, .next = { {2} } },
+                { },
+            },
+            .start_bb = {0},
+            .end_bb = {2},
+        }, line_errors);
+    }
+    return fc;
+}
+
+static std::string summary_bytes(const file_checker<BasicAdapter>& fc, const std::string& file) {
+    const char* names[] = {"shared", "other"};
+    return summarize_unit(fc, [&](int lock) {
+        return std::string(names[lock]);
+    }, [](const std::string& name) {
+        return name;
+    }, [&](int loc) {
+        return source_location{file, (uint32_t)loc};
+    }).serialize();
+}
+
+TEST(test_unit_summary, test_round_trip) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    // f() { lock(0); g(); unlock(0); lock(1); lock(0); unlock(0); unlock(1); }
+    std::unordered_map<int, errors> line_errors;
+    auto fc = check_unit({
+        {"f", { a::lock_(1, ix{0}), a::call_(2, std::string("g")), a::unlock_(3, ix{0}), a::lock_(4, ix{1}), a::lock_(5, ix{0}), a::unlock_(6, ix{0}), a::unlock_(7, ix{1}) }},
+    }, line_errors);
+    const std::string bytes = summary_bytes(fc, "a.c");
+    ASSERT_EQ(bytes.size() % 4, 0);
+
+    // followed by something else, which isn't part of it
+    const std::string padded = bytes + "trailing";
+    auto view = summary_view::open(padded.data(), padded.size());
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view->size, bytes.size());
+    ASSERT_EQ(view->num_locks(), 2);
+    ASSERT_STREQ(view->lock(0), "shared");
+    ASSERT_STREQ(view->lock(1), "other");
+
+    ASSERT_EQ(view->num_functions(), 1);
+    const auto f = view->function(0);
+    ASSERT_STREQ(view->string(f.name), "f");
+    ASSERT_EQ(f.blocking_locks, 3);
+    ASSERT_EQ(f.num_calls, 1);
+    const auto c = view->call(f.first_call);
+    ASSERT_STREQ(view->string(c.callee), "g");
+    ASSERT_STREQ(view->string(c.file), "a.c");
+    ASSERT_EQ(c.line, 2);
+    ASSERT_EQ(c.held, 1);
+
+    ASSERT_EQ(view->num_edges(), 1);
+    const auto e = view->edge(0);
+    ASSERT_STREQ(view->lock(e.held), "other");
+    ASSERT_STREQ(view->lock(e.taken), "shared");
+    ASSERT_EQ(e.line, 5);
+
+    // the same checker always gives the same bytes
+    ASSERT_EQ(summary_bytes(fc, "a.c"), bytes);
+
+    // truncated, or with an index out of range
+    ASSERT_FALSE(summary_view::open(bytes.data(), bytes.size() - 4));
+    ASSERT_FALSE(summary_view::open(bytes.data(), 16));
+    std::string bad = bytes;
+    bad[unit_summary::kHeaderWords * 4] = 100; // the first lock's name
+    ASSERT_FALSE(summary_view::open(bad.data(), bad.size()));
+    bad = bytes;
+    bad[0] = 'X';
+    ASSERT_FALSE(summary_view::open(bad.data(), bad.size()));
+}
+
+TEST(test_unit_summary, test_program_checker) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    // a.c:
+    // update() { lock(shared); log_event(); unlock(shared); }
+    // local() { lock(shared); take_shared(); unlock(shared); }
+    // take_shared() { lock(shared); unlock(shared); }
+    // first() { lock(shared); lock(other); unlock(other); unlock(shared); }
+    std::unordered_map<int, errors> a_errors;
+    auto unit_a = check_unit({
+        {"update", { a::lock_(1, ix{0}), a::call_(2, std::string("log_event")), a::unlock_(3, ix{0}) }},
+        {"local", { a::lock_(11, ix{0}), a::call_(12, std::string("take_shared")), a::unlock_(13, ix{0}) }},
+        {"take_shared", { a::lock_(21, ix{0}), a::unlock_(22, ix{0}) }},
+        {"first", { a::lock_(31, ix{0}), a::lock_(32, ix{1}), a::unlock_(33, ix{1}), a::unlock_(34, ix{0}) }},
+    }, a_errors);
+    ASSERT_EQ(a_errors.size(), 1); // the call in local(), which the unit finds on its own
+
+    // b.c:
+    // log_event() { lock(shared); unlock(shared); }
+    // second() { lock(other); lock(shared); unlock(shared); unlock(other); }
+    std::unordered_map<int, errors> b_errors;
+    auto unit_b = check_unit({
+        {"log_event", { a::lock_(1, ix{0}), a::unlock_(2, ix{0}) }},
+        {"second", { a::lock_(11, ix{1}), a::lock_(12, ix{0}), a::unlock_(13, ix{0}), a::unlock_(14, ix{1}) }},
+    }, b_errors);
+    ASSERT_EQ(b_errors.size(), 0);
+    ASSERT_EQ(unit_a.order_cycles.size() + unit_b.order_cycles.size(), 0);
+
+    // either order gives the same result
+    const std::string a_bytes = summary_bytes(unit_a, "a.c"), b_bytes = summary_bytes(unit_b, "b.c");
+    for (bool a_first: {true, false}) {
+        program_checker program;
+        for (const auto* bytes: a_first ? std::vector{&a_bytes, &b_bytes} : std::vector{&b_bytes, &a_bytes}) {
+            program.add_unit(*summary_view::open(bytes->data(), bytes->size()));
+        }
+        ASSERT_EQ(program.units, 2);
+
+        // only the call that blocks in the other file is new
+        const auto errs = program.new_errors();
+        ASSERT_EQ(errs.size(), 1);
+        ASSERT_EQ(errs[0].first, (source_location{"a.c", 2}));
+        ASSERT_EQ(errs[0].second.typ, error::kCallWithBlockingLock);
+        ASSERT_EQ(program.blocking_locks("update"), std::vector<std::string>{"shared"});
+
+        const auto cycles = program.new_cycles();
+        ASSERT_EQ(cycles.size(), 1);
+        ASSERT_EQ(cycles[0].locks.size(), 2);
+        std::set<source_location> sites(cycles[0].sites.begin(), cycles[0].sites.end());
+        ASSERT_EQ(sites, (std::set<source_location>{{"a.c", 32}, {"b.c", 12}}));
+    }
+}
+
+// a little endian ELF64 object with the given sections, in the layout a compiler would leave them
+static std::string elf_object(const std::vector<std::pair<std::string, std::string>>& sections) {
+    std::string names(1, '\0'), contents;
+    std::vector<Elf64_Shdr> headers(1, Elf64_Shdr{});
+    for (const auto& [name, data]: sections) {
+        Elf64_Shdr sh = {};
+        sh.sh_name = names.size();
+        sh.sh_type = SHT_PROGBITS;
+        sh.sh_offset = sizeof(Elf64_Ehdr) + contents.size();
+        sh.sh_size = data.size();
+        headers.push_back(sh);
+        names += name + '\0';
+        contents += data;
+    }
+    Elf64_Shdr strtab = {};
+    strtab.sh_name = names.size();
+    strtab.sh_type = SHT_STRTAB;
+    strtab.sh_offset = sizeof(Elf64_Ehdr) + contents.size();
+    names += std::string(".shstrtab") + '\0';
+    strtab.sh_size = names.size();
+    headers.push_back(strtab);
+    contents += names;
+
+    Elf64_Ehdr eh = {};
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS64;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_type = ET_REL;
+    eh.e_shoff = sizeof(Elf64_Ehdr) + contents.size();
+    eh.e_shentsize = sizeof(Elf64_Shdr);
+    eh.e_shnum = headers.size();
+    eh.e_shstrndx = headers.size() - 1;
+
+    std::string out((const char*)&eh, sizeof(eh));
+    out += contents;
+    out.append((const char*)headers.data(), headers.size() * sizeof(Elf64_Shdr));
+    return out;
+}
+
+TEST(test_unit_summary, test_program_more_than_32_locks) {
+    // every unit has a lock of its own, with a function that blocks on it
+    program_checker program;
+    std::vector<std::string> units;
+    for (int i = 0; i < 40; i++) {
+        unit_summary unit;
+        unit.locks.push_back(unit.intern("lock" + std::to_string(i)));
+        unit.functions.push_back({unit.intern("take" + std::to_string(i)), 1, 0, 0});
+        units.push_back(unit.serialize());
+    }
+    // caller() { lock(lock3); take35(); unlock(lock3); lock(lock35); take35(); unlock(lock35); }
+    unit_summary caller;
+    caller.locks = {caller.intern("lock3"), caller.intern("lock35")};
+    caller.functions.push_back({caller.intern("caller"), 3, 0, 2});
+    caller.calls.push_back({caller.intern("take35"), caller.intern("caller.c"), 1, 1});
+    caller.calls.push_back({caller.intern("take35"), caller.intern("caller.c"), 2, 2});
+    units.push_back(caller.serialize());
+    for (const auto& bytes: units) {
+        program.add_unit(*summary_view::open(bytes.data(), bytes.size()));
+    }
+    ASSERT_EQ(program.locks.size(), 40);
+    ASSERT_EQ(program.truncated_units, 0);
+
+    // lock35 isn't mistaken for lock3, or anything else
+    const auto errs = program.new_errors();
+    ASSERT_EQ(errs.size(), 1);
+    ASSERT_EQ(errs[0].first, (source_location{"caller.c", 2}));
+    ASSERT_EQ(program.blocking_locks("take35"), std::vector<std::string>{"lock35"});
+    ASSERT_EQ(program.blocking_locks("caller"), (std::vector<std::string>{"lock3", "lock35"}));
+    ASSERT_EQ(program.new_cycles().size(), 0);
+}
+
+TEST(test_unit_summary, test_object_sections) {
+    using a = action<BasicAdapter>;
+    using ix = idx<lock>;
+
+    std::unordered_map<int, errors> line_errors;
+    auto unit_a = check_unit({ {"update", { a::lock_(1, ix{0}), a::call_(2, std::string("log_event")), a::unlock_(3, ix{0}) }} }, line_errors);
+    auto unit_b = check_unit({ {"log_event", { a::lock_(1, ix{0}), a::unlock_(2, ix{0}) }} }, line_errors);
+    ASSERT_EQ(line_errors.size(), 0);
+    const std::string a_bytes = summary_bytes(unit_a, "a.c"), b_bytes = summary_bytes(unit_b, "b.c");
+
+    // a partially linked object has both summaries in one section, each padded out to the plugin's alignment
+    auto padded = [](std::string s) {
+        s.resize((s.size() + unit_summary::kSectionAlign - 1) / unit_summary::kSectionAlign * unit_summary::kSectionAlign, '\0');
+        return s;
+    };
+    ASSERT_NE(b_bytes.size() % unit_summary::kSectionAlign, 0); // so there is some padding to skip
+    const std::string object = elf_object({{".text", "code"}, {".lock_checker", padded(b_bytes) + padded(a_bytes)}, {".data", "1234"}});
+    const auto as_range = [](const std::string& s) {
+        return byte_range{(const uint8_t*)s.data(), s.size()};
+    };
+
+    auto section = find_elf_section(as_range(object), ".lock_checker");
+    ASSERT_TRUE(section);
+    ASSERT_EQ((const char*)section->data, object.data() + sizeof(Elf64_Ehdr) + 4); // not copied
+    auto summaries = split_summaries(section->data, section->size);
+    ASSERT_TRUE(summaries);
+    ASSERT_EQ(summaries->size(), 2);
+    ASSERT_EQ(std::string((const char*)summaries->at(1).data, summaries->at(1).size), a_bytes);
+
+    program_checker program;
+    for (const auto& unit: *summaries) {
+        program.add_unit(unit);
+    }
+    ASSERT_EQ(program.new_errors().size(), 1);
+    ASSERT_EQ(program.new_errors()[0].first, (source_location{"a.c", 2}));
+
+    ASSERT_FALSE(find_elf_section(as_range(object), ".lock_checke"));
+    ASSERT_FALSE(find_elf_section(as_range(elf_object({{".text", "code"}})), ".lock_checker"));
+    ASSERT_FALSE(find_elf_section(as_range(object.substr(0, object.size() - 8)), ".lock_checker"));
+    ASSERT_FALSE(find_elf_section(as_range(a_bytes), ".lock_checker"));
+    ASSERT_FALSE(split_summaries(object.data(), object.size()));
+
+    // the same object in an archive, after a symbol table, with an odd-sized member to pad after
+    auto member = [](const std::string& name, const std::string& data) {
+        char header[61];
+        snprintf(header, sizeof(header), "%-16s%-12d%-6d%-6d%-8o%-10zu`\n", name.c_str(), 0, 0, 0, 0644, data.size());
+        return std::string(header, 60) + data + (data.size() % 2 ? "\n" : "");
+    };
+    const std::string archive = "!<arch>\n" + member("/", "xyz") + member("a.o/", object) + member("b.o/", elf_object({{".lock_checker", b_bytes}}));
+    auto members = archive_members(as_range(archive));
+    ASSERT_TRUE(members);
+    ASSERT_EQ(members->size(), 2);
+    ASSERT_EQ(members->at(0).size, object.size());
+    ASSERT_TRUE(find_elf_section(members->at(0), ".lock_checker"));
+    section = find_elf_section(members->at(1), ".lock_checker");
+    ASSERT_TRUE(section);
+    ASSERT_EQ(std::string((const char*)section->data, section->size), b_bytes);
+    ASSERT_FALSE(archive_members(as_range(object)));
+}
+
+TEST(test_lock_api, test_parse_line) {
+    auto take = lock_api_registry::parse_line("rtos_mutex_lock take 3 lock=1 delay=2");
+    ASSERT_TRUE(take.has_value());
+    ASSERT_EQ(take->name, "rtos_mutex_lock");
+    ASSERT_EQ(take->kind, kTake);
+    ASSERT_EQ(take->nargs, 3);
+    ASSERT_EQ(take->lock_arg, 1);
+    ASSERT_EQ(take->delay_arg, 2);
+
+    // a take without a delay never waits
+    auto try_take = lock_api_registry::parse_line("\trtos_mutex_try_lock  take 1");
+    ASSERT_TRUE(try_take.has_value());
+    ASSERT_EQ(try_take->lock_arg, 0);
+    ASSERT_EQ(try_take->delay_arg, -1);
+
+    ASSERT_TRUE(lock_api_registry::parse_line("rtos_mutex_new create 0").has_value());
+    ASSERT_FALSE(lock_api_registry::parse_line("rtos_mutex_lock").has_value());
+    ASSERT_FALSE(lock_api_registry::parse_line("rtos_mutex_lock lock 1").has_value());
+    ASSERT_FALSE(lock_api_registry::parse_line("rtos_mutex_lock take x").has_value());
+    ASSERT_FALSE(lock_api_registry::parse_line("rtos_mutex_lock take 1 lock=1").has_value());
+    ASSERT_FALSE(lock_api_registry::parse_line("rtos_mutex_lock take 1 timeout=0").has_value());
+}
+
+TEST(test_lock_api, test_load) {
+    char path[] = "/tmp/lock_api_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    FILE* out = fdopen(fd, "w");
+    fprintf(out, "# wrappers\n\nrtos_mutex_lock take 2 delay=1 # blocks\nrtos_mutex_unlock give 1\nxSemaphoreGive give 2 lock=1\nnot an api\n");
+    fclose(out);
+
+    auto registry = lock_api_registry::freertos();
+    const size_t builtin = registry.apis.size();
+    ASSERT_TRUE(registry.load(path));
+    remove(path);
+    ASSERT_FALSE(registry.load(path));
+
+    // the bad line is skipped, and an entry with the same name as a built in one replaces it
+    ASSERT_EQ(registry.apis.size(), builtin + 2);
+    std::map<std::string, lock_api> by_name;
+    for (const auto& api: registry.apis) {
+        by_name[api.name] = api;
+    }
+    ASSERT_EQ(by_name["rtos_mutex_lock"].delay_arg, 1);
+    ASSERT_EQ(by_name["rtos_mutex_unlock"].kind, kGive);
+    ASSERT_EQ(by_name["xSemaphoreGive"].nargs, 2);
+    ASSERT_EQ(by_name["xSemaphoreGive"].lock_arg, 1);
+    ASSERT_EQ(by_name["xSemaphoreTake"].delay_arg, 1);
+}
+
+TEST(test_log, test_disabled_levels_do_nothing) {
+    int evaluated = 0;
+    auto arg = [&] {
+        evaluated++;
+        return 0;
+    };
+
+    log_verbosity = kQuiet;
+    LOCK_CHECKER_LOG(kWarnings, "%d", arg());
+    ASSERT_EQ(evaluated, 0);
+
+    log_verbosity = kWarnings;
+    LOCK_CHECKER_LOG(kDebug, "%d", arg());
+    ASSERT_EQ(evaluated, 0);
+    LOCK_CHECKER_LOG(kWarnings, "%d", arg());
+    ASSERT_EQ(evaluated, 1);
+    log_verbosity = kQuiet;
+}
 
 }
@@ -0,0 +1,23 @@
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+// checked together with test_lto_b.c by the check_lto target; neither file has an error on its own
+
+SemaphoreHandle_t shared;
+SemaphoreHandle_t other;
+
+void log_event(int v);
+
+void update(int v) {
+    xSemaphoreTake(shared, portMAX_DELAY);
+    // log_event takes shared as well, which only shows up once both files are linked
+    log_event(v);
+    xSemaphoreGive(shared);
+}
+
+void first(void) {
+    xSemaphoreTake(shared, portMAX_DELAY);
+    xSemaphoreTake(other, portMAX_DELAY);
+    xSemaphoreGive(other);
+    xSemaphoreGive(shared);
+}
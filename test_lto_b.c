@@ -0,0 +1,21 @@
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+extern SemaphoreHandle_t shared;
+extern SemaphoreHandle_t other;
+
+int events;
+
+void log_event(int v) {
+    xSemaphoreTake(shared, portMAX_DELAY);
+    events += v;
+    xSemaphoreGive(shared);
+}
+
+// the opposite order to first() in test_lto_a.c
+void second(void) {
+    xSemaphoreTake(other, portMAX_DELAY);
+    xSemaphoreTake(shared, portMAX_DELAY);
+    xSemaphoreGive(shared);
+    xSemaphoreGive(other);
+}
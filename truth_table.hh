@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+// the possible values of an expression built out of constants and the results of fallible lock calls
+//
+// each combination of call results (an outcome) is numbered by putting the result of calls[i] in
+// bit i of the number; for every distinct value the expression can have, the outcomes giving that
+// value are kept as a bitset with one bit per outcome, packed 64 to a word
+//
+// expressions over lock results only ever have a few distinct values, so combining two of them is
+// a few word-wide ands per pair of values instead of a loop over every outcome
+
+namespace lock_checker {
+
+struct truth_table {
+    using outcomes = std::vector<uint64_t>;
+
+    // each extra call doubles the size of the tables; conditions that depend on this many lock
+    // results aren't something the checker can do much with anyway
+    static constexpr size_t kMaxCalls = 16;
+
+    std::vector<int> calls; // fallible call ids, sorted
+    std::vector<std::pair<int64_t, outcomes>> values; // each value and the outcomes that give it
+
+    static size_t num_words(size_t num_calls) {
+        return num_calls <= 6 ? 1 : (size_t)1 << (num_calls - 6);
+    }
+    // the bits of the single word that are in use when there are fewer than 64 outcomes
+    static uint64_t used_bits(size_t num_calls) {
+        return num_calls >= 6 ? ~0ull : (1ull << (1u << num_calls)) - 1;
+    }
+
+    static truth_table constant(int64_t v) {
+        return {{}, {{v, {1}}}};
+    }
+    // the return value of a fallible take; pdFAIL (0) if it failed and pdPASS (1) if it succeeded
+    static truth_table call_result(int call) {
+        return {{call}, {{0, {0b01}}, {1, {0b10}}}};
+    }
+
+    // the value, if it's the same for every outcome
+    std::optional<int64_t> constant_value() const {
+        if (values.size() == 1) {
+            return values[0].first;
+        }
+        return std::nullopt;
+    }
+
+    // adds a call that the value doesn't depend on at position pos of calls
+    void insert_call(size_t pos, int call) {
+        const size_t n = calls.size();
+        for (auto& [_, bits]: values) {
+            bits = spread(bits, pos, n);
+        }
+        calls.insert(calls.begin() + pos, call);
+    }
+
+    // op applied to every outcome of a and b; nullopt if the result would depend on too many calls
+    template <typename F> static std::optional<truth_table> combine(const truth_table& a, const truth_table& b, F op) {
+        std::vector<int> merged;
+        size_t i = 0, j = 0;
+        while (i < a.calls.size() || j < b.calls.size()) {
+            if (j == b.calls.size() || (i < a.calls.size() && a.calls[i] < b.calls[j])) {
+                merged.push_back(a.calls[i++]);
+            } else if (i == a.calls.size() || b.calls[j] < a.calls[i]) {
+                merged.push_back(b.calls[j++]);
+            } else {
+                merged.push_back(a.calls[i++]);
+                j++;
+            }
+        }
+        if (merged.size() > kMaxCalls) {
+            return std::nullopt;
+        }
+
+        const truth_table wide_a = a.widen(merged);
+        const truth_table wide_b = b.widen(merged);
+
+        truth_table result = {merged, {}};
+        const size_t words = num_words(merged.size());
+        outcomes both(words);
+        for (const auto& [a_val, a_bits]: wide_a.values) {
+            for (const auto& [b_val, b_bits]: wide_b.values) {
+                bool any = false;
+                for (size_t w = 0; w < words; w++) {
+                    both[w] = a_bits[w] & b_bits[w];
+                    any |= both[w] != 0;
+                }
+                if (any) {
+                    result.add(op(a_val, b_val), both);
+                }
+            }
+        }
+        return result;
+    }
+
+    // if whether the value is nonzero depends on exactly one call, returns that call and whether
+    // the value is nonzero when the call succeeds
+    std::optional<std::pair<int, bool>> as_condition() const {
+        const size_t n = calls.size();
+        outcomes truth(num_words(n), 0);
+        for (const auto& [val, bits]: values) {
+            if (val != 0) {
+                for (size_t w = 0; w < truth.size(); w++) {
+                    truth[w] |= bits[w];
+                }
+            }
+        }
+
+        std::optional<size_t> only;
+        for (size_t i = 0; i < n; i++) {
+            if (depends_on(truth, i, n)) {
+                if (only) {
+                    return std::nullopt;
+                }
+                only = i;
+            }
+        }
+        if (!only) {
+            return std::nullopt;
+        }
+
+        // the value only depends on this call, so it's true either exactly when it succeeds or exactly when it fails
+        const bool true_on_success = *only < 6 ? (truth[0] & kSet[*only]) != 0 : truth[(size_t)1 << (*only - 6)] != 0;
+        return std::pair<int, bool>{calls[*only], true_on_success};
+    }
+
+    void dump() const {
+        fprintf(stderr, "[");
+        for (const auto& [val, bits]: values) {
+            size_t count = 0;
+            for (auto w: bits) {
+                count += __builtin_popcountll(w);
+            }
+            fprintf(stderr, "%lld x%zu ", (long long)val, count);
+        }
+        fprintf(stderr, "] over %zu calls", calls.size());
+    }
+
+private:
+    // outcomes with bit i set, for i < 6
+    static constexpr uint64_t kSet[6] = {
+        0xaaaaaaaaaaaaaaaaull,
+        0xccccccccccccccccull,
+        0xf0f0f0f0f0f0f0f0ull,
+        0xff00ff00ff00ff00ull,
+        0xffff0000ffff0000ull,
+        0xffffffff00000000ull,
+    };
+
+    void add(int64_t val, const outcomes& bits) {
+        for (auto& [v, existing]: values) {
+            if (v == val) {
+                for (size_t w = 0; w < bits.size(); w++) {
+                    existing[w] |= bits[w];
+                }
+                return;
+            }
+        }
+        values.push_back({val, bits});
+    }
+
+    // this table, with every call in all_calls (a sorted superset of calls) added
+    truth_table widen(const std::vector<int>& all_calls) const {
+        truth_table wide = *this;
+        for (size_t pos = 0; pos < all_calls.size(); pos++) {
+            if (pos == wide.calls.size() || wide.calls[pos] != all_calls[pos]) {
+                wide.insert_call(pos, all_calls[pos]);
+            }
+        }
+        return wide;
+    }
+
+    // copies each group of g bits in the low half of x to two neighbouring groups of the result
+    static uint64_t duplicate_groups(uint64_t x, unsigned g) {
+        static constexpr uint64_t kSpread[6] = {
+            0x5555555555555555ull, // 1
+            0x3333333333333333ull, // 2
+            0x0f0f0f0f0f0f0f0full, // 4
+            0x00ff00ff00ff00ffull, // 8
+            0x0000ffff0000ffffull, // 16
+            0x00000000ffffffffull, // 32
+        };
+        x &= kSpread[5];
+        // move group j up to group 2j, leaving a gap of g bits after every group
+        for (unsigned k = 16, level = 4; k >= g; k /= 2, level--) {
+            x = (x | (x << k)) & kSpread[level];
+        }
+        return x | (x << g);
+    }
+
+    // the outcome bitset over n + 1 calls, where the new call at position pos doesn't change anything
+    static outcomes spread(const outcomes& bits, size_t pos, size_t n) {
+        outcomes out(num_words(n + 1), 0);
+        if (pos >= 6) {
+            // whole runs of words are repeated
+            const size_t run = (size_t)1 << (pos - 6);
+            for (size_t w = 0; w < bits.size(); w += run) {
+                for (size_t k = 0; k < run; k++) {
+                    out[2 * w + k] = bits[w + k];
+                    out[2 * w + run + k] = bits[w + k];
+                }
+            }
+        } else {
+            // groups of 2^pos bits within each word are repeated, so every word turns into two
+            const unsigned g = 1u << pos;
+            for (size_t w = 0; w < bits.size(); w++) {
+                out[2 * w] = duplicate_groups(bits[w], g);
+                if (2 * w + 1 < out.size()) {
+                    out[2 * w + 1] = duplicate_groups(bits[w] >> 32, g);
+                }
+            }
+            out[0] &= used_bits(n + 1);
+        }
+        return out;
+    }
+
+    // whether flipping the result of calls[i] ever changes the bitset
+    static bool depends_on(const outcomes& bits, size_t i, size_t n) {
+        if (i < 6) {
+            const unsigned g = 1u << i;
+            for (auto w: bits) {
+                if ((((w >> g) ^ w) & ~kSet[i] & used_bits(n)) != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        const size_t stride = (size_t)1 << (i - 6);
+        for (size_t w = 0; w < bits.size(); w++) {
+            if ((w & stride) == 0 && bits[w] != bits[w + stride]) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "file_checker.hh"
+
+// what a translation unit passes on to a whole-program check: its locks, which of them each function
+// ends up taking with a blocking call, every call site with the locks held there, and the order locks
+// are taken in; no function bodies, so nothing has to be explored again once the units are put together
+//
+// everything is named by strings that mean the same thing in every unit (lock and function names,
+// file names), and the binary form is a flat run of little endian uint32s followed by a string table,
+// so a reader can use it in place:
+//
+//     magic version num_locks num_functions num_calls num_edges num_strings string_bytes
+//     locks[num_locks]                  string index of each lock; bit i of a mask is locks[i]
+//     functions[num_functions]          name blocking_locks first_call num_calls
+//     calls[num_calls]                  callee file line held
+//     edges[num_edges]                  held taken file line (lock indices)
+//     string_offsets[num_strings]
+//     string bytes, each NUL terminated, padded to a multiple of 4
+
+namespace lock_checker {
+
+struct source_location {
+    std::string file;
+    uint32_t line = 0;
+
+    bool operator==(const source_location& other) const {
+        return line == other.line && file == other.file;
+    }
+    bool operator<(const source_location& other) const {
+        return std::tie(file, line) < std::tie(other.file, other.line);
+    }
+};
+
+}
+
+template <> struct std::hash<lock_checker::source_location> {
+    size_t operator()(const lock_checker::source_location& loc) const {
+        return std::hash<std::string>()(loc.file) * 31 + loc.line;
+    }
+};
+
+namespace lock_checker {
+
+// the ids a whole-program check works with, once everything has been turned into names
+struct SummaryAdapter {
+    using FuncId = std::string;
+    using Location = source_location;
+    using LockId = std::string;
+};
+
+struct unit_summary {
+    static constexpr uint32_t kMagic = 0x534b434c; // "LCKS"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderWords = 8;
+    // what the plugin aligns each summary to in the .lock_checker section; summaries are only a multiple
+    // of 4 bytes long, so when the linker puts several together there's zero padding between them
+    static constexpr size_t kSectionAlign = 8;
+
+    struct function {
+        uint32_t name;
+        uint32_t blocking_locks; // mask over locks
+        uint32_t first_call, num_calls; // its calls are calls[first_call, first_call + num_calls)
+    };
+    struct call {
+        uint32_t callee, file, line;
+        uint32_t held; // mask over locks
+    };
+    struct order_edge {
+        uint32_t held, taken; // indices into locks
+        uint32_t file, line;
+    };
+
+    std::vector<std::string> strings;
+    std::vector<uint32_t> locks;
+    std::vector<function> functions;
+    std::vector<call> calls;
+    std::vector<order_edge> edges;
+
+    uint32_t intern(const std::string& s) {
+        if (auto it = string_ids.find(s); it != string_ids.end()) {
+            return it->second;
+        }
+        const uint32_t id = strings.size();
+        string_ids[s] = id;
+        strings.push_back(s);
+        return id;
+    }
+
+    std::string serialize() const {
+        std::vector<uint32_t> words = {
+            kMagic, kVersion,
+            (uint32_t)locks.size(), (uint32_t)functions.size(), (uint32_t)calls.size(),
+            (uint32_t)edges.size(), (uint32_t)strings.size(), 0,
+        };
+        words.insert(words.end(), locks.begin(), locks.end());
+        for (const auto& f: functions) {
+            words.insert(words.end(), {f.name, f.blocking_locks, f.first_call, f.num_calls});
+        }
+        for (const auto& c: calls) {
+            words.insert(words.end(), {c.callee, c.file, c.line, c.held});
+        }
+        for (const auto& e: edges) {
+            words.insert(words.end(), {e.held, e.taken, e.file, e.line});
+        }
+        std::string blob;
+        for (const auto& s: strings) {
+            words.push_back(blob.size());
+            blob += s;
+            blob += '\0';
+        }
+        blob.resize((blob.size() + 3) & ~(size_t)3, '\0');
+        words[7] = blob.size();
+
+        std::string out(words.size() * 4, '\0');
+        for (size_t i = 0; i < words.size(); i++) {
+            const uint32_t w = words[i];
+            const uint8_t bytes[4] = {(uint8_t)w, (uint8_t)(w >> 8), (uint8_t)(w >> 16), (uint8_t)(w >> 24)};
+            memcpy(&out[i * 4], bytes, 4);
+        }
+        return out + blob;
+    }
+
+private:
+    std::unordered_map<std::string, uint32_t> string_ids;
+};
+
+// a serialized unit_summary, read where it lies; open() checks every count and index once, so the
+// accessors don't have to
+struct summary_view {
+    const uint8_t* data = nullptr;
+    size_t size = 0; // of this summary, which may be followed by something else
+
+    static std::optional<summary_view> open(const void* p, size_t available) {
+        summary_view v;
+        v.data = (const uint8_t*)p;
+        if (available < unit_summary::kHeaderWords * 4 || v.word(0) != unit_summary::kMagic || v.word(1) != unit_summary::kVersion) {
+            return std::nullopt;
+        }
+        const uint64_t words = unit_summary::kHeaderWords + (uint64_t)v.num_locks() + 4ull * v.num_functions()
+            + 4ull * v.num_calls() + 4ull * v.num_edges() + v.num_strings();
+        const uint64_t total = words * 4 + v.word(7);
+        if (total > available || v.word(7) % 4 != 0) {
+            return std::nullopt;
+        }
+        v.size = total;
+
+        const uint32_t blob = v.word(7);
+        if (v.num_strings() > 0 && (blob == 0 || v.data[total - 1] != '\0')) {
+            return std::nullopt;
+        }
+        for (uint32_t i = 0; i < v.num_strings(); i++) {
+            if (v.word(v.strings_at() + i) >= blob) {
+                return std::nullopt;
+            }
+        }
+        for (uint32_t i = 0; i < v.num_locks(); i++) {
+            if (v.lock_string(i) >= v.num_strings()) {
+                return std::nullopt;
+            }
+        }
+        for (uint32_t i = 0; i < v.num_functions(); i++) {
+            const auto f = v.function(i);
+            if (f.name >= v.num_strings() || (uint64_t)f.first_call + f.num_calls > v.num_calls()) {
+                return std::nullopt;
+            }
+        }
+        for (uint32_t i = 0; i < v.num_calls(); i++) {
+            const auto c = v.call(i);
+            if (c.callee >= v.num_strings() || c.file >= v.num_strings()) {
+                return std::nullopt;
+            }
+        }
+        for (uint32_t i = 0; i < v.num_edges(); i++) {
+            const auto e = v.edge(i);
+            if (e.held >= v.num_locks() || e.taken >= v.num_locks() || e.file >= v.num_strings()) {
+                return std::nullopt;
+            }
+        }
+        return v;
+    }
+
+    uint32_t num_locks() const { return word(2); }
+    uint32_t num_functions() const { return word(3); }
+    uint32_t num_calls() const { return word(4); }
+    uint32_t num_edges() const { return word(5); }
+    uint32_t num_strings() const { return word(6); }
+
+    const char* string(uint32_t i) const {
+        return (const char*)data + (strings_at() + num_strings()) * 4 + word(strings_at() + i);
+    }
+    uint32_t lock_string(uint32_t i) const {
+        return word(unit_summary::kHeaderWords + i);
+    }
+    const char* lock(uint32_t i) const {
+        return string(lock_string(i));
+    }
+    unit_summary::function function(uint32_t i) const {
+        const size_t at = functions_at() + 4 * i;
+        return {word(at), word(at + 1), word(at + 2), word(at + 3)};
+    }
+    unit_summary::call call(uint32_t i) const {
+        const size_t at = functions_at() + 4 * ((size_t)num_functions() + i);
+        return {word(at), word(at + 1), word(at + 2), word(at + 3)};
+    }
+    unit_summary::order_edge edge(uint32_t i) const {
+        const size_t at = functions_at() + 4 * ((size_t)num_functions() + num_calls() + i);
+        return {word(at), word(at + 1), word(at + 2), word(at + 3)};
+    }
+
+private:
+    uint32_t word(size_t i) const {
+        uint8_t b[4];
+        memcpy(b, data + i * 4, 4);
+        return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+    }
+    size_t functions_at() const {
+        return unit_summary::kHeaderWords + num_locks();
+    }
+    size_t strings_at() const {
+        return functions_at() + 4 * ((size_t)num_functions() + num_calls() + num_edges());
+    }
+};
+
+// every summary in a run of them, as the linker leaves them when it puts the same section from several
+// objects together (each one padded with zeros to the section's alignment); nullopt if anything in
+// the run isn't a summary
+inline std::optional<std::vector<summary_view>> split_summaries(const void* p, size_t size) {
+    const uint8_t* data = (const uint8_t*)p;
+    std::vector<summary_view> views;
+    size_t at = 0;
+    while (at < size) {
+        if (data[at] == 0) {
+            at++;
+            continue;
+        }
+        auto view = summary_view::open(data + at, size - at);
+        if (!view) {
+            return std::nullopt;
+        }
+        views.push_back(*view);
+        at += view->size;
+    }
+    return views;
+}
+
+// the summary of everything a file_checker has seen
+//
+// lock_name, func_name and where turn the checker's lock ids, function ids and locations into
+// something that means the same thing in every unit (a std::string for the first two and a
+// source_location); functions, calls and edges are sorted so the same unit always gives the same bytes
+template <typename T, typename S, typename L, typename N, typename W>
+unit_summary summarize_unit(const file_checker<T, S>& fc, L lock_name, N func_name, W where) {
+    unit_summary out;
+    for (const auto& lock: fc.locks) {
+        out.locks.push_back(out.intern(lock_name(lock)));
+    }
+
+    std::map<std::string, std::vector<unit_summary::call>> calls_by_caller;
+    std::map<std::string, uint32_t> blocking;
+    for (const auto& [name, used]: fc.blocking_locks_used) {
+        blocking[func_name(name)] = used.state;
+    }
+    for (const auto& [callee, sites]: fc.called_by) {
+        const uint32_t callee_name = out.intern(func_name(callee));
+        for (const auto& site: sites) {
+            const source_location loc = where(site.loc);
+            calls_by_caller[func_name(site.caller)].push_back({callee_name, out.intern(loc.file), loc.line, site.cur_lock_state.state});
+        }
+    }
+
+    for (const auto& [name, used]: blocking) {
+        auto& calls = calls_by_caller[name];
+        std::sort(calls.begin(), calls.end(), [&](const auto& a, const auto& b) {
+            return std::tie(out.strings[a.file], a.line, out.strings[a.callee]) < std::tie(out.strings[b.file], b.line, out.strings[b.callee]);
+        });
+        out.functions.push_back({out.intern(name), used, (uint32_t)out.calls.size(), (uint32_t)calls.size()});
+        out.calls.insert(out.calls.end(), calls.begin(), calls.end());
+    }
+
+    std::vector<std::pair<uint64_t, source_location>> edges;
+    for (const auto& [key, site]: fc.order.sites) {
+        edges.push_back({key, where(site)});
+    }
+    std::sort(edges.begin(), edges.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+    for (const auto& [key, loc]: edges) {
+        out.edges.push_back({(uint32_t)(key >> 32), (uint32_t)key, out.intern(loc.file), loc.line});
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lock_checker {
+
+// calls f(i) for every i in [0, n), spread across up to num_threads threads (including the calling one)
+//
+// the indices are dealt out round robin to a queue per thread; a thread that empties its own queue
+// steals from the back of the others, so a few expensive items don't leave the rest of the threads idle
+template <typename F> void parallel_for(size_t n, unsigned num_threads, F f) {
+    num_threads = std::min<size_t>(num_threads, n);
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < n; i++) {
+            f(i);
+        }
+        return;
+    }
+
+    struct work_queue {
+        std::mutex m;
+        std::deque<size_t> items;
+    };
+    std::vector<work_queue> queues(num_threads);
+    for (size_t i = 0; i < n; i++) {
+        queues[i % num_threads].items.push_back(i);
+    }
+
+    auto next = [&](unsigned self, size_t& item) {
+        for (unsigned k = 0; k < num_threads; k++) {
+            auto& q = queues[(self + k) % num_threads];
+            std::lock_guard<std::mutex> guard(q.m);
+            if (q.items.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                item = q.items.front();
+                q.items.pop_front();
+            } else {
+                item = q.items.back();
+                q.items.pop_back();
+            }
+            return true;
+        }
+        return false;
+    };
+    auto worker = [&](unsigned self) {
+        size_t item;
+        while (next(self, item)) {
+            f(item);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < num_threads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& t: threads) {
+        t.join();
+    }
+}
+
+}